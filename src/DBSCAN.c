@@ -4,20 +4,26 @@
 #include "io.h"
 #include "countPoints.h"
 #include "clusters.h"
+#include "output.h"
+#include "options.h"
 
 int main(int argc, char ** argv) {
 	
-	if(argc != 7) {
+	Options opts;
+	initOptions(opts);
+	if(argc < 7 || !parseOptions(argc, argv, 7, opts)) {
 		printf("ERROR! Incorrect number of input arguments\n");
-		printf("DBSCAN inputEvents output searchRadius minPts minCorPointsInEachCluster nonCorePoints\n");
+		printf("DBSCAN inputEvents output searchRadius minPts minCorPointsInEachCluster nonCorePoints [options]\n");
+		printOptionsUsage();
+		return 1;
+	}
+	if(NULL != opts.summaryFile || opts.smoothBandwidth > 0 || opts.pipeline || opts.eventList) {
+		printf("ERROR! DBSCAN doesn't support -summary, -smooth, -pipeline or -eventList\n");
 		return 1;
 	}
 
 	double xMin = 999999999, yMin = 999999999, xMax = -999999999, yMax = -999999999;
 	
-	FILE * input;
-	FILE * output;
-
 	double radius = atof(argv[3]);
 	int minPts = atoi(argv[4]);
 	double minCore = atof(argv[5]);
@@ -26,64 +32,140 @@ int main(int argc, char ** argv) {
 		nonCorePoints = false;
 		
 
-	if(NULL == (input = fopen(argv[1], "r")))
-	{
-		printf("ERROR: Can't open the input file.\n");
-		exit(1);
-	}
-
-	int count = getCount(input, xMin, xMax, yMin, yMax);
-
 	double * x;
 	double * y;
-	
-	if(NULL == (x = (double *)malloc(sizeof(double) * count)))
-	{
-		printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
-		exit(1);
+
+	//the input may be an index file written by ESCIB_Index, which is mapped instead of read and indexed
+	PointIndex * saved = mapPointIndex(argv[1]);
+	if(opts.dedup && NULL != saved) {
+		printf("ERROR! -dedup can't be used with index files\n");
+		return 1;
 	}
-	if(NULL == (y = (double *)malloc(sizeof(double) * count)))
-	{
-		printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
-		exit(1);
+	if(opts.geo && (NULL != saved || opts.approxCells > 0 || opts.index == INDEX_KDTREE)) {
+		printf("ERROR! -geo can't be used with index files, -approx or -index kdtree\n");
+		return 1;
+	}
+	if(opts.sortX && (NULL != saved)) {
+		printf("ERROR! -sortX can't be used with index files\n");
+		return 1;
 	}
 
-	readPoints(input, x, y);
+	PointCount count = (NULL != saved) ? savedPoints(saved, x, y, xMin, xMax, yMin, yMax) : loadPoints(argv[1], x, y, xMin, xMax, yMin, yMax, opts.parallelRead);
+
+	//with -geo, longitudes are scaled while points are indexed so that each grid block covers the search radius (see initGeo), and put back from a copy for the output
+	Geo geo;
+	Geo * geoOrNull = NULL;
+	double * longitude = NULL;
+	if(opts.geo) {
+		initGeo(geo, radius, yMin, yMax);
+		toGeoGrid(geo, x, count, &longitude);
+		xMin *= geo.scale;
+		xMax *= geo.scale;
+		radius = geo.blockSize;
+		geoOrNull = &geo;
+	}
 
-	fclose(input);
-	
-	int nBlockX = ceil((xMax - xMin) / radius);
-	int nBlockY = ceil((yMax - yMin) / radius);
+	int nBlockX, nBlockY;
+	if(!gridBlocks(xMin, xMax, yMin, yMax, radius, nBlockX, nBlockY)) {
+		printf("ERROR! The grid of index blocks is too large, use a larger search radius\n");
+		return 1;
+	}
+	if(!matchPointIndex(saved, radius, xMin, yMin, nBlockX, nBlockY))
+		return 1;
 
-	int * index;
+	PointCount * index;
+	PointCount * order = NULL;
 
-	index = indexPoints(x, y, count, xMin, yMin, nBlockX, nBlockY, radius);
-	
-	int * countPoints = countInDistance_Single(x, y, index, nBlockX, nBlockY, radius);
+	//with -dedup, points at the same location are counted and clustered once, weighted by their number
+	PointCount nLocations = count;
+	PointCount * weight = NULL;
+	PointCount * location = NULL;
+	if(opts.dedup)
+	{
+		nLocations = dedupPoints(x, y, count, weight, location);
+		printf("Distinct locations: %lld\n", (long long)nLocations);
+	}
 
-	int * clusters = doClusterDBSCAN(x, y, index, nBlockX, nBlockY, radius, minPts, xMin, yMin, countPoints, minCore, nonCorePoints);
-	
-	//Output 
-	if(NULL == (output = fopen(argv[2], "w"))) {
-		printf("ERROR: Can't open the output file.\n");
-		exit(1);
+	if(NULL != saved) {
+		index = saved->index;
+		order = saved->order;
 	}
+	else
+		index = indexPoints(x, y, nLocations, xMin, yMin, nBlockX, nBlockY, radius, (opts.binaryOutput || opts.dedup || opts.geo) ? &order : NULL);
+	//with -sortX, each row strip of blocks is sorted by X for the searches
+	if(opts.sortX)
+		sortBlocksByX(x, y, index, nBlockX, nBlockY, order);
+	if(opts.dedup)
+		reorderValues(weight, order, nLocations);
 	
-	for(int i = 0; i < count; i++)
+	//a KD-tree replaces the grid blocks for highly concentrated points
+	KDTree * tree = useKDTree(opts, index, nBlockX, nBlockY) ? buildKDTree(x, y, nLocations, weight) : NULL;
+	if(NULL != tree)
+		printf("KD-tree index for event points\n");
+
+	//with -coreOnly, the points near each point are only counted up to minPts
+	PointCount * limit = NULL;
+	if(opts.coreOnly)
+	{
+		if(NULL == (limit = (PointCount *)malloc(sizeof(PointCount) * (nLocations + 1))))
+		{
+			printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+			exit(1);
+		}
+		for(PointCount i = 0; i < nLocations; i++)
+			limit[i] = minPts;
+	}
+
+	//with -approx, counts are summed on a lattice of cells, and only the points near the search circle are tested
+	PointCount * countPoints;
+	if(opts.approxCells > 0)
 	{
-		fprintf(output, "%lf,%lf,%d\n", x[i], y[i], clusters[i]);
+		Lattice * lattice = buildLattice(x, y, nLocations, weight, xMin, yMin, xMax, yMax, radius / opts.approxCells);
+		countPoints = countInDistance_Lattice(x, y, nLocations, lattice, radius);
+		freeLattice(lattice);
 	}
+	else
+		countPoints = (NULL != tree) ? countInDistance_KD(x, y, nLocations, tree, radius, limit) : countInDistance_Single(x, y, index, nBlockX, nBlockY, radius, limit, weight, geoOrNull, opts.sortX);
+	free(limit);
 
-	fclose(output);
+	int * clusters = doClusterDBSCAN(x, y, index, nBlockX, nBlockY, radius, minPts, xMin, yMin, countPoints, minCore, nonCorePoints, tree, weight, geoOrNull, opts.sortX);
+	if(opts.dedup)
+	{
+		PointCount * pointOrder = NULL;
+		int * pointClusters = expandDuplicates(clusters, x, y, count, location, order, nLocations, xMin, yMin, nBlockX, nBlockY, radius, opts.sortX, (opts.binaryOutput || opts.geo) ? &pointOrder : NULL);
+		free(clusters);
+		free(order);
+		free(location);
+		free(weight);
+		clusters = pointClusters;
+		order = pointOrder;
+	}
+	if(opts.geo)
+		fromGeoGrid(x, longitude, order, count);
+	
+	//Output 
+	if(opts.binaryOutput) {
+		writeLabelsBinary(argv[2], clusters, order, count, NULL, NULL, 0, opts.clusteredOnly);
+	}
+	else {
+		OutputBuffer * output = openOutput(argv[2]);
+		writeLabelsCSV(output, x, y, clusters, count, -1, opts.clusteredOnly);
+		closeOutput(output);
+	}
+	if(NULL == saved)
+		free(order);
 
 	free(clusters);
 
 
 
-	free(x);
-	free(y);
-
-	free(index);
+	if(NULL == saved) {
+		free(x);
+		free(y);
+		free(index);
+	}
+	closePointIndex(saved);
+	freeKDTree(tree);
 	free(countPoints);
 
 	return 0;
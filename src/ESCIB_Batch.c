@@ -0,0 +1,567 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "io.h"
+#include "countPoints.h"
+#include "clusters.h"
+#include "output.h"
+
+#define MODEL_POISSON 0
+#define MODEL_BERNOULLI 1
+
+//the most tokens of a manifest line
+#define BATCH_MAX_TOKENS 16
+//the longest message of a failed job
+#define BATCH_MAX_MESSAGE 128
+//freed blocks up to this size stay in the heap of a worker for its next jobs instead of going back to the system
+#define BATCH_MMAP_THRESHOLD (32 << 20)
+
+//one line of the manifest and its result
+struct Job {
+	char * line;			//the manifest line, which the strings below point into
+	const char * id;
+	int model;			//MODEL_POISSON or MODEL_BERNOULLI, -1 if the line has no valid model
+	const char * input[2];		//background and events (MODEL_POISSON), or cases and controls (MODEL_BERNOULLI)
+	const char * output;
+	const char * summaryFile;	//NULL for no summary
+	double radius;
+	double significance;
+	double baseLineRatio;
+	int minCore;
+	bool nonCorePoints;
+	long long bytes;		//the size of both inputs, used to schedule the job
+
+	bool ok;
+	char message[BATCH_MAX_MESSAGE];
+	PointCount count[2];
+	int clusters;
+	double seconds;
+	int worker;			//the worker running the job, -1 if it ran alone with all threads
+};
+
+//the jobs of one worker; the worker takes them from the head and other workers steal them from the tail
+struct JobQueue {
+	int * jobs;
+	int head;
+	int tail;
+	pthread_mutex_t lock;
+};
+
+//allocations a worker keeps from one job to the next
+struct Workspace {
+	OutputBuffer * out;
+};
+
+//the state shared by all workers
+struct Batch {
+	Job * jobs;
+	JobQueue * queues;
+	int nWorkers;
+};
+
+static Batch batch;
+
+/**
+ * NAME:	seconds
+ * DESCRIPTION:	get the time elapsed since a moment
+ * PARAMETERS:
+ * 	struct timespec & start:	the moment
+ * RETURN:
+ * 	TYPE:	double
+ * 	VALUE:	the elapsed time in seconds
+ */
+static double seconds(struct timespec & start)
+{
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+/**
+ * NAME:	failJob
+ * DESCRIPTION:	record why a job can't be run
+ * PARAMETERS:
+ * 	Job & job:		the job
+ * 	const char * message:	the reason
+ * RETURN: none
+ */
+static void failJob(Job & job, const char * message)
+{
+	job.ok = false;
+	snprintf(job.message, BATCH_MAX_MESSAGE, "%s", message);
+}
+
+/**
+ * NAME:	parseJob
+ * DESCRIPTION:	parse a manifest line "id poisson|bernoulli input1 input2 output radius alpha baselineRatio minCore nonCorePoints [summary file]" and check that its files can be opened, as the output functions exit on failure
+ * PARAMETERS:
+ * 	char * line:	the manifest line, kept by the job
+ * 	Job & job:	the job
+ * RETURN:
+ * 	TYPE:	bool
+ * 	VALUE:	true if the job can be run, otherwise job.message tells why not
+ */
+static bool parseJob(char * line, Job & job)
+{
+	memset(&job, 0, sizeof(Job));
+	job.line = line;
+	job.model = -1;
+	job.worker = -1;
+	job.ok = true;
+
+	char * save;
+	char * tokens[BATCH_MAX_TOKENS];
+	int nTokens = 0;
+	for(char * t = strtok_r(line, " \t\r\n", &save); NULL != t && nTokens < BATCH_MAX_TOKENS; t = strtok_r(NULL, " \t\r\n", &save))
+		tokens[nTokens ++] = t;
+	job.id = (nTokens > 0) ? tokens[0] : "?";
+	if(nTokens != 10 && !(nTokens == 12 && 0 == strcmp(tokens[10], "summary")))
+	{
+		failJob(job, "expected: id poisson|bernoulli input1 input2 output radius alpha baselineRatio minCore nonCorePoints [summary file]");
+		return false;
+	}
+
+	if(0 == strcmp(tokens[1], "poisson"))
+		job.model = MODEL_POISSON;
+	else if(0 == strcmp(tokens[1], "bernoulli"))
+		job.model = MODEL_BERNOULLI;
+	else
+	{
+		failJob(job, "unknown model");
+		return false;
+	}
+	job.input[0] = tokens[2];
+	job.input[1] = tokens[3];
+	job.output = tokens[4];
+	job.radius = atof(tokens[5]);
+	job.significance = atof(tokens[6]);
+	job.baseLineRatio = atof(tokens[7]);
+	job.minCore = atoi(tokens[8]);
+	job.nonCorePoints = (atoi(tokens[9]) != 0);
+	job.summaryFile = (nTokens == 12) ? tokens[11] : NULL;
+	if(!(job.radius > 0))
+	{
+		failJob(job, "invalid search radius");
+		return false;
+	}
+
+	struct stat st;
+	for(int s = 0; s < 2; s++)
+	{
+		FILE * file = fopen(job.input[s], "rb");
+		if(NULL == file || 0 != fstat(fileno(file), &st))
+		{
+			if(NULL != file)
+				fclose(file);
+			failJob(job, "can't open an input file");
+			return false;
+		}
+		fclose(file);
+		job.bytes += st.st_size;
+	}
+	for(int k = 0; k < 2; k++)
+	{
+		const char * fileName = (k == 0) ? job.output : job.summaryFile;
+		if(NULL == fileName)
+			continue;
+		FILE * file = fopen(fileName, "wb");
+		if(NULL == file)
+		{
+			failJob(job, "can't open an output file");
+			return false;
+		}
+		fclose(file);
+	}
+	return true;
+}
+
+/**
+ * NAME:	runJob
+ * DESCRIPTION:	run one job the same way as ESCIB_Poisson or ESCIB_Bernoulli with default options, writing the same output (and cluster summary) files. A large job (run by no worker) parses its inputs with all threads
+ * PARAMETERS:
+ * 	Job & job:		the job
+ * 	Workspace & ws:		the allocations kept by the worker running the job
+ * RETURN: none
+ */
+static void runJob(Job & job, Workspace & ws)
+{
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	double xMin = 999999999, yMin = 999999999, xMax = -999999999, yMax = -999999999;
+	double * x[2];
+	double * y[2];
+	const char * readError[2];
+	for(int s = 0; s < 2; s++)
+		job.count[s] = loadPoints(job.input[s], x[s], y[s], xMin, xMax, yMin, yMax, job.worker < 0, &readError[s]);
+	//indexPoints exits on a grid that is too large, so it is checked here
+	double radius = job.radius;
+	int nBlockX, nBlockY;
+	const char * error = NULL;
+	if(NULL != readError[0] || NULL != readError[1])
+		error = (NULL != readError[0]) ? readError[0] : readError[1];
+	else if(job.count[0] == 0 || job.count[1] == 0)
+		error = "an input file has no points";
+	else if(!gridBlocks(xMin, xMax, yMin, yMax, radius, nBlockX, nBlockY))
+		error = "the grid of index blocks is too large for the search radius";
+	if(NULL != error)
+	{
+		failJob(job, error);
+		for(int s = 0; s < 2; s++)
+		{
+			free(x[s]);
+			free(y[s]);
+		}
+		job.seconds = seconds(start);
+		return;
+	}
+
+	PointCount * index[2];
+	for(int s = 0; s < 2; s++)
+		index[s] = indexPoints(x[s], y[s], job.count[s], xMin, yMin, nBlockX, nBlockY, radius);
+
+	ClusterSummaries summaries;
+	initClusterSummaries(summaries);
+	ClusterSummaries * summariesOrNull = (NULL != job.summaryFile) ? &summaries : NULL;
+	int * clusters;
+	PointCount nPoints;
+	if(NULL == ws.out)
+		ws.out = openOutput(job.output);
+	else
+		reopenOutput(ws.out, job.output);
+	if(job.model == MODEL_POISSON)
+	{
+		//0: background, 1: events
+		PointCount countB = job.count[0];
+		PointCount countE = job.count[1];
+		PointCount * countPointsE = countInDistance_Single(x[1], y[1], index[1], nBlockX, nBlockY, radius);
+		PointCount * countPointsB = countInDistance_Double(x[1], y[1], x[0], y[0], index[1], index[0], nBlockX, nBlockY, radius);
+		double * lambda;
+		if(NULL == (lambda = (double *)malloc(sizeof(double) * (countE + 1))))
+		{
+			printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+			exit(1);
+		}
+		for(PointCount i = 0; i < countE; i++)
+			lambda[i] = (double)(countPointsB[i]) * countE * job.baseLineRatio / countB;
+		clusters = doClusterPoi(x[1], y[1], index[1], nBlockX, nBlockY, radius, xMin, yMin, countPointsE, lambda, job.significance, job.minCore, job.nonCorePoints, summariesOrNull);
+		nPoints = countE;
+		writeLabelsCSV(ws.out, x[1], y[1], clusters, countE, -1, false);
+		free(countPointsE);
+		free(countPointsB);
+		free(lambda);
+	}
+	else
+	{
+		//0: cases, 1: controls
+		PointCount countCas = job.count[0];
+		PointCount countCon = job.count[1];
+		PointCount * countPointsCas = countInDistance_Single(x[0], y[0], index[0], nBlockX, nBlockY, radius);
+		PointCount * countPointsCon = countInDistance_Double(x[0], y[0], x[1], y[1], index[0], index[1], nBlockX, nBlockY, radius);
+		double p = job.baseLineRatio * countCas / (countCas + countCon);
+		clusters = doClusterBer(x[0], y[0], index[0], x[1], y[1], index[1], nBlockX, nBlockY, radius, xMin, yMin, countPointsCas, countPointsCon, p, job.significance, job.minCore, job.nonCorePoints, summariesOrNull);
+		nPoints = countCas + (job.nonCorePoints ? countCon : 0);
+		writeLabelsCSV(ws.out, x[0], y[0], clusters, countCas, 1, false);
+		if(job.nonCorePoints)
+			writeLabelsCSV(ws.out, x[1], y[1], clusters + countCas, countCon, 0, false);
+		free(countPointsCas);
+		free(countPointsCon);
+	}
+	finishOutput(ws.out);
+	if(NULL != job.summaryFile)
+	{
+		writeClusterSummary(job.summaryFile, summaries);
+		freeClusterSummaries(summaries);
+	}
+
+	job.clusters = 0;
+	for(PointCount i = 0; i < nPoints; i++)
+	{
+		if(clusters[i] > job.clusters)
+			job.clusters = clusters[i];
+	}
+	free(clusters);
+	for(int s = 0; s < 2; s++)
+	{
+		free(x[s]);
+		free(y[s]);
+		free(index[s]);
+	}
+	job.seconds = seconds(start);
+}
+
+/**
+ * NAME:	takeJob
+ * DESCRIPTION:	get the next job of a worker from its own queue or, once that is empty, steal the last job of another worker's queue. Jobs are never added after the workers start, so no job left in any queue means the batch is done
+ * PARAMETERS:
+ * 	int w:		the worker
+ * 	int &job:	set to the job taken
+ * RETURN:
+ * 	TYPE:	bool
+ * 	VALUE:	true if a job was taken
+ */
+static bool takeJob(int w, int &job)
+{
+	JobQueue & own = batch.queues[w];
+	pthread_mutex_lock(&own.lock);
+	bool found = own.head < own.tail;
+	if(found)
+		job = own.jobs[own.head ++];
+	pthread_mutex_unlock(&own.lock);
+
+	for(int k = 1; k < batch.nWorkers && !found; k++)
+	{
+		JobQueue & victim = batch.queues[(w + k) % batch.nWorkers];
+		pthread_mutex_lock(&victim.lock);
+		found = victim.head < victim.tail;
+		if(found)
+			job = victim.jobs[-- victim.tail];
+		pthread_mutex_unlock(&victim.lock);
+	}
+	return found;
+}
+
+/**
+ * NAME:	worker
+ * DESCRIPTION:	the thread function of a worker: run jobs one at a time, each with a single thread, until no job is left
+ * PARAMETERS:
+ * 	void * arg: the worker number
+ * RETURN:
+ * 	TYPE:	void *
+ * 	VALUE:	NULL
+ */
+static void * worker(void * arg)
+{
+	int w = (int)(long)arg;
+#ifdef _OPENMP
+	//small jobs run side by side, so each of them keeps to its own thread
+	omp_set_num_threads(1);
+#endif
+	Workspace ws;
+	ws.out = NULL;
+	int job;
+	while(takeJob(w, job))
+	{
+		batch.jobs[job].worker = w;
+		runJob(batch.jobs[job], ws);
+	}
+	if(NULL != ws.out)
+		closeOutput(ws.out);
+	return NULL;
+}
+
+/**
+ * NAME:	compareJobSize
+ * DESCRIPTION:	order job numbers by the size of their inputs, largest first, for qsort
+ * PARAMETERS:
+ * 	const void * a:	a job number
+ * 	const void * b:	another job number
+ * RETURN:
+ * 	TYPE:	int
+ * 	VALUE:	negative if a goes first, positive if b goes first, 0 if the same
+ */
+static int compareJobSize(const void * a, const void * b)
+{
+	long long sa = batch.jobs[*(const int *)a].bytes;
+	long long sb = batch.jobs[*(const int *)b].bytes;
+	if(sa != sb)
+		return (sa > sb) ? -1 : 1;
+	return *(const int *)a - *(const int *)b;
+}
+
+/**
+ * NAME:	writeReport
+ * DESCRIPTION:	write the result of every job as a csv with a header row, one row per manifest line in manifest order
+ * PARAMETERS:
+ * 	const char * fileName:	the report file name
+ * 	int nJobs:		the number of jobs
+ * RETURN: none
+ */
+static void writeReport(const char * fileName, int nJobs)
+{
+	FILE * file;
+	if(NULL == (file = fopen(fileName, "w")))
+	{
+		printf("ERROR: Can't open the report file.\n");
+		exit(1);
+	}
+	fprintf(file, "id,model,status,points1,points2,clusters,seconds,worker,message\n");
+	for(int i = 0; i < nJobs; i++)
+	{
+		Job & job = batch.jobs[i];
+		const char * model = (job.model == MODEL_POISSON) ? "poisson" : ((job.model == MODEL_BERNOULLI) ? "bernoulli" : "");
+		fprintf(file, "%s,%s,%s,%lld,%lld,%d,%.3lf,%d,%s\n", job.id, model, job.ok ? "OK" : "ERROR", (long long)job.count[0], (long long)job.count[1], job.clusters, job.seconds, job.worker, job.message);
+	}
+	fclose(file);
+}
+
+int main(int argc, char ** argv) {
+
+	int nThreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	double largeMB = 64;
+	bool badArgs = (argc < 3);
+	for(int i = 3; i < argc && !badArgs; i++)
+	{
+		if(0 == strcmp(argv[i], "-threads") && i + 1 < argc)
+			nThreads = atoi(argv[++i]);
+		else if(0 == strcmp(argv[i], "-largeMB") && i + 1 < argc)
+			largeMB = atof(argv[++i]);
+		else
+			badArgs = true;
+	}
+	if(badArgs) {
+		printf("ERROR! Incorrect input arguments\n");
+		printf("ESCIB_Batch manifest report [-threads n] [-largeMB n]\n");
+		printf("Jobs, one per line: id poisson|bernoulli input1 input2 output searchRadius significance(alpha) baselineRatio minCorPointsInEachCluster nonCorePoints [summary file]\n");
+		return 1;
+	}
+	if(nThreads < 1)
+		nThreads = 1;
+
+	FILE * manifest;
+	if(NULL == (manifest = fopen(argv[1], "r")))
+	{
+		printf("ERROR: Can't open the manifest.\n");
+		return 1;
+	}
+	int nJobs = 0;
+	int capacity = 256;
+	if(NULL == (batch.jobs = (Job *)malloc(sizeof(Job) * capacity)))
+	{
+		printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+		exit(1);
+	}
+	char * line = NULL;
+	size_t size = 0;
+	while(getline(&line, &size, manifest) > 0)
+	{
+		size_t skip = strspn(line, " \t\r\n");
+		if(line[skip] == 0 || line[skip] == '#')
+			continue;
+		if(nJobs == capacity)
+		{
+			capacity *= 2;
+			if(NULL == (batch.jobs = (Job *)realloc(batch.jobs, sizeof(Job) * capacity)))
+			{
+				printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+				exit(1);
+			}
+		}
+		parseJob(line, batch.jobs[nJobs ++]);
+		line = NULL;
+		size = 0;
+	}
+	free(line);
+	fclose(manifest);
+
+	//jobs to run, largest first
+	int * order;
+	if(NULL == (order = (int *)malloc(sizeof(int) * (nJobs + 1))))
+	{
+		printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+		exit(1);
+	}
+	int nRun = 0;
+	for(int i = 0; i < nJobs; i++)
+	{
+		if(batch.jobs[i].ok)
+			order[nRun ++] = i;
+	}
+	qsort(order, nRun, sizeof(int), compareJobSize);
+	long long largeBytes = (long long)(largeMB * 1024 * 1024);
+	int nLarge = 0;
+	while(nLarge < nRun && batch.jobs[order[nLarge]].bytes >= largeBytes)
+		nLarge ++;
+
+	printf("Jobs: %d (%d large, %d invalid)\n", nJobs, nLarge, nJobs - nRun);
+	printf("Threads: %d\n", nThreads);
+	fflush(stdout);
+
+	//freed memory is kept by each thread for its next jobs
+	mallopt(M_MMAP_THRESHOLD, BATCH_MMAP_THRESHOLD);
+	mallopt(M_TRIM_THRESHOLD, BATCH_MMAP_THRESHOLD * 2);
+
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	//large jobs one at a time, each using all threads
+#ifdef _OPENMP
+	omp_set_num_threads(nThreads);
+#endif
+	Workspace ws;
+	ws.out = NULL;
+	for(int i = 0; i < nLarge; i++)
+		runJob(batch.jobs[order[i]], ws);
+	if(NULL != ws.out)
+		closeOutput(ws.out);
+
+	//small jobs side by side, dealt to the workers round-robin from the largest and then balanced by stealing
+	batch.nWorkers = nThreads;
+	if(NULL == (batch.queues = (JobQueue *)malloc(sizeof(JobQueue) * nThreads)))
+	{
+		printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+		exit(1);
+	}
+	for(int w = 0; w < nThreads; w++)
+	{
+		JobQueue & queue = batch.queues[w];
+		if(NULL == (queue.jobs = (int *)malloc(sizeof(int) * ((nRun - nLarge) / nThreads + 1))))
+		{
+			printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+			exit(1);
+		}
+		queue.head = 0;
+		queue.tail = 0;
+		pthread_mutex_init(&queue.lock, NULL);
+	}
+	for(int i = nLarge; i < nRun; i++)
+	{
+		JobQueue & queue = batch.queues[(i - nLarge) % nThreads];
+		queue.jobs[queue.tail ++] = order[i];
+	}
+
+	pthread_t * workers;
+	if(NULL == (workers = (pthread_t *)malloc(sizeof(pthread_t) * nThreads)))
+	{
+		printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+		exit(1);
+	}
+	for(int w = 0; w < nThreads; w++)
+		pthread_create(workers + w, NULL, worker, (void *)(long)w);
+	for(int w = 0; w < nThreads; w++)
+		pthread_join(workers[w], NULL);
+
+	double elapsed = seconds(start);
+	double busy = 0;
+	int nFailed = 0;
+	for(int i = 0; i < nJobs; i++)
+	{
+		busy += batch.jobs[i].seconds;
+		if(!batch.jobs[i].ok)
+			nFailed ++;
+	}
+	writeReport(argv[2], nJobs);
+	printf("Finished %d jobs (%d failed) in %.3lf seconds, %.3lf seconds of job time\n", nJobs, nFailed, elapsed, busy);
+
+	for(int w = 0; w < nThreads; w++)
+	{
+		free(batch.queues[w].jobs);
+		pthread_mutex_destroy(&batch.queues[w].lock);
+	}
+	free(batch.queues);
+	free(workers);
+	free(order);
+	for(int i = 0; i < nJobs; i++)
+		free(batch.jobs[i].line);
+	free(batch.jobs);
+	return (nFailed == 0) ? 0 : 1;
+}
@@ -1,24 +1,71 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include "io.h"
 #include "countPoints.h"
 #include "clusters.h"
+#include "output.h"
+#include "options.h"
+
+/**
+ * NAME:	countCases
+ * DESCRIPTION:	count the cases near each case point with the search chosen by the options: on a lattice with -approx, with a KD-tree if there is one, or on the grid blocks
+ * PARAMETERS:
+ * 	Options & opts:		the settings
+ * 	double * xCas:		the X values of the case points (or locations)
+ * 	double * yCas:		the Y values of the case points
+ * 	PointCount * indexCas:	the index of the case points
+ * 	PointCount nLocationsCas:	the number of case points
+ * 	PointCount * weightCas:	if not NULL, the number of cases at each location
+ * 	KDTree * treeCas:	if not NULL, a KD-tree of the case points
+ * 	int nBlockX:		the number of index blocks along X dimension
+ * 	int nBlockY:		the number of index blocks along Y dimension
+ * 	double radius:		the search radius, which is also the block size
+ * 	double xMin:		the minimum X of all points
+ * 	double yMin:		the minimum Y of all points
+ * 	double xMax:		the maximum X of all points
+ * 	double yMax:		the maximum Y of all points
+ * 	PointCount * critical:	if not NULL, counting for each point stops at its critical count (-coreOnly)
+ * 	const Geo * geo:	if not NULL, points are geographic
+ * RETURN:
+ * 	TYPE:	PointCount *
+ * 	VALUE:	the number of cases near each case point
+ */
+static PointCount * countCases(Options & opts, double * xCas, double * yCas, PointCount * indexCas, PointCount nLocationsCas, PointCount * weightCas, KDTree * treeCas, int nBlockX, int nBlockY, double radius, double xMin, double yMin, double xMax, double yMax, PointCount * critical, const Geo * geo)
+{
+	//with -approx, counts are summed on a lattice of cells, and only the points near the search circle are tested
+	if(opts.approxCells > 0)
+	{
+		Lattice * latticeCas = buildLattice(xCas, yCas, nLocationsCas, weightCas, xMin, yMin, xMax, yMax, radius / opts.approxCells);
+		PointCount * countPointsCas = countInDistance_Lattice(xCas, yCas, nLocationsCas, latticeCas, radius);
+		freeLattice(latticeCas);
+		return countPointsCas;
+	}
+	return (NULL != treeCas) ? countInDistance_KD(xCas, yCas, nLocationsCas, treeCas, radius, critical) : countInDistance_Single(xCas, yCas, indexCas, nBlockX, nBlockY, radius, critical, weightCas, geo, opts.sortX);
+}
 
 int main(int argc, char ** argv) {
 
-	if(argc != 9) {
+	Options opts;
+	initOptions(opts);
+	if(argc < 9 || !parseOptions(argc, argv, 9, opts)) {
 		printf("ERROR! Incorrect number of input arguments\n");
-		printf("ESCIB_Bernoulli inputCase inputControl output searchRadius significance(alpha) baselineRatio minCorPointsInEachCluster nonCorePoints\n");
+		printf("ESCIB_Bernoulli inputCase inputControl output searchRadius significance(alpha) baselineRatio minCorPointsInEachCluster nonCorePoints [options]\n");
+		printOptionsUsage();
+		return 1;
+	}
+	if(opts.smoothBandwidth > 0 || opts.eventList) {
+		printf("ERROR! ESCIB_Bernoulli doesn't support -smooth or -eventList\n");
+		return 1;
+	}
+	if(opts.coreOnly && NULL != opts.summaryFile) {
+		printf("ERROR! -summary can't be used with -coreOnly\n");
 		return 1;
 	}
 
 	double xMin = 999999999, yMin = 999999999, xMax = -999999999, yMax = -999999999;
 
-	FILE * inputCas;
-	FILE * inputCon;
-	FILE * output;
-
 	double radius = atof(argv[4]);
 	double significance = atof(argv[5]);
 
@@ -28,107 +75,255 @@ int main(int argc, char ** argv) {
 	if(atoi(argv[8]) == 0)
 		nonCorePoints = false;
 
-	if(NULL == (inputCas = fopen(argv[1], "r")))
-	{
-		printf("ERROR: Can't open the input file.\n");
-		exit(1);
-	}
-	if(NULL == (inputCon = fopen(argv[2], "r")))
-	{
-		printf("ERROR: Can't open the input file.\n");
-		exit(1);
-	}
-
-		
-	int countCas = getCount(inputCas, xMin, xMax, yMin, yMax);
-	int countCon = getCount(inputCon, xMin, xMax, yMin, yMax);
-
 	double * xCas;
 	double * yCas;
 	double * xCon;
 	double * yCon;
 
-	if(NULL == (xCas = (double *)malloc(sizeof(double) * countCas)))
-	{
-		printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
-		exit(1);
+	//inputs may be index files written by ESCIB_Index, which are mapped instead of read and indexed
+	PointIndex * savedCas = mapPointIndex(argv[1]);
+	PointIndex * savedCon = mapPointIndex(argv[2]);
+	if(opts.dedup && (NULL != savedCas || NULL != savedCon)) {
+		printf("ERROR! -dedup can't be used with index files\n");
+		return 1;
 	}
-	if(NULL == (yCas = (double *)malloc(sizeof(double) * countCas)))
-	{
-		printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
-		exit(1);
+	if(opts.geo && (NULL != savedCas || NULL != savedCon || opts.approxCells > 0 || opts.index == INDEX_KDTREE)) {
+		printf("ERROR! -geo can't be used with index files, -approx or -index kdtree\n");
+		return 1;
+	}
+	if(opts.sortX && (NULL != savedCas || NULL != savedCon)) {
+		printf("ERROR! -sortX can't be used with index files\n");
+		return 1;
 	}
-	if(NULL == (xCon = (double *)malloc(sizeof(double) * countCon)))
+
+	//with -pipeline, the controls are read on a thread of their own while the cases are read
+	bool pipelined = opts.pipeline && NULL == savedCas && NULL == savedCon;
+	PointCount countCas, countCon;
+	if(pipelined)
 	{
-		printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
-		exit(1);
+		PointTask loadingCon;
+		startLoading(loadingCon, argv[2], opts.parallelRead);
+		countCas = loadPoints(argv[1], xCas, yCas, xMin, xMax, yMin, yMax, opts.parallelRead);
+		countCon = finishLoading(loadingCon, xCon, yCon, xMin, xMax, yMin, yMax);
 	}
-	if(NULL == (yCon = (double *)malloc(sizeof(double) * countCon)))
+	else
 	{
-		printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
-		exit(1);
+		countCas = (NULL != savedCas) ? savedPoints(savedCas, xCas, yCas, xMin, xMax, yMin, yMax) : loadPoints(argv[1], xCas, yCas, xMin, xMax, yMin, yMax, opts.parallelRead);
+		countCon = (NULL != savedCon) ? savedPoints(savedCon, xCon, yCon, xMin, xMax, yMin, yMax) : loadPoints(argv[2], xCon, yCon, xMin, xMax, yMin, yMax, opts.parallelRead);
 	}
 
-	printf("Number of cases: %d\n", countCas);
-	printf("Number of controls: %d\n", countCon);
+	printf("Number of cases: %lld\n", (long long)countCas);
+	printf("Number of controls: %lld\n", (long long)countCon);
 	printf("X Range: %lf - %lf\n", xMin, xMax);
 	printf("Y Range: %lf - %lf\n", yMin, yMax);
 
-	readPoints(inputCas, xCas, yCas);
-	readPoints(inputCon, xCon, yCon);
+	//with -geo, longitudes are scaled while points are indexed so that each grid block covers the search radius (see initGeo), and put back from copies for the output
+	Geo geo;
+	Geo * geoOrNull = NULL;
+	double * longitudeCas = NULL;
+	double * longitudeCon = NULL;
+	if(opts.geo) {
+		initGeo(geo, radius, yMin, yMax);
+		toGeoGrid(geo, xCas, countCas, &longitudeCas);
+		toGeoGrid(geo, xCon, countCon, &longitudeCon);
+		xMin *= geo.scale;
+		xMax *= geo.scale;
+		radius = geo.blockSize;
+		geoOrNull = &geo;
+	}
 
-	int nBlockX = ceil((xMax - xMin) / radius);
-	int nBlockY = ceil((yMax - yMin) / radius);
+	int nBlockX, nBlockY;
+	if(!gridBlocks(xMin, xMax, yMin, yMax, radius, nBlockX, nBlockY)) {
+		printf("ERROR! The grid of index blocks is too large, use a larger search radius\n");
+		return 1;
+	}
+	if(!matchPointIndex(savedCas, radius, xMin, yMin, nBlockX, nBlockY) || !matchPointIndex(savedCon, radius, xMin, yMin, nBlockX, nBlockY))
+		return 1;
 
 //	printf("Index blocks: %d * %d\n", nBlockX, nBlockY);
 
-	int * indexCas;
-	int * indexCon;
+	PointCount * indexCas;
+	PointCount * indexCon;
+	PointCount * orderCas = NULL;
+	PointCount * orderCon = NULL;
 
 
-	indexCas = indexPoints(xCas, yCas, countCas, xMin, yMin, nBlockX, nBlockY, radius);
-	indexCon = indexPoints(xCon, yCon, countCon, xMin, yMin, nBlockX, nBlockY, radius);
+	//with -dedup, points at the same location are counted and clustered once, weighted by their number
+	PointCount nLocationsCas = countCas;
+	PointCount nLocationsCon = countCon;
+	PointCount * weightCas = NULL;
+	PointCount * weightCon = NULL;
+	PointCount * locationCas = NULL;
+	PointCount * locationCon = NULL;
+	if(opts.dedup)
+	{
+		nLocationsCas = dedupPoints(xCas, yCas, countCas, weightCas, locationCas);
+		nLocationsCon = dedupPoints(xCon, yCon, countCon, weightCon, locationCon);
+		printf("Distinct case locations: %lld\n", (long long)nLocationsCas);
+		printf("Distinct control locations: %lld\n", (long long)nLocationsCon);
+	}
 
-	fclose(inputCas);
-	fclose(inputCon);
+	if(NULL != savedCas) {
+		indexCas = savedCas->index;
+		orderCas = savedCas->order;
+	}
+	else
+		indexCas = indexPoints(xCas, yCas, nLocationsCas, xMin, yMin, nBlockX, nBlockY, radius, (opts.binaryOutput || opts.dedup || opts.geo) ? &orderCas : NULL);
+	//with -pipeline, the controls are indexed on a thread of their own while the cases are indexed and counted
+	PointTask indexingCon;
+	bool pendingCon = false;
+	if(NULL != savedCon) {
+		indexCon = savedCon->index;
+		orderCon = savedCon->order;
+	}
+	else if(pipelined)
+	{
+		startIndexing(indexingCon, xCon, yCon, nLocationsCon, xMin, yMin, nBlockX, nBlockY, radius, opts.binaryOutput || opts.dedup || opts.geo, opts.sortX);
+		indexCon = NULL;
+		pendingCon = true;
+	}
+	else
+		indexCon = indexPoints(xCon, yCon, nLocationsCon, xMin, yMin, nBlockX, nBlockY, radius, (opts.binaryOutput || opts.dedup || opts.geo) ? &orderCon : NULL);
+	//with -sortX, each row strip of blocks is sorted by X for the searches
+	if(opts.sortX)
+	{
+		sortBlocksByX(xCas, yCas, indexCas, nBlockX, nBlockY, orderCas);
+		if(NULL != indexCon)
+			sortBlocksByX(xCon, yCon, indexCon, nBlockX, nBlockY, orderCon);
+	}
+	if(opts.dedup)
+		reorderValues(weightCas, orderCas, nLocationsCas);
 
-	int * countPointsCas = countInDistance_Single(xCas, yCas, indexCas, nBlockX, nBlockY, radius);
-	int * countPointsCon = countInDistance_Double(xCas, yCas, xCon, yCon, indexCas, indexCon, nBlockX, nBlockY, radius);
+	//KD-trees replace the grid blocks for highly concentrated points
+	KDTree * treeCas = useKDTree(opts, indexCas, nBlockX, nBlockY) ? buildKDTree(xCas, yCas, nLocationsCas, weightCas) : NULL;
+	if(NULL != treeCas)
+		printf("KD-tree index for cases\n");
 
-	double p = baseLineRatio * countCas / (countCas + countCon); 
+	//the cases near each case point don't depend on the controls unless -coreOnly, so they are counted first (while the controls are still indexed with -pipeline)
+	PointCount * countPointsCas = NULL;
+	if(!opts.coreOnly)
+		countPointsCas = countCases(opts, xCas, yCas, indexCas, nLocationsCas, weightCas, treeCas, nBlockX, nBlockY, radius, xMin, yMin, xMax, yMax, NULL, geoOrNull);
 
-	int * clusters = doClusterBer(xCas, yCas, indexCas, xCon, yCon, indexCon, nBlockX, nBlockY, radius, xMin, yMin, countPointsCas, countPointsCon, p, significance, minCore, nonCorePoints);
-	//Output 
-	if(NULL == (output = fopen(argv[3], "w"))) {
-		printf("ERROR: Can't open the output file.\n");
-		exit(1);
-	}
+	if(pendingCon)
+		indexCon = finishIndexing(indexingCon, xCon, yCon, &orderCon);
+	if(opts.dedup)
+		reorderValues(weightCon, orderCon, nLocationsCon);
+	KDTree * treeCon = useKDTree(opts, indexCon, nBlockX, nBlockY) ? buildKDTree(xCon, yCon, nLocationsCon, weightCon) : NULL;
+	if(NULL != treeCon)
+		printf("KD-tree index for controls\n");
 
-	for(int i = 0; i < countCas; i++) {
-		fprintf(output, "%lf,%lf,1,%d\n", xCas[i], yCas[i], clusters[i]);
+	//with -approx, counts are summed on a lattice of cells, and only the points near the search circle are tested
+	PointCount * countPointsCon;
+	if(opts.approxCells > 0)
+	{
+		Lattice * latticeCon = buildLattice(xCon, yCon, nLocationsCon, weightCon, xMin, yMin, xMax, yMax, radius / opts.approxCells);
+		countPointsCon = countInDistance_Lattice(xCas, yCas, nLocationsCas, latticeCon, radius);
+		freeLattice(latticeCon);
 	}
+	else
+		countPointsCon = (NULL != treeCon) ? countInDistance_KD(xCas, yCas, nLocationsCas, treeCon, radius) : countInDistance_Double(xCas, yCas, xCon, yCon, indexCas, indexCon, nBlockX, nBlockY, radius, weightCon, geoOrNull, opts.sortX);
 
-	if(nonCorePoints) {
-		for(int i = 0; i < countCon; i++)
+	double p = baseLineRatio * countCas / (countCas + countCon); 
+
+	//with -coreOnly, the cases near each point are only counted up to the number that makes it a core point
+	PointCount * critical = NULL;
+	if(opts.coreOnly)
+	{
+		PointCount maxCon = 0;
+		for(PointCount i = 0; i < nLocationsCas; i++)
 		{
-			fprintf(output, "%lf,%lf,0,%d\n", xCon[i], yCon[i], clusters[countCas + i]);
+			if(countPointsCon[i] > maxCon)
+				maxCon = countPointsCon[i];
 		}
+		PointCount * table = criticalCountsBer(maxCon, countCas, p, significance);
+		if(NULL == (critical = (PointCount *)malloc(sizeof(PointCount) * (nLocationsCas + 1))))
+		{
+			printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+			exit(1);
+		}
+		for(PointCount i = 0; i < nLocationsCas; i++)
+			critical[i] = table[countPointsCon[i]];
+		free(table);
 	}
 
-	fclose(output);
+	if(opts.coreOnly)
+		countPointsCas = countCases(opts, xCas, yCas, indexCas, nLocationsCas, weightCas, treeCas, nBlockX, nBlockY, radius, xMin, yMin, xMax, yMax, critical, geoOrNull);
 
+	ClusterSummaries summaries;
+	initClusterSummaries(summaries);
+	int * clusters = doClusterBer(xCas, yCas, indexCas, xCon, yCon, indexCon, nBlockX, nBlockY, radius, xMin, yMin, countPointsCas, countPointsCon, p, significance, minCore, nonCorePoints, (NULL != opts.summaryFile) ? &summaries : NULL, treeCas, treeCon, critical, weightCas, weightCon, geoOrNull, opts.sortX);
+	if(opts.dedup)
+	{
+		PointCount * pointOrderCas = NULL;
+		PointCount * pointOrderCon = NULL;
+		int * clustersCas = expandDuplicates(clusters, xCas, yCas, countCas, locationCas, orderCas, nLocationsCas, xMin, yMin, nBlockX, nBlockY, radius, opts.sortX, (opts.binaryOutput || opts.geo) ? &pointOrderCas : NULL);
+		int * clustersCon = expandDuplicates(clusters + nLocationsCas, xCon, yCon, countCon, locationCon, orderCon, nLocationsCon, xMin, yMin, nBlockX, nBlockY, radius, opts.sortX, (opts.binaryOutput || opts.geo) ? &pointOrderCon : NULL);
+		free(clusters);
+		if(NULL == (clusters = (int *)malloc(sizeof(int) * (countCas + countCon + 1))))
+		{
+			printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+			exit(1);
+		}
+		memcpy(clusters, clustersCas, sizeof(int) * countCas);
+		memcpy(clusters + countCas, clustersCon, sizeof(int) * countCon);
+		free(clustersCas);
+		free(clustersCon);
+		free(orderCas);
+		free(orderCon);
+		free(locationCas);
+		free(locationCon);
+		orderCas = pointOrderCas;
+		orderCon = pointOrderCon;
+	}
+	if(opts.geo) {
+		fromGeoGrid(xCas, longitudeCas, orderCas, countCas);
+		fromGeoGrid(xCon, longitudeCon, orderCon, countCon);
+		if(NULL != opts.summaryFile)
+			fromGeoSummaries(geo, summaries);
+	}
+	//Output 
+	if(opts.binaryOutput) {
+		writeLabelsBinary(argv[3], clusters, orderCas, countCas, clusters + countCas, orderCon, nonCorePoints ? countCon : 0, opts.clusteredOnly);
+	}
+	else {
+		OutputBuffer * output = openOutput(argv[3]);
+		writeLabelsCSV(output, xCas, yCas, clusters, countCas, 1, opts.clusteredOnly);
+		if(nonCorePoints)
+			writeLabelsCSV(output, xCon, yCon, clusters + countCas, countCon, 0, opts.clusteredOnly);
+		closeOutput(output);
+	}
+	if(NULL == savedCas)
+		free(orderCas);
+	if(NULL == savedCon)
+		free(orderCon);
+	if(NULL != opts.summaryFile) {
+		writeClusterSummary(opts.summaryFile, summaries);
+		freeClusterSummaries(summaries);
+	}
 
-	free(xCas);
-	free(yCas);
-	free(indexCas);
+
+	if(NULL == savedCas) {
+		free(xCas);
+		free(yCas);
+		free(indexCas);
+	}
+	closePointIndex(savedCas);
+	freeKDTree(treeCas);
 	free(countPointsCas);
 
-	free(xCon);
-	free(yCon);
-	free(indexCon);
+	if(NULL == savedCon) {
+		free(xCon);
+		free(yCon);
+		free(indexCon);
+	}
+	closePointIndex(savedCon);
+	freeKDTree(treeCon);
 	free(countPointsCon);
+	free(weightCas);
+	free(weightCon);
 
 
+	free(critical);
 	free(clusters);
 
 	return 0;
@@ -0,0 +1,61 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "io.h"
+
+int main(int argc, char ** argv) {
+
+	if(argc != 4 && argc != 8) {
+		printf("ERROR! Incorrect number of input arguments\n");
+		printf("ESCIB_Index input output searchRadius [xMin yMin xMax yMax]\n");
+		return 1;
+	}
+
+	double xMin = 999999999, yMin = 999999999, xMax = -999999999, yMax = -999999999;
+
+	double radius = atof(argv[3]);
+
+	double * x;
+	double * y;
+
+	PointCount count = loadPoints(argv[1], x, y, xMin, xMax, yMin, yMax, false);
+
+	//an explicit extent lets the index be used with other inputs inside it
+	if(argc == 8) {
+		double exMin = atof(argv[4]);
+		double eyMin = atof(argv[5]);
+		double exMax = atof(argv[6]);
+		double eyMax = atof(argv[7]);
+		if(count > 0 && (exMin > xMin || eyMin > yMin || exMax < xMax || eyMax < yMax)) {
+			printf("ERROR! The extent doesn't cover all points (X Range: %lf - %lf, Y Range: %lf - %lf)\n", xMin, xMax, yMin, yMax);
+			return 1;
+		}
+		xMin = exMin;
+		yMin = eyMin;
+		xMax = exMax;
+		yMax = eyMax;
+	}
+
+	printf("Number of points: %lld\n", (long long)count);
+	printf("X Range: %lf - %lf\n", xMin, xMax);
+	printf("Y Range: %lf - %lf\n", yMin, yMax);
+	printf("Search radius %lf\n", radius);
+
+	int nBlockX, nBlockY;
+	if(!gridBlocks(xMin, xMax, yMin, yMax, radius, nBlockX, nBlockY)) {
+		printf("ERROR! The grid of index blocks is too large, use a larger search radius\n");
+		return 1;
+	}
+
+	PointCount * order;
+	PointCount * index = indexPoints(x, y, count, xMin, yMin, nBlockX, nBlockY, radius, &order);
+
+	savePointIndex(argv[2], x, y, count, index, order, radius, xMin, yMin, xMax, yMax, nBlockX, nBlockY);
+
+	free(x);
+	free(y);
+	free(index);
+	free(order);
+
+	return 0;
+}
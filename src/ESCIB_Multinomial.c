@@ -0,0 +1,306 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "io.h"
+#include "countPoints.h"
+#include "clusters.h"
+#include "output.h"
+#include "options.h"
+
+/**
+ * NAME:	compareCategories
+ * DESCRIPTION:	order two categories, for qsort
+ * PARAMETERS:
+ * 	const void * a:	an int
+ * 	const void * b:	another int
+ * RETURN:
+ * 	TYPE:	int
+ * 	VALUE:	negative, zero or positive as a is before, equal to or after b
+ */
+static int compareCategories(const void * a, const void * b)
+{
+	int va = *(const int *)a;
+	int vb = *(const int *)b;
+	return (va > vb) - (va < vb);
+}
+
+int main(int argc, char ** argv) {
+
+	Options opts;
+	initOptions(opts);
+	if(argc < 9 || !parseOptions(argc, argv, 9, opts)) {
+		printf("ERROR! Incorrect number of input arguments\n");
+		printf("ESCIB_Multinomial inputCase inputControl output searchRadius significance(alpha) baselineRatio minCorPointsInEachCluster nonCorePoints [options]\n");
+		printOptionsUsage();
+		return 1;
+	}
+	if(opts.binaryOutput || NULL != opts.summaryFile || opts.index == INDEX_KDTREE || opts.coreOnly || opts.dedup || opts.approxCells > 0 || opts.smoothBandwidth > 0 || opts.geo || opts.eventList) {
+		printf("ERROR! ESCIB_Multinomial only supports -clusteredOnly, -parallelRead, -index grid, -sortX and -pipeline\n");
+		return 1;
+	}
+
+	double xMin = 999999999, yMin = 999999999, xMax = -999999999, yMax = -999999999;
+
+	double radius = atof(argv[4]);
+	double significance = atof(argv[5]);
+
+	double baseLineRatio = atof(argv[6]);
+	double minCore = atof(argv[7]);
+	bool nonCorePoints = true;
+	if(atoi(argv[8]) == 0)
+		nonCorePoints = false;
+
+	double * xCas;
+	double * yCas;
+	double * xCon;
+	double * yCon;
+	int * category;
+
+	//cases are read with their category column in a single stream; with -pipeline, the controls are read on a thread of their own meanwhile
+	PointCount countCas, countCon;
+	if(opts.pipeline)
+	{
+		PointTask loadingCon;
+		startLoading(loadingCon, argv[2], opts.parallelRead);
+		countCas = readPointsStream(argv[1], xCas, yCas, xMin, xMax, yMin, yMax, &category);
+		countCon = finishLoading(loadingCon, xCon, yCon, xMin, xMax, yMin, yMax);
+	}
+	else
+	{
+		countCas = readPointsStream(argv[1], xCas, yCas, xMin, xMax, yMin, yMax, &category);
+		countCon = loadPoints(argv[2], xCon, yCon, xMin, xMax, yMin, yMax, opts.parallelRead);
+	}
+	for(PointCount i = 0; i < countCas; i++)
+	{
+		if(category[i] < 0)
+		{
+			printf("ERROR! Every case needs a non-negative integer category in its third column\n");
+			return 1;
+		}
+	}
+
+	//the distinct categories, in increasing order
+	int * categories;
+	if(NULL == (categories = (int *)malloc(sizeof(int) * (countCas + 1))))
+	{
+		printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+		exit(1);
+	}
+	memcpy(categories, category, sizeof(int) * countCas);
+	qsort(categories, countCas, sizeof(int), compareCategories);
+	int nCategories = 0;
+	for(PointCount i = 0; i < countCas; i++)
+	{
+		if(nCategories == 0 || categories[nCategories - 1] != categories[i])
+			categories[nCategories ++] = categories[i];
+	}
+
+	printf("Number of cases: %lld\n", (long long)countCas);
+	printf("Number of categories: %d\n", nCategories);
+	printf("Number of controls: %lld\n", (long long)countCon);
+	printf("X Range: %lf - %lf\n", xMin, xMax);
+	printf("Y Range: %lf - %lf\n", yMin, yMax);
+
+	int nBlockX, nBlockY;
+	if(!gridBlocks(xMin, xMax, yMin, yMax, radius, nBlockX, nBlockY)) {
+		printf("ERROR! The grid of index blocks is too large, use a larger search radius\n");
+		return 1;
+	}
+
+	//the cases of all categories share one index, and their categories follow them into indexed order
+	PointCount * orderCas;
+	PointCount * indexCas = indexPoints(xCas, yCas, countCas, xMin, yMin, nBlockX, nBlockY, radius, &orderCas);
+	PointCount * indexCon = indexPoints(xCon, yCon, countCon, xMin, yMin, nBlockX, nBlockY, radius);
+	//with -sortX, each row strip of blocks is sorted by X for the searches
+	if(opts.sortX)
+	{
+		sortBlocksByX(xCas, yCas, indexCas, nBlockX, nBlockY, orderCas);
+		sortBlocksByX(xCon, yCon, indexCon, nBlockX, nBlockY);
+	}
+	int * categoryCas;
+	if(NULL == (categoryCas = (int *)malloc(sizeof(int) * (countCas + 1))))
+	{
+		printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+		exit(1);
+	}
+	for(PointCount i = 0; i < countCas; i++)
+		categoryCas[i] = category[orderCas[i]];
+	free(category);
+	free(orderCas);
+
+	//the cases of its own category and the controls near each case are counted in one sweep for all categories
+	PointCount * countPointsCas;
+	PointCount * countPointsCon;
+	countInDistance_Categories(xCas, yCas, categoryCas, xCon, yCon, indexCas, indexCon, nBlockX, nBlockY, radius, countPointsCas, countPointsCon, opts.sortX);
+
+	int * clusters;
+	if(NULL == (clusters = (int *)malloc(sizeof(int) * (countCas + 1))))
+	{
+		printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+		exit(1);
+	}
+	for(PointCount i = 0; i < countCas; i++)
+		clusters[i] = -1;
+
+	//a control may join clusters of several categories, and is written once for each of them
+	PointCount nRows = 0;
+	PointCount capacity = 1024;
+	PointCount * rowCon;
+	int * rowCategory;
+	int * rowCluster;
+	bool * clusteredCon;
+	if(NULL == (rowCon = (PointCount *)malloc(sizeof(PointCount) * capacity)) || NULL == (rowCategory = (int *)malloc(sizeof(int) * capacity)) || NULL == (rowCluster = (int *)malloc(sizeof(int) * capacity)) || NULL == (clusteredCon = (bool *)calloc(countCon + 1, sizeof(bool))))
+	{
+		printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+		exit(1);
+	}
+
+	//each category is then tested and expanded as ESCIB_Bernoulli would with its cases, which keep their indexed order and so get an index of their own on the same grid
+	int nBlocks = nBlockX * nBlockY;
+	PointCount * indexK;
+	if(NULL == (indexK = (PointCount *)malloc(sizeof(PointCount) * (nBlocks + 1))))
+	{
+		printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+		exit(1);
+	}
+	int nClusters = 0;
+	for(int k = 0; k < nCategories; k++)
+	{
+		PointCount countK = 0;
+		for(PointCount i = 0; i < countCas; i++)
+		{
+			if(categoryCas[i] == categories[k])
+				countK ++;
+		}
+		double * xK;
+		double * yK;
+		PointCount * casK;
+		PointCount * conK;
+		PointCount * caseK;
+		if(NULL == (xK = (double *)malloc(sizeof(double) * countK)) || NULL == (yK = (double *)malloc(sizeof(double) * countK)) || NULL == (casK = (PointCount *)malloc(sizeof(PointCount) * countK)) || NULL == (conK = (PointCount *)malloc(sizeof(PointCount) * countK)) || NULL == (caseK = (PointCount *)malloc(sizeof(PointCount) * countK)))
+		{
+			printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+			exit(1);
+		}
+		PointCount j = 0;
+		for(int b = 0; b < nBlocks; b++)
+		{
+			indexK[b] = j;
+			for(PointCount i = indexCas[b]; i < indexCas[b + 1]; i++)
+			{
+				if(categoryCas[i] != categories[k])
+					continue;
+				xK[j] = xCas[i];
+				yK[j] = yCas[i];
+				casK[j] = countPointsCas[i];
+				conK[j] = countPointsCon[i];
+				caseK[j ++] = i;
+			}
+		}
+		indexK[nBlocks] = j;
+
+		double p = baseLineRatio * countK / (countK + countCon);
+		int * clustersK = doClusterBer(xK, yK, indexK, xCon, yCon, indexCon, nBlockX, nBlockY, radius, xMin, yMin, casK, conK, p, significance, minCore, nonCorePoints, NULL, NULL, NULL, NULL, NULL, NULL, NULL, opts.sortX);
+
+		//cluster IDs of later categories follow those of earlier ones
+		int nClustersK = 0;
+		for(j = 0; j < countK; j++)
+		{
+			if(clustersK[j] > 0)
+			{
+				clusters[caseK[j]] = nClusters + clustersK[j];
+				if(clustersK[j] > nClustersK)
+					nClustersK = clustersK[j];
+			}
+		}
+		for(PointCount c = 0; nonCorePoints && c < countCon; c++)
+		{
+			if(clustersK[countK + c] <= 0)
+				continue;
+			if(nRows == capacity)
+			{
+				capacity *= 2;
+				if(NULL == (rowCon = (PointCount *)realloc(rowCon, sizeof(PointCount) * capacity)) || NULL == (rowCategory = (int *)realloc(rowCategory, sizeof(int) * capacity)) || NULL == (rowCluster = (int *)realloc(rowCluster, sizeof(int) * capacity)))
+				{
+					printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+					exit(1);
+				}
+			}
+			rowCon[nRows] = c;
+			rowCategory[nRows] = categories[k];
+			rowCluster[nRows ++] = nClusters + clustersK[countK + c];
+			clusteredCon[c] = true;
+		}
+		printf("Category %d: %lld cases, %d clusters\n", categories[k], (long long)countK, nClustersK);
+		nClusters += nClustersK;
+
+		free(clustersK);
+		free(xK);
+		free(yK);
+		free(casK);
+		free(conK);
+		free(caseK);
+	}
+	free(indexK);
+	free(countPointsCas);
+	free(countPointsCon);
+
+	//Output
+	OutputBuffer * output = openOutput(argv[3]);
+	writeCategoryLabelsCSV(output, xCas, yCas, categoryCas, clusters, countCas, 1, opts.clusteredOnly);
+	if(nonCorePoints)
+	{
+		//controls in clusters, then the other controls once with category and cluster ID -1
+		PointCount nUnclustered = 0;
+		for(PointCount c = 0; c < countCon; c++)
+		{
+			if(!clusteredCon[c])
+				nUnclustered ++;
+		}
+		PointCount nAll = nRows + nUnclustered;
+		double * xRow;
+		double * yRow;
+		if(NULL == (xRow = (double *)malloc(sizeof(double) * (nAll + 1))) || NULL == (yRow = (double *)malloc(sizeof(double) * (nAll + 1))) || NULL == (rowCategory = (int *)realloc(rowCategory, sizeof(int) * (nAll + 1))) || NULL == (rowCluster = (int *)realloc(rowCluster, sizeof(int) * (nAll + 1))))
+		{
+			printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+			exit(1);
+		}
+		for(PointCount r = 0; r < nRows; r++)
+		{
+			xRow[r] = xCon[rowCon[r]];
+			yRow[r] = yCon[rowCon[r]];
+		}
+		PointCount r = nRows;
+		for(PointCount c = 0; c < countCon; c++)
+		{
+			if(clusteredCon[c])
+				continue;
+			xRow[r] = xCon[c];
+			yRow[r] = yCon[c];
+			rowCategory[r] = -1;
+			rowCluster[r ++] = -1;
+		}
+		writeCategoryLabelsCSV(output, xRow, yRow, rowCategory, rowCluster, nAll, 0, opts.clusteredOnly);
+		free(xRow);
+		free(yRow);
+	}
+	closeOutput(output);
+	printf("Number of clusters: %d\n", nClusters);
+
+	free(xCas);
+	free(yCas);
+	free(indexCas);
+	free(categoryCas);
+	free(xCon);
+	free(yCon);
+	free(indexCon);
+	free(categories);
+	free(clusters);
+	free(rowCon);
+	free(rowCategory);
+	free(rowCluster);
+	free(clusteredCon);
+
+	return 0;
+}
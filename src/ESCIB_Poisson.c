@@ -1,140 +1,719 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include "io.h"
 #include "countPoints.h"
 #include "clusters.h"
+#include "output.h"
+#include "options.h"
 
-int main(int argc, char ** argv) {
+/**
+ * NAME:	countEvents
+ * DESCRIPTION:	count the events near each event point with the search chosen by the options: on a lattice with -approx, with a KD-tree if there is one, or on the grid blocks
+ * PARAMETERS:
+ * 	Options & opts:		the settings
+ * 	double * xE:		the X values of the event points (or locations)
+ * 	double * yE:		the Y values of the event points
+ * 	PointCount * indexE:	the index of the event points
+ * 	PointCount nLocationsE:	the number of event points
+ * 	PointCount * weightE:	if not NULL, the number of events at each location
+ * 	KDTree * treeE:		if not NULL, a KD-tree of the event points
+ * 	int nBlockX:		the number of index blocks along X dimension
+ * 	int nBlockY:		the number of index blocks along Y dimension
+ * 	double radius:		the search radius, which is also the block size
+ * 	double xMin:		the minimum X of all points
+ * 	double yMin:		the minimum Y of all points
+ * 	double xMax:		the maximum X of all points
+ * 	double yMax:		the maximum Y of all points
+ * 	PointCount * critical:	if not NULL, counting for each point stops at its critical count (-coreOnly)
+ * 	const Geo * geo:	if not NULL, points are geographic
+ * RETURN:
+ * 	TYPE:	PointCount *
+ * 	VALUE:	the number of events near each event point
+ */
+static PointCount * countEvents(Options & opts, double * xE, double * yE, PointCount * indexE, PointCount nLocationsE, PointCount * weightE, KDTree * treeE, int nBlockX, int nBlockY, double radius, double xMin, double yMin, double xMax, double yMax, PointCount * critical, const Geo * geo)
+{
+	//with -approx, counts are summed on a lattice of cells, and only the points near the search circle are tested
+	if(opts.approxCells > 0)
+	{
+		Lattice * latticeE = buildLattice(xE, yE, nLocationsE, weightE, xMin, yMin, xMax, yMax, radius / opts.approxCells);
+		PointCount * countPointsE = countInDistance_Lattice(xE, yE, nLocationsE, latticeE, radius);
+		freeLattice(latticeE);
+		return countPointsE;
+	}
+	return (NULL != treeE) ? countInDistance_KD(xE, yE, nLocationsE, treeE, radius, critical) : countInDistance_Single(xE, yE, indexE, nBlockX, nBlockY, radius, critical, weightE, geo, opts.sortX);
+}
 
-	if(argc != 9) {
-		printf("ERROR! Incorrect number of input arguments\n");
-		printf("ESCIB_Poisson inputBackground inputEvents output searchRadius significance(alpha) baselineRatio minCorPointsInEachCluster nonCorePoints\n");
-		return 1;
+//the background of -eventList, read and indexed once on a fixed grid and shared by every event file
+struct Background {
+	double * x;
+	double * y;
+	PointCount count;
+	PointCount * index;
+	PointIndex * saved;	//if not NULL, the background is a mapped index file
+	KDTree * tree;
+	Lattice * lattice;	//with -approx
+	Raster * raster;	//with -smooth
+	double xMin, yMin, xMax, yMax;
+	int nBlockX, nBlockY;
+};
+
+/**
+ * NAME:	loadBackground
+ * DESCRIPTION:	read and index the background of -eventList. The grid is fixed by the extent of the background, or by the extent of its index file, which ESCIB_Index can widen to cover every event file
+ * PARAMETERS:
+ * 	Options & opts:		the settings
+ * 	const char * fileName:	the background file, or an index file written by ESCIB_Index
+ * 	double radius:		the search radius, which is also the block size
+ * 	Background & bg:	the background to fill
+ * RETURN:
+ * 	TYPE:	bool
+ * 	VALUE:	false if the grid is too large, or an index file doesn't match the search radius or is used with -sortX
+ */
+static bool loadBackground(Options & opts, const char * fileName, double radius, Background & bg)
+{
+	bg.xMin = 999999999, bg.yMin = 999999999, bg.xMax = -999999999, bg.yMax = -999999999;
+	bg.saved = mapPointIndex(fileName);
+	//the blocks of a mapped index are read only, so they can't be sorted by X
+	if(NULL != bg.saved && opts.sortX) {
+		printf("ERROR! -sortX can't be used with index files\n");
+		closePointIndex(bg.saved);
+		return false;
+	}
+	bg.count = (NULL != bg.saved) ? savedPoints(bg.saved, bg.x, bg.y, bg.xMin, bg.xMax, bg.yMin, bg.yMax) : loadPoints(fileName, bg.x, bg.y, bg.xMin, bg.xMax, bg.yMin, bg.yMax, opts.parallelRead);
+	if(!gridBlocks(bg.xMin, bg.xMax, bg.yMin, bg.yMax, radius, bg.nBlockX, bg.nBlockY)) {
+		printf("ERROR! The grid of index blocks is too large, use a larger search radius\n");
+		return false;
 	}
+	if(!matchPointIndex(bg.saved, radius, bg.xMin, bg.yMin, bg.nBlockX, bg.nBlockY))
+		return false;
 
-	double xMin = 999999999, yMin = 999999999, xMax = -999999999, yMax = -999999999;
+	printf("Number of background points: %lld\n", (long long)bg.count);
+	printf("X Range: %lf - %lf\n", bg.xMin, bg.xMax);
+	printf("Y Range: %lf - %lf\n", bg.yMin, bg.yMax);
+	printf("Search radius %lf\n", radius);
 
-	FILE * inputB;
-	FILE * inputE;
-	FILE * output;
+	bg.index = NULL;
+	bg.tree = NULL;
+	bg.lattice = NULL;
+	bg.raster = NULL;
+	if(opts.smoothBandwidth > 0)
+	{
+		bg.raster = buildSmoothRaster(bg.x, bg.y, bg.count, NULL, bg.xMin, bg.yMin, bg.xMax, bg.yMax, opts.smoothBandwidth);
+		printf("Background smoothed on a raster of %d * %d cells\n", bg.raster->nX, bg.raster->nY);
+		return true;
+	}
+	if(opts.approxCells > 0)
+	{
+		bg.lattice = buildLattice(bg.x, bg.y, bg.count, NULL, bg.xMin, bg.yMin, bg.xMax, bg.yMax, radius / opts.approxCells);
+		return true;
+	}
+	bg.index = (NULL != bg.saved) ? bg.saved->index : indexPoints(bg.x, bg.y, bg.count, bg.xMin, bg.yMin, bg.nBlockX, bg.nBlockY, radius, NULL);
+	if(opts.sortX)
+		sortBlocksByX(bg.x, bg.y, bg.index, bg.nBlockX, bg.nBlockY);
+	if(useKDTree(opts, bg.index, bg.nBlockX, bg.nBlockY))
+	{
+		bg.tree = buildKDTree(bg.x, bg.y, bg.count, NULL);
+		printf("KD-tree index for background points\n");
+	}
+	return true;
+}
 
-	double radius = atof(argv[4]);
-	double significance = atof(argv[5]);
+/**
+ * NAME:	freeBackground
+ * DESCRIPTION:	release the background of -eventList
+ * PARAMETERS:
+ * 	Background & bg:	the background
+ * RETURN: none
+ */
+static void freeBackground(Background & bg)
+{
+	if(NULL == bg.saved) {
+		free(bg.x);
+		free(bg.y);
+		free(bg.index);
+	}
+	closePointIndex(bg.saved);
+	freeKDTree(bg.tree);
+	freeLattice(bg.lattice);
+	freeRaster(bg.raster);
+}
 
-	double baseLineRatio = atof(argv[6]);
-	double minCore = atof(argv[7]);
-	bool nonCorePoints = true;
-	if(atoi(argv[8]) == 0)
-		nonCorePoints = false;
+/**
+ * NAME:	clusterEventSet
+ * DESCRIPTION:	cluster one event file of -eventList against the shared background and write its output. Events outside the extent of the background can't be indexed on its grid: they get cluster ID -1, aren't counted near any other event and don't count towards the number of events in lambda, but are still written, after all other events in csv output and at their input order in binary output
+ * PARAMETERS:
+ * 	Options & opts:		the settings
+ * 	Background & bg:	the background, see loadBackground
+ * 	const char * eventFile:	the event file
+ * 	const char * outputFile:	the output file
+ * 	double radius:		the search radius
+ * 	double significance:	the significance level (alpha)
+ * 	double baseLineRatio:	the baseline ratio
+ * 	double minCore:		the minimum number of core points in each cluster
+ * 	bool nonCorePoints:	whether non-core points are added to clusters
+ * 	PointCount & count:	the number of events read
+ * 	PointCount & outside:	the number of events outside the grid
+ * RETURN:
+ * 	TYPE:	int
+ * 	VALUE:	the number of clusters
+ */
+static int clusterEventSet(Options & opts, Background & bg, const char * eventFile, const char * outputFile, double radius, double significance, double baseLineRatio, double minCore, bool nonCorePoints, PointCount & count, PointCount & outside)
+{
+	double * x;
+	double * y;
+	double xMin = 999999999, yMin = 999999999, xMax = -999999999, yMax = -999999999;
+	count = loadPoints(eventFile, x, y, xMin, xMax, yMin, yMax, opts.parallelRead);
 
-	if(NULL == (inputB = fopen(argv[1], "r")))
+	//split the events by whether they are within the extent of the background and indexPoints would place them in a block of the grid
+	bool * in;
+	if(NULL == (in = (bool *)malloc(sizeof(bool) * (count + 1))))
 	{
-		printf("ERROR: Can't open the input file.\n");
+		printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
 		exit(1);
 	}
-	if(NULL == (inputE = fopen(argv[2], "r")))
+	PointCount countE = 0;
+	for(PointCount i = 0; i < count; i++)
 	{
-		printf("ERROR: Can't open the input file.\n");
-		exit(1);
+		in[i] = x[i] >= bg.xMin && x[i] <= bg.xMax && y[i] >= bg.yMin && y[i] <= bg.yMax && (int)((x[i] - bg.xMin) / radius) < bg.nBlockX && (int)((y[i] - bg.yMin) / radius) < bg.nBlockY;
+		if(in[i])
+			countE ++;
 	}
+	outside = count - countE;
 
-		
-	int countB = getCount(inputB, xMin, xMax, yMin, yMax);
-	int countE = getCount(inputE, xMin, xMax, yMin, yMax);
-
-	double * xB;
-	double * yB;
 	double * xE;
 	double * yE;
-
-	if(NULL == (xB = (double *)malloc(sizeof(double) * countB)))
+	double * xOut;
+	double * yOut;
+	PointCount * rowE;
+	PointCount * rowOut;
+	if(NULL == (xE = (double *)malloc(sizeof(double) * (countE + 1))) || NULL == (yE = (double *)malloc(sizeof(double) * (countE + 1))) || NULL == (xOut = (double *)malloc(sizeof(double) * (outside + 1))) || NULL == (yOut = (double *)malloc(sizeof(double) * (outside + 1))) || NULL == (rowE = (PointCount *)malloc(sizeof(PointCount) * (countE + 1))) || NULL == (rowOut = (PointCount *)malloc(sizeof(PointCount) * (outside + 1))))
 	{
 		printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
 		exit(1);
 	}
-	if(NULL == (yB = (double *)malloc(sizeof(double) * countB)))
+	PointCount nE = 0, nOut = 0;
+	for(PointCount i = 0; i < count; i++)
 	{
-		printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
-		exit(1);
+		if(in[i]) {
+			xE[nE] = x[i];
+			yE[nE] = y[i];
+			rowE[nE ++] = i;
+		}
+		else {
+			xOut[nOut] = x[i];
+			yOut[nOut] = y[i];
+			rowOut[nOut ++] = i;
+		}
 	}
-	if(NULL == (xE = (double *)malloc(sizeof(double) * countE)))
+	free(in);
+	free(x);
+	free(y);
+
+	int * clusters;
+	if(NULL == (clusters = (int *)malloc(sizeof(int) * (count + 1))))
 	{
 		printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
 		exit(1);
 	}
-	if(NULL == (yE = (double *)malloc(sizeof(double) * countE)))
+	for(PointCount i = countE; i < count; i++)
+		clusters[i] = -1;
+	PointCount * indexE = NULL;
+	PointCount * orderE = NULL;
+	int nClusters = 0;
+	if(countE > 0)
+	{
+		indexE = indexPoints(xE, yE, countE, bg.xMin, bg.yMin, bg.nBlockX, bg.nBlockY, radius, opts.binaryOutput ? &orderE : NULL);
+		if(opts.sortX)
+			sortBlocksByX(xE, yE, indexE, bg.nBlockX, bg.nBlockY, orderE);
+		KDTree * treeE = useKDTree(opts, indexE, bg.nBlockX, bg.nBlockY) ? buildKDTree(xE, yE, countE, NULL) : NULL;
+
+		PointCount * countPointsB = NULL;
+		double * smoothB = NULL;
+		if(NULL != bg.raster)
+			smoothB = countInDistance_Smooth(xE, yE, countE, bg.raster, radius);
+		else if(NULL != bg.lattice)
+			countPointsB = countInDistance_Lattice(xE, yE, countE, bg.lattice, radius);
+		else
+			countPointsB = (NULL != bg.tree) ? countInDistance_KD(xE, yE, countE, bg.tree, radius) : countInDistance_Double(xE, yE, bg.x, bg.y, indexE, bg.index, bg.nBlockX, bg.nBlockY, radius, NULL, NULL, opts.sortX);
+
+		//with -coreOnly, the events near each point are only counted up to the number that makes it a core point
+		PointCount * critical = NULL;
+		if(opts.coreOnly)
+		{
+			PointCount maxB = 0;
+			for(PointCount i = 0; i < countE; i++)
+			{
+				if(countPointsB[i] > maxB)
+					maxB = countPointsB[i];
+			}
+			PointCount * table = criticalCountsPoi(maxB, countE, bg.count, baseLineRatio, significance);
+			if(NULL == (critical = (PointCount *)malloc(sizeof(PointCount) * (countE + 1))))
+			{
+				printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+				exit(1);
+			}
+			for(PointCount i = 0; i < countE; i++)
+				critical[i] = table[countPointsB[i]];
+			free(table);
+		}
+		PointCount * countPointsE = countEvents(opts, xE, yE, indexE, countE, NULL, treeE, bg.nBlockX, bg.nBlockY, radius, bg.xMin, bg.yMin, bg.xMax, bg.yMax, critical, NULL);
+
+		double * lambda;
+		if(NULL == (lambda = (double *)malloc(sizeof(double) * (countE + 1))))
+		{
+			printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+			exit(1);
+		}
+		for(PointCount i = 0; i < countE; i++)
+			lambda[i] = ((NULL != smoothB) ? smoothB[i] : (double)(countPointsB[i])) * countE * baseLineRatio / bg.count;
+		free(countPointsB);
+		free(smoothB);
+
+		int * clustersE = doClusterPoi(xE, yE, indexE, bg.nBlockX, bg.nBlockY, radius, bg.xMin, bg.yMin, countPointsE, lambda, significance, minCore, nonCorePoints, NULL, treeE, critical, NULL, NULL, opts.sortX);
+		for(PointCount i = 0; i < countE; i++)
+		{
+			clusters[i] = clustersE[i];
+			if(clustersE[i] > nClusters)
+				nClusters = clustersE[i];
+		}
+		free(clustersE);
+		free(countPointsE);
+		free(lambda);
+		free(critical);
+		freeKDTree(treeE);
+	}
+
+	//Output
+	if(opts.binaryOutput) {
+		PointCount * order;
+		if(NULL == (order = (PointCount *)malloc(sizeof(PointCount) * (count + 1))))
+		{
+			printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+			exit(1);
+		}
+		for(PointCount i = 0; i < countE; i++)
+			order[i] = rowE[orderE[i]];
+		for(PointCount i = 0; i < outside; i++)
+			order[countE + i] = rowOut[i];
+		writeLabelsBinary(outputFile, clusters, order, count, NULL, NULL, 0, opts.clusteredOnly);
+		free(order);
+	}
+	else {
+		OutputBuffer * output = openOutput(outputFile);
+		writeLabelsCSV(output, xE, yE, clusters, countE, -1, opts.clusteredOnly);
+		writeLabelsCSV(output, xOut, yOut, clusters + countE, outside, -1, opts.clusteredOnly);
+		closeOutput(output);
+	}
+
+	free(xE);
+	free(yE);
+	free(xOut);
+	free(yOut);
+	free(rowE);
+	free(rowOut);
+	free(indexE);
+	free(orderE);
+	free(clusters);
+	return nClusters;
+}
+
+/**
+ * NAME:	clusterEventList
+ * DESCRIPTION:	-eventList: read and index the background once, then cluster every event file listed in listFile against it, one "events output" pair per line (blank lines and lines starting with # are skipped), and write a report csv with one row per event file
+ * PARAMETERS:
+ * 	Options & opts:		the settings
+ * 	char ** argv:		the command line arguments
+ * RETURN:
+ * 	TYPE:	int
+ * 	VALUE:	the exit status
+ */
+static int clusterEventList(Options & opts, char ** argv)
+{
+	double radius = atof(argv[4]);
+	double significance = atof(argv[5]);
+	double baseLineRatio = atof(argv[6]);
+	double minCore = atof(argv[7]);
+	bool nonCorePoints = (atoi(argv[8]) != 0);
+
+	FILE * list;
+	if(NULL == (list = fopen(argv[2], "r")))
+	{
+		printf("ERROR! Can't open the event list %s\n", argv[2]);
+		return 1;
+	}
+	int nSets = 0;
+	int capacity = 64;
+	char ** events;
+	char ** outputs;
+	if(NULL == (events = (char **)malloc(sizeof(char *) * capacity)) || NULL == (outputs = (char **)malloc(sizeof(char *) * capacity)))
 	{
 		printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
 		exit(1);
 	}
+	char * line = NULL;
+	size_t size = 0;
+	while(getline(&line, &size, list) > 0)
+	{
+		size_t skip = strspn(line, " \t\r\n");
+		if(line[skip] == 0 || line[skip] == '#')
+			continue;
+		char * save;
+		char * eventFile = strtok_r(line, " \t\r\n", &save);
+		char * outputFile = strtok_r(NULL, " \t\r\n", &save);
+		if(NULL == outputFile || NULL != strtok_r(NULL, " \t\r\n", &save))
+		{
+			printf("ERROR! Each line of the event list should be: events output\n");
+			return 1;
+		}
+		//loadPoints exits on a missing file, so every event file is checked before the background is read
+		FILE * file;
+		if(NULL == (file = fopen(eventFile, "rb")))
+		{
+			printf("ERROR! Can't open the event file %s\n", eventFile);
+			return 1;
+		}
+		fclose(file);
+		if(nSets == capacity)
+		{
+			capacity *= 2;
+			if(NULL == (events = (char **)realloc(events, sizeof(char *) * capacity)) || NULL == (outputs = (char **)realloc(outputs, sizeof(char *) * capacity)))
+			{
+				printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+				exit(1);
+			}
+		}
+		events[nSets] = strdup(eventFile);
+		outputs[nSets ++] = strdup(outputFile);
+	}
+	free(line);
+	fclose(list);
+
+	FILE * report;
+	if(NULL == (report = fopen(argv[3], "w")))
+	{
+		printf("ERROR! Can't open the report file %s\n", argv[3]);
+		return 1;
+	}
+
+	Background bg;
+	if(!loadBackground(opts, argv[1], radius, bg))
+		return 1;
+
+	fprintf(report, "events,output,points,outside,clusters\n");
+	for(int i = 0; i < nSets; i++)
+	{
+		PointCount count, outside;
+		int nClusters = clusterEventSet(opts, bg, events[i], outputs[i], radius, significance, baseLineRatio, minCore, nonCorePoints, count, outside);
+		printf("%s: %lld events, %lld outside the background grid, %d clusters\n", events[i], (long long)count, (long long)outside, nClusters);
+		fprintf(report, "%s,%s,%lld,%lld,%d\n", events[i], outputs[i], (long long)count, (long long)outside, nClusters);
+	}
+	fclose(report);
+
+	freeBackground(bg);
+	for(int i = 0; i < nSets; i++) {
+		free(events[i]);
+		free(outputs[i]);
+	}
+	free(events);
+	free(outputs);
+	return 0;
+}
+
+int main(int argc, char ** argv) {
+
+	Options opts;
+	initOptions(opts);
+	if(argc < 9 || !parseOptions(argc, argv, 9, opts)) {
+		printf("ERROR! Incorrect number of input arguments\n");
+		printf("ESCIB_Poisson inputBackground inputEvents output searchRadius significance(alpha) baselineRatio minCorPointsInEachCluster nonCorePoints [options]\n");
+		printOptionsUsage();
+		return 1;
+	}
+	if(opts.coreOnly && NULL != opts.summaryFile) {
+		printf("ERROR! -summary can't be used with -coreOnly\n");
+		return 1;
+	}
+	if(opts.smoothBandwidth > 0 && (opts.coreOnly || opts.geo)) {
+		printf("ERROR! -smooth can't be used with -coreOnly or -geo\n");
+		return 1;
+	}
+	if(opts.eventList) {
+		if(opts.dedup || opts.geo || opts.pipeline || NULL != opts.summaryFile) {
+			printf("ERROR! -eventList can't be used with -dedup, -geo, -pipeline or -summary\n");
+			return 1;
+		}
+		return clusterEventList(opts, argv);
+	}
+
+	double xMin = 999999999, yMin = 999999999, xMax = -999999999, yMax = -999999999;
+
+	double radius = atof(argv[4]);
+	double significance = atof(argv[5]);
+
+	double baseLineRatio = atof(argv[6]);
+	double minCore = atof(argv[7]);
+	bool nonCorePoints = true;
+	if(atoi(argv[8]) == 0)
+		nonCorePoints = false;
+
+	double * xB;
+	double * yB;
+	double * xE;
+	double * yE;
+
+	//inputs may be index files written by ESCIB_Index, which are mapped instead of read and indexed
+	PointIndex * savedB = mapPointIndex(argv[1]);
+	PointIndex * savedE = mapPointIndex(argv[2]);
+	if(opts.dedup && (NULL != savedB || NULL != savedE)) {
+		printf("ERROR! -dedup can't be used with index files\n");
+		return 1;
+	}
+	if(opts.geo && (NULL != savedB || NULL != savedE || opts.approxCells > 0 || opts.index == INDEX_KDTREE)) {
+		printf("ERROR! -geo can't be used with index files, -approx or -index kdtree\n");
+		return 1;
+	}
+	if(opts.sortX && (NULL != savedB || NULL != savedE)) {
+		printf("ERROR! -sortX can't be used with index files\n");
+		return 1;
+	}
 
-	printf("Number of background points: %d\n", countB);
-	printf("Number of event points: %d\n", countE);
+	//with -pipeline, the background is read on a thread of its own while the events are read
+	bool pipelined = opts.pipeline && NULL == savedB && NULL == savedE;
+	PointCount countB, countE;
+	if(pipelined)
+	{
+		PointTask loadingB;
+		startLoading(loadingB, argv[1], opts.parallelRead);
+		countE = loadPoints(argv[2], xE, yE, xMin, xMax, yMin, yMax, opts.parallelRead);
+		countB = finishLoading(loadingB, xB, yB, xMin, xMax, yMin, yMax);
+	}
+	else
+	{
+		countB = (NULL != savedB) ? savedPoints(savedB, xB, yB, xMin, xMax, yMin, yMax) : loadPoints(argv[1], xB, yB, xMin, xMax, yMin, yMax, opts.parallelRead);
+		countE = (NULL != savedE) ? savedPoints(savedE, xE, yE, xMin, xMax, yMin, yMax) : loadPoints(argv[2], xE, yE, xMin, xMax, yMin, yMax, opts.parallelRead);
+	}
+
+	printf("Number of background points: %lld\n", (long long)countB);
+	printf("Number of event points: %lld\n", (long long)countE);
 	printf("X Range: %lf - %lf\n", xMin, xMax);
 	printf("Y Range: %lf - %lf\n", yMin, yMax);
 	printf("Search radius %lf\n", radius);
 
-	readPoints(inputB, xB, yB);
-	readPoints(inputE, xE, yE);
+	//with -geo, longitudes are scaled while points are indexed so that each grid block covers the search radius (see initGeo), and the event longitudes are put back from a copy for the output
+	Geo geo;
+	Geo * geoOrNull = NULL;
+	double * longitudeE = NULL;
+	if(opts.geo) {
+		initGeo(geo, radius, yMin, yMax);
+		toGeoGrid(geo, xB, countB);
+		toGeoGrid(geo, xE, countE, &longitudeE);
+		xMin *= geo.scale;
+		xMax *= geo.scale;
+		radius = geo.blockSize;
+		geoOrNull = &geo;
+	}
 
-	int nBlockX = ceil((xMax - xMin) / radius);
-	int nBlockY = ceil((yMax - yMin) / radius);
+	int nBlockX, nBlockY;
+	if(!gridBlocks(xMin, xMax, yMin, yMax, radius, nBlockX, nBlockY)) {
+		printf("ERROR! The grid of index blocks is too large, use a larger search radius\n");
+		return 1;
+	}
+	if(!matchPointIndex(savedB, radius, xMin, yMin, nBlockX, nBlockY) || !matchPointIndex(savedE, radius, xMin, yMin, nBlockX, nBlockY))
+		return 1;
 
 //	printf("Index blocks: %d * %d\n", nBlockX, nBlockY);
 
-	int * indexB;
-	int * indexE;
+	PointCount * indexB;
+	PointCount * indexE;
+	PointCount * orderE = NULL;
+	PointCount * orderB = NULL;
 
+	//with -dedup, points at the same location are counted and clustered once, weighted by their number
+	PointCount nLocationsE = countE;
+	PointCount nLocationsB = countB;
+	PointCount * weightE = NULL;
+	PointCount * weightB = NULL;
+	PointCount * locationE = NULL;
+	if(opts.dedup)
+	{
+		PointCount * locationB;
+		nLocationsE = dedupPoints(xE, yE, countE, weightE, locationE);
+		nLocationsB = dedupPoints(xB, yB, countB, weightB, locationB);
+		free(locationB);
+		printf("Distinct event locations: %lld\n", (long long)nLocationsE);
+		printf("Distinct background locations: %lld\n", (long long)nLocationsB);
+	}
 
-	indexB = indexPoints(xB, yB, countB, xMin, yMin, nBlockX, nBlockY, radius);
-	indexE = indexPoints(xE, yE, countE, xMin, yMin, nBlockX, nBlockY, radius);
+	//a smoothed background is binned onto its own raster instead of being indexed; with -pipeline, the background is indexed on a thread of its own while the events are indexed and counted
+	PointTask indexingB;
+	bool pendingB = false;
+	if(NULL != savedB)
+		indexB = savedB->index;
+	else if(opts.smoothBandwidth > 0)
+		indexB = NULL;
+	else if(pipelined)
+	{
+		startIndexing(indexingB, xB, yB, nLocationsB, xMin, yMin, nBlockX, nBlockY, radius, opts.dedup, opts.sortX);
+		indexB = NULL;
+		pendingB = true;
+	}
+	else
+		indexB = indexPoints(xB, yB, nLocationsB, xMin, yMin, nBlockX, nBlockY, radius, opts.dedup ? &orderB : NULL);
+	if(NULL != savedE) {
+		indexE = savedE->index;
+		orderE = savedE->order;
+	}
+	else
+		indexE = indexPoints(xE, yE, nLocationsE, xMin, yMin, nBlockX, nBlockY, radius, (opts.binaryOutput || opts.dedup || opts.geo) ? &orderE : NULL);
+	//with -sortX, each row strip of blocks is sorted by X for the searches
+	if(opts.sortX)
+	{
+		if(NULL != indexB)
+			sortBlocksByX(xB, yB, indexB, nBlockX, nBlockY, orderB);
+		sortBlocksByX(xE, yE, indexE, nBlockX, nBlockY, orderE);
+	}
+	if(opts.dedup)
+		reorderValues(weightE, orderE, nLocationsE);
+
+	//KD-trees replace the grid blocks for highly concentrated points
+	KDTree * treeE = useKDTree(opts, indexE, nBlockX, nBlockY) ? buildKDTree(xE, yE, nLocationsE, weightE) : NULL;
+	if(NULL != treeE)
+		printf("KD-tree index for event points\n");
 
-	fclose(inputB);
-	fclose(inputE);
+	//the events near each event point don't depend on the background unless -coreOnly, so they are counted first (while the background is still indexed with -pipeline)
+	PointCount * countPointsE = NULL;
+	if(!opts.coreOnly)
+		countPointsE = countEvents(opts, xE, yE, indexE, nLocationsE, weightE, treeE, nBlockX, nBlockY, radius, xMin, yMin, xMax, yMax, NULL, geoOrNull);
 
-	int * countPointsE = countInDistance_Single(xE, yE, indexE, nBlockX, nBlockY, radius);
-	int * countPointsB = countInDistance_Double(xE, yE, xB, yB, indexE, indexB, nBlockX, nBlockY, radius);
+	if(pendingB)
+		indexB = finishIndexing(indexingB, xB, yB, &orderB);
+	if(opts.dedup)
+	{
+		if(NULL != orderB)
+			reorderValues(weightB, orderB, nLocationsB);
+		free(orderB);
+	}
+	KDTree * treeB = (opts.smoothBandwidth == 0 && useKDTree(opts, indexB, nBlockX, nBlockY)) ? buildKDTree(xB, yB, nLocationsB, weightB) : NULL;
+	if(NULL != treeB)
+		printf("KD-tree index for background points\n");
 
-	free(xB);
-	free(yB);
-	free(indexB);
+	//with -smooth, the background near each event is estimated from a kernel density instead of counted
+	PointCount * countPointsB = NULL;
+	double * smoothB = NULL;
+	if(opts.smoothBandwidth > 0)
+	{
+		Raster * rasterB = buildSmoothRaster(xB, yB, nLocationsB, weightB, xMin, yMin, xMax, yMax, opts.smoothBandwidth);
+		printf("Background smoothed on a raster of %d * %d cells\n", rasterB->nX, rasterB->nY);
+		smoothB = countInDistance_Smooth(xE, yE, nLocationsE, rasterB, radius);
+		freeRaster(rasterB);
+	}
+	//with -approx, counts are summed on a lattice of cells, and only the points near the search circle are tested
+	else if(opts.approxCells > 0)
+	{
+		Lattice * latticeB = buildLattice(xB, yB, nLocationsB, weightB, xMin, yMin, xMax, yMax, radius / opts.approxCells);
+		countPointsB = countInDistance_Lattice(xE, yE, nLocationsE, latticeB, radius);
+		freeLattice(latticeB);
+	}
+	else
+		countPointsB = (NULL != treeB) ? countInDistance_KD(xE, yE, nLocationsE, treeB, radius) : countInDistance_Double(xE, yE, xB, yB, indexE, indexB, nBlockX, nBlockY, radius, weightB, geoOrNull, opts.sortX);
+
+	//with -coreOnly, the events near each point are only counted up to the number that makes it a core point
+	PointCount * critical = NULL;
+	if(opts.coreOnly)
+	{
+		PointCount maxB = 0;
+		for(PointCount i = 0; i < nLocationsE; i++)
+		{
+			if(countPointsB[i] > maxB)
+				maxB = countPointsB[i];
+		}
+		PointCount * table = criticalCountsPoi(maxB, countE, countB, baseLineRatio, significance);
+		if(NULL == (critical = (PointCount *)malloc(sizeof(PointCount) * (nLocationsE + 1))))
+		{
+			printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+			exit(1);
+		}
+		for(PointCount i = 0; i < nLocationsE; i++)
+			critical[i] = table[countPointsB[i]];
+		free(table);
+	}
+
+	if(opts.coreOnly)
+		countPointsE = countEvents(opts, xE, yE, indexE, nLocationsE, weightE, treeE, nBlockX, nBlockY, radius, xMin, yMin, xMax, yMax, critical, geoOrNull);
+
+	if(NULL == savedB) {
+		free(xB);
+		free(yB);
+		free(indexB);
+	}
+	closePointIndex(savedB);
+	freeKDTree(treeB);
+	free(weightB);
 
 	double * lambda;
-	if(NULL == (lambda = (double *)malloc(sizeof(double) * countE)))
+	if(NULL == (lambda = (double *)malloc(sizeof(double) * (nLocationsE + 1))))
 	{
 		printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
 		exit(1);
 	}
 
-	for(int i = 0; i < countE; i++)
+	for(PointCount i = 0; i < nLocationsE; i++)
 	{
 		//lambda[i] = (double)(countPointsB[i]) * countE / countB;
-		lambda[i] = (double)(countPointsB[i]) * countE * baseLineRatio / countB;
+		lambda[i] = ((NULL != smoothB) ? smoothB[i] : (double)(countPointsB[i])) * countE * baseLineRatio / countB;
 	}
 	
 	free(countPointsB);
+	free(smoothB);
 
 
-	int * clusters =  doClusterPoi(xE, yE, indexE, nBlockX, nBlockY, radius, xMin, yMin, countPointsE, lambda, significance, minCore, nonCorePoints);
+	ClusterSummaries summaries;
+	initClusterSummaries(summaries);
+	int * clusters = doClusterPoi(xE, yE, indexE, nBlockX, nBlockY, radius, xMin, yMin, countPointsE, lambda, significance, minCore, nonCorePoints, (NULL != opts.summaryFile) ? &summaries : NULL, treeE, critical, weightE, geoOrNull, opts.sortX);
+	if(opts.dedup)
+	{
+		PointCount * pointOrderE = NULL;
+		int * clustersE = expandDuplicates(clusters, xE, yE, countE, locationE, orderE, nLocationsE, xMin, yMin, nBlockX, nBlockY, radius, opts.sortX, (opts.binaryOutput || opts.geo) ? &pointOrderE : NULL);
+		free(clusters);
+		free(orderE);
+		free(locationE);
+		free(weightE);
+		clusters = clustersE;
+		orderE = pointOrderE;
+	}
+	if(opts.geo) {
+		fromGeoGrid(xE, longitudeE, orderE, countE);
+		if(NULL != opts.summaryFile)
+			fromGeoSummaries(geo, summaries);
+	}
 	//Output 
-	if(NULL == (output = fopen(argv[3], "w"))) {
-		printf("ERROR: Can't open the output file.\n");
-		exit(1);
+	if(opts.binaryOutput) {
+		writeLabelsBinary(argv[3], clusters, orderE, countE, NULL, NULL, 0, opts.clusteredOnly);
 	}
-
-
-	for(int i = 0; i < countE; i++) {
-		fprintf(output, "%lf,%lf,%d\n", xE[i], yE[i], clusters[i]);
+	else {
+		OutputBuffer * output = openOutput(argv[3]);
+		writeLabelsCSV(output, xE, yE, clusters, countE, -1, opts.clusteredOnly);
+		closeOutput(output);
+	}
+	if(NULL == savedE)
+		free(orderE);
+	if(NULL != opts.summaryFile) {
+		writeClusterSummary(opts.summaryFile, summaries);
+		freeClusterSummaries(summaries);
 	}
-
-	fclose(output);
 
 	free(countPointsE);
-	free(xE);
-	free(yE);
-	free(indexE);
+	if(NULL == savedE) {
+		free(xE);
+		free(yE);
+		free(indexE);
+	}
+	closePointIndex(savedE);
+	freeKDTree(treeE);
 	free(lambda);
+	free(critical);
 
 	free(clusters);
 
@@ -0,0 +1,671 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "io.h"
+#include "countPoints.h"
+#include "clusters.h"
+#include "output.h"
+
+#define MODEL_POISSON 0
+#define MODEL_BERNOULLI 1
+
+//the number of search radii whose indexed points are kept
+#define SERVER_CACHE_SIZE 8
+//the longest reply line
+#define SERVER_MAX_REPLY 512
+
+//points loaded once and shared by all requests
+struct Dataset {
+	double * x;
+	double * y;
+	PointCount count;
+};
+
+//points of a data set indexed for one search radius
+struct IndexedSet {
+	double * x;
+	double * y;
+	PointCount * index;
+	PointCount count;
+};
+
+//the grid of one request and the points of both data sets indexed on it
+struct Grid {
+	double radius;
+	double xMin, yMin;
+	int nBlockX, nBlockY;
+	IndexedSet sets[2];
+};
+
+//where requests come from and replies go to
+struct Connection {
+	FILE * in;
+	int outFd;
+	pthread_mutex_t lock;	//guards replies and pending
+	int pending;		//requests queued or running
+	bool closed;		//no more requests will be read
+	bool broken;		//the client is gone, so replies are dropped
+};
+
+//a request line waiting for a worker
+struct Request {
+	char * line;
+	Connection * conn;
+	Request * next;
+};
+
+//the state shared by all threads of the server
+struct Server {
+	int model;
+	Dataset data[2];	//background and events (MODEL_POISSON), or cases and controls (MODEL_BERNOULLI)
+	double xMin, yMin, xMax, yMax;
+
+	Grid cache[SERVER_CACHE_SIZE];
+	int nCached;
+	pthread_mutex_t cacheLock;
+
+	Request * head;
+	Request * tail;
+	bool done;		//no more requests will be queued
+	pthread_mutex_t queueLock;
+	pthread_cond_t notEmpty;
+};
+
+static Server server;
+
+/**
+ * NAME:	copySet
+ * DESCRIPTION:	copy the points of a data set within a box, leaving the shared data set unchanged, and update the bounding box of the copied points
+ * PARAMETERS:
+ * 	Dataset & data:		the data set
+ * 	double * box:		xMin, yMin, xMax, yMax of the box (the maximum is excluded), NULL to copy all points
+ * 	IndexedSet & set:	the copied points, indexed later by indexSet
+ * 	double &xMin:		the minimum X of copied points, can be updated in this function if necessary
+ * 	double &xMax:		the maximum X of copied points, can be updated in this function if necessary
+ * 	double &yMin:		the minimum Y of copied points, can be updated in this function if necessary
+ * 	double &yMax:		the maximum Y of copied points, can be updated in this function if necessary
+ * RETURN: none
+ */
+static void copySet(Dataset & data, double * box, IndexedSet & set, double &xMin, double &xMax, double &yMin, double &yMax)
+{
+	if(NULL == (set.x = (double *)malloc(sizeof(double) * (data.count + 1))))
+	{
+		fprintf(stderr, "ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+		exit(1);
+	}
+	if(NULL == (set.y = (double *)malloc(sizeof(double) * (data.count + 1))))
+	{
+		fprintf(stderr, "ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+		exit(1);
+	}
+	set.count = 0;
+	set.index = NULL;
+	for(PointCount i = 0; i < data.count; i++)
+	{
+		if(NULL != box && (data.x[i] < box[0] || data.y[i] < box[1] || data.x[i] >= box[2] || data.y[i] >= box[3]))
+			continue;
+		set.x[set.count] = data.x[i];
+		set.y[set.count] = data.y[i];
+		if(set.x[set.count] < xMin)
+			xMin = set.x[set.count];
+		if(set.x[set.count] > xMax)
+			xMax = set.x[set.count];
+		if(set.y[set.count] < yMin)
+			yMin = set.y[set.count];
+		if(set.y[set.count] > yMax)
+			yMax = set.y[set.count];
+		set.count ++;
+	}
+}
+
+/**
+ * NAME:	indexSet
+ * DESCRIPTION:	index copied points on a grid
+ * PARAMETERS:
+ * 	Grid & grid:		the grid to index the points on
+ * 	IndexedSet & set:	the points copied by copySet
+ * RETURN: none
+ */
+static void indexSet(Grid & grid, IndexedSet & set)
+{
+	set.index = indexPoints(set.x, set.y, set.count, grid.xMin, grid.yMin, grid.nBlockX, grid.nBlockY, grid.radius);
+}
+
+/**
+ * NAME:	freeGrid
+ * DESCRIPTION:	free the indexed points of a grid
+ * PARAMETERS:
+ * 	Grid & grid: the grid
+ * RETURN: none
+ */
+static void freeGrid(Grid & grid)
+{
+	for(int s = 0; s < 2; s++)
+	{
+		free(grid.sets[s].x);
+		free(grid.sets[s].y);
+		free(grid.sets[s].index);
+	}
+}
+
+/**
+ * NAME:	cachedGrid
+ * DESCRIPTION:	get the points of both data sets indexed for a search radius over the whole extent, indexing them only on the first request with this radius. Cached grids are never changed or freed, so requests read them without locking. The caller checks that the grid fits (see gridBlocks)
+ * PARAMETERS:
+ * 	double radius:	the search radius
+ * 	Grid & grid:	set to the indexed points
+ * RETURN:
+ * 	TYPE:	bool
+ * 	VALUE:	true if the grid is cached, false if it is private to the caller and must be freed by freeGrid
+ */
+static bool cachedGrid(double radius, Grid & grid)
+{
+	pthread_mutex_lock(&server.cacheLock);
+	for(int i = 0; i < server.nCached; i++)
+	{
+		if(server.cache[i].radius == radius)
+		{
+			grid = server.cache[i];
+			pthread_mutex_unlock(&server.cacheLock);
+			return true;
+		}
+	}
+	pthread_mutex_unlock(&server.cacheLock);
+
+	double xMin = 999999999, yMin = 999999999, xMax = -999999999, yMax = -999999999;
+	grid.radius = radius;
+	grid.xMin = server.xMin;
+	grid.yMin = server.yMin;
+	gridBlocks(server.xMin, server.xMax, server.yMin, server.yMax, radius, grid.nBlockX, grid.nBlockY);
+	for(int s = 0; s < 2; s++)
+	{
+		copySet(server.data[s], NULL, grid.sets[s], xMin, xMax, yMin, yMax);
+		indexSet(grid, grid.sets[s]);
+	}
+
+	//another request may have indexed the same radius meanwhile
+	bool cached = false;
+	pthread_mutex_lock(&server.cacheLock);
+	for(int i = 0; i < server.nCached && !cached; i++)
+	{
+		if(server.cache[i].radius == radius)
+		{
+			freeGrid(grid);
+			grid = server.cache[i];
+			cached = true;
+		}
+	}
+	if(!cached && server.nCached < SERVER_CACHE_SIZE)
+	{
+		server.cache[server.nCached ++] = grid;
+		cached = true;
+	}
+	pthread_mutex_unlock(&server.cacheLock);
+	return cached;
+}
+
+/**
+ * NAME:	canWrite
+ * DESCRIPTION:	check that an output file can be created, as the output functions exit on failure
+ * PARAMETERS:
+ * 	const char * fileName:	the output file name
+ * RETURN:
+ * 	TYPE:	bool
+ * 	VALUE:	true if the file can be written
+ */
+static bool canWrite(const char * fileName)
+{
+	FILE * file = fopen(fileName, "wb");
+	if(NULL == file)
+		return false;
+	fclose(file);
+	return true;
+}
+
+/**
+ * NAME:	runRequest
+ * DESCRIPTION:	cluster the loaded points for one request line "id output radius alpha baselineRatio minCore nonCorePoints [summary] [box xMin yMin xMax yMax]" and write the labels (or the cluster summaries) to the output file. With a box, only points within it are used, indexed on the grid of their own bounding box, the same as running the tool on those points. Requests that the library would reject by exiting (an empty box, a grid too large for the radius) get an ERROR reply instead
+ * PARAMETERS:
+ * 	char * line:	the request line, changed by this function
+ * 	char * reply:	the buffer for the reply line "id OK clusters points seconds" or "id ERROR message"
+ * RETURN: none
+ */
+static void runRequest(char * line, char * reply)
+{
+	char * save;
+	char * tokens[16];
+	int nTokens = 0;
+	for(char * t = strtok_r(line, " \t\r\n", &save); NULL != t && nTokens < 16; t = strtok_r(NULL, " \t\r\n", &save))
+		tokens[nTokens ++] = t;
+	if(nTokens == 0)
+	{
+		reply[0] = 0;
+		return;
+	}
+	const char * id = tokens[0];
+	if(nTokens < 7)
+	{
+		snprintf(reply, SERVER_MAX_REPLY, "%s ERROR expected: id output radius alpha baselineRatio minCore nonCorePoints [summary] [box xMin yMin xMax yMax]\n", id);
+		return;
+	}
+
+	const char * output = tokens[1];
+	double radius = atof(tokens[2]);
+	double significance = atof(tokens[3]);
+	double baseLineRatio = atof(tokens[4]);
+	int minCore = atoi(tokens[5]);
+	bool nonCorePoints = (atoi(tokens[6]) != 0);
+	bool summary = false;
+	bool hasBox = false;
+	double box[4];
+	for(int i = 7; i < nTokens; i++)
+	{
+		if(0 == strcmp(tokens[i], "summary"))
+			summary = true;
+		else if(0 == strcmp(tokens[i], "box") && i + 4 < nTokens)
+		{
+			hasBox = true;
+			for(int k = 0; k < 4; k++)
+				box[k] = atof(tokens[++i]);
+		}
+		else
+		{
+			snprintf(reply, SERVER_MAX_REPLY, "%s ERROR unknown argument %s\n", id, tokens[i]);
+			return;
+		}
+	}
+	if(!(radius > 0) || (hasBox && !(box[2] > box[0] && box[3] > box[1])))
+	{
+		snprintf(reply, SERVER_MAX_REPLY, "%s ERROR invalid search radius or box\n", id);
+		return;
+	}
+	if(!canWrite(output))
+	{
+		snprintf(reply, SERVER_MAX_REPLY, "%s ERROR can't open the output file\n", id);
+		return;
+	}
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	Grid grid;
+	bool cached = false;
+	if(hasBox)
+	{
+		double xMin = 999999999, yMin = 999999999, xMax = -999999999, yMax = -999999999;
+		for(int s = 0; s < 2; s++)
+			copySet(server.data[s], box, grid.sets[s], xMin, xMax, yMin, yMax);
+		const char * error = NULL;
+		if(grid.sets[0].count == 0 || grid.sets[1].count == 0)
+			error = "no points of one data set in the box";
+		else if(!gridBlocks(xMin, xMax, yMin, yMax, radius, grid.nBlockX, grid.nBlockY))
+			error = "the grid of index blocks is too large, use a larger search radius";
+		if(NULL != error)
+		{
+			freeGrid(grid);
+			snprintf(reply, SERVER_MAX_REPLY, "%s ERROR %s\n", id, error);
+			return;
+		}
+		grid.radius = radius;
+		grid.xMin = xMin;
+		grid.yMin = yMin;
+		for(int s = 0; s < 2; s++)
+			indexSet(grid, grid.sets[s]);
+	}
+	else
+	{
+		int nBlockX, nBlockY;
+		if(!gridBlocks(server.xMin, server.xMax, server.yMin, server.yMax, radius, nBlockX, nBlockY))
+		{
+			snprintf(reply, SERVER_MAX_REPLY, "%s ERROR the grid of index blocks is too large, use a larger search radius\n", id);
+			return;
+		}
+		cached = cachedGrid(radius, grid);
+	}
+
+	IndexedSet & a = grid.sets[0];
+	IndexedSet & b = grid.sets[1];
+	ClusterSummaries summaries;
+	initClusterSummaries(summaries);
+	int * clusters;
+	PointCount nPoints;
+
+	if(server.model == MODEL_POISSON)
+	{
+		//a: background, b: events
+		PointCount * countPointsE = countInDistance_Single(b.x, b.y, b.index, grid.nBlockX, grid.nBlockY, radius);
+		PointCount * countPointsB = countInDistance_Double(b.x, b.y, a.x, a.y, b.index, a.index, grid.nBlockX, grid.nBlockY, radius);
+		double * lambda;
+		if(NULL == (lambda = (double *)malloc(sizeof(double) * (b.count + 1))))
+		{
+			fprintf(stderr, "ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+			exit(1);
+		}
+		for(PointCount i = 0; i < b.count; i++)
+			lambda[i] = (double)(countPointsB[i]) * b.count * baseLineRatio / a.count;
+		clusters = doClusterPoi(b.x, b.y, b.index, grid.nBlockX, grid.nBlockY, radius, grid.xMin, grid.yMin, countPointsE, lambda, significance, minCore, nonCorePoints, summary ? &summaries : NULL);
+		nPoints = b.count;
+		if(!summary)
+		{
+			OutputBuffer * out = openOutput(output);
+			writeLabelsCSV(out, b.x, b.y, clusters, b.count, -1, false);
+			closeOutput(out);
+		}
+		free(countPointsE);
+		free(countPointsB);
+		free(lambda);
+	}
+	else
+	{
+		//a: cases, b: controls
+		PointCount * countPointsCas = countInDistance_Single(a.x, a.y, a.index, grid.nBlockX, grid.nBlockY, radius);
+		PointCount * countPointsCon = countInDistance_Double(a.x, a.y, b.x, b.y, a.index, b.index, grid.nBlockX, grid.nBlockY, radius);
+		double p = baseLineRatio * a.count / (a.count + b.count);
+		clusters = doClusterBer(a.x, a.y, a.index, b.x, b.y, b.index, grid.nBlockX, grid.nBlockY, radius, grid.xMin, grid.yMin, countPointsCas, countPointsCon, p, significance, minCore, nonCorePoints, summary ? &summaries : NULL);
+		nPoints = a.count + (nonCorePoints ? b.count : 0);
+		if(!summary)
+		{
+			OutputBuffer * out = openOutput(output);
+			writeLabelsCSV(out, a.x, a.y, clusters, a.count, 1, false);
+			if(nonCorePoints)
+				writeLabelsCSV(out, b.x, b.y, clusters + a.count, b.count, 0, false);
+			closeOutput(out);
+		}
+		free(countPointsCas);
+		free(countPointsCon);
+	}
+
+	int nClusters = 0;
+	for(PointCount i = 0; i < nPoints; i++)
+	{
+		if(clusters[i] > nClusters)
+			nClusters = clusters[i];
+	}
+	if(summary)
+	{
+		writeClusterSummary(output, summaries);
+		freeClusterSummaries(summaries);
+	}
+	free(clusters);
+	if(!cached)
+		freeGrid(grid);
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	snprintf(reply, SERVER_MAX_REPLY, "%s OK clusters=%d points=%lld seconds=%.3lf\n", id, nClusters, (long long)nPoints, (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+}
+
+/**
+ * NAME:	releaseConnection
+ * DESCRIPTION:	mark one request of a connection as finished, closing the connection after its last request once it has no more
+ * PARAMETERS:
+ * 	Connection * conn:	the connection
+ * 	bool finished:		whether a request finished (otherwise the reading of requests finished)
+ * RETURN: none
+ */
+static void releaseConnection(Connection * conn, bool finished)
+{
+	pthread_mutex_lock(&conn->lock);
+	if(finished)
+		conn->pending --;
+	else
+		conn->closed = true;
+	bool last = conn->closed && conn->pending == 0;
+	pthread_mutex_unlock(&conn->lock);
+	if(!last)
+		return;
+	fclose(conn->in);
+	close(conn->outFd);
+	pthread_mutex_destroy(&conn->lock);
+	free(conn);
+}
+
+/**
+ * NAME:	worker
+ * DESCRIPTION:	the thread function of a worker: run queued requests until the queue is empty and no more requests will come
+ * PARAMETERS:
+ * 	void * arg: not used
+ * RETURN:
+ * 	TYPE:	void *
+ * 	VALUE:	NULL
+ */
+static void * worker(void * arg)
+{
+	(void)arg;
+#ifdef _OPENMP
+	//requests run side by side, so each of them keeps to its own thread
+	omp_set_num_threads(1);
+#endif
+	char reply[SERVER_MAX_REPLY];
+	Request * req;
+	while(true)
+	{
+		pthread_mutex_lock(&server.queueLock);
+		while(NULL == server.head && !server.done)
+			pthread_cond_wait(&server.notEmpty, &server.queueLock);
+		req = server.head;
+		if(NULL != req)
+		{
+			server.head = req->next;
+			if(NULL == server.head)
+				server.tail = NULL;
+		}
+		pthread_mutex_unlock(&server.queueLock);
+		if(NULL == req)
+			return NULL;
+
+		runRequest(req->line, reply);
+		pthread_mutex_lock(&req->conn->lock);
+		//SIGPIPE is ignored, so a client that is gone only fails its own connection
+		if(reply[0] != 0 && !req->conn->broken && write(req->conn->outFd, reply, strlen(reply)) < 0)
+		{
+			req->conn->broken = true;
+			fprintf(stderr, "ERROR: Can't send a reply: %s\n", strerror(errno));
+		}
+		pthread_mutex_unlock(&req->conn->lock);
+		releaseConnection(req->conn, true);
+		free(req->line);
+		free(req);
+	}
+}
+
+/**
+ * NAME:	readRequests
+ * DESCRIPTION:	the thread function reading request lines from a connection and queueing them for the workers
+ * PARAMETERS:
+ * 	void * arg: the connection
+ * RETURN:
+ * 	TYPE:	void *
+ * 	VALUE:	NULL
+ */
+static void * readRequests(void * arg)
+{
+	Connection * conn = (Connection *)arg;
+	char * line = NULL;
+	size_t size = 0;
+	Request * req;
+	while(getline(&line, &size, conn->in) > 0)
+	{
+		if(NULL == (req = (Request *)malloc(sizeof(Request))))
+		{
+			fprintf(stderr, "ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+			exit(1);
+		}
+		req->line = line;
+		req->conn = conn;
+		req->next = NULL;
+		line = NULL;
+		size = 0;
+
+		pthread_mutex_lock(&conn->lock);
+		conn->pending ++;
+		pthread_mutex_unlock(&conn->lock);
+
+		pthread_mutex_lock(&server.queueLock);
+		if(NULL == server.tail)
+			server.head = req;
+		else
+			server.tail->next = req;
+		server.tail = req;
+		pthread_cond_signal(&server.notEmpty);
+		pthread_mutex_unlock(&server.queueLock);
+	}
+	free(line);
+	releaseConnection(conn, false);
+	return NULL;
+}
+
+/**
+ * NAME:	openConnection
+ * DESCRIPTION:	create a connection reading requests from one file descriptor and replying to another
+ * PARAMETERS:
+ * 	int inFd:	where requests are read from
+ * 	int outFd:	where replies are written to
+ * RETURN:
+ * 	TYPE:	Connection *
+ * 	VALUE:	the connection, freed after its last reply
+ */
+static Connection * openConnection(int inFd, int outFd)
+{
+	Connection * conn;
+	if(NULL == (conn = (Connection *)malloc(sizeof(Connection))))
+	{
+		fprintf(stderr, "ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+		exit(1);
+	}
+	if(NULL == (conn->in = fdopen(inFd, "r")))
+	{
+		fprintf(stderr, "ERROR: Can't read requests.\n");
+		exit(1);
+	}
+	conn->outFd = outFd;
+	conn->pending = 0;
+	conn->closed = false;
+	conn->broken = false;
+	pthread_mutex_init(&conn->lock, NULL);
+	return conn;
+}
+
+int main(int argc, char ** argv) {
+
+	const char * socketPath = NULL;
+	int nThreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	bool parallelRead = false;
+	bool badArgs = (argc < 4);
+	for(int i = 4; i < argc && !badArgs; i++)
+	{
+		if(0 == strcmp(argv[i], "-socket") && i + 1 < argc)
+			socketPath = argv[++i];
+		else if(0 == strcmp(argv[i], "-threads") && i + 1 < argc)
+			nThreads = atoi(argv[++i]);
+		else if(0 == strcmp(argv[i], "-parallelRead"))
+			parallelRead = true;
+		else
+			badArgs = true;
+	}
+	if(!badArgs && 0 == strcmp(argv[1], "poisson"))
+		server.model = MODEL_POISSON;
+	else if(!badArgs && 0 == strcmp(argv[1], "bernoulli"))
+		server.model = MODEL_BERNOULLI;
+	else
+		badArgs = true;
+	if(badArgs) {
+		fprintf(stderr, "ERROR! Incorrect input arguments\n");
+		fprintf(stderr, "ESCIB_Server poisson inputBackground inputEvents [-socket path] [-threads n] [-parallelRead]\n");
+		fprintf(stderr, "ESCIB_Server bernoulli inputCase inputControl [-socket path] [-threads n] [-parallelRead]\n");
+		fprintf(stderr, "Requests, one per line: id output searchRadius significance(alpha) baselineRatio minCorPointsInEachCluster nonCorePoints [summary] [box xMin yMin xMax yMax]\n");
+		return 1;
+	}
+	if(nThreads < 1)
+		nThreads = 1;
+	signal(SIGPIPE, SIG_IGN);
+
+	//replies go to the original stdout, and everything printed (including messages of the library) goes to stderr
+	int replyFd = dup(STDOUT_FILENO);
+	fflush(stdout);
+	dup2(STDERR_FILENO, STDOUT_FILENO);
+
+	server.xMin = 999999999;
+	server.yMin = 999999999;
+	server.xMax = -999999999;
+	server.yMax = -999999999;
+	for(int s = 0; s < 2; s++)
+		server.data[s].count = loadPoints(argv[2 + s], server.data[s].x, server.data[s].y, server.xMin, server.xMax, server.yMin, server.yMax, parallelRead);
+
+	fprintf(stderr, "Number of points: %lld, %lld\n", (long long)server.data[0].count, (long long)server.data[1].count);
+	fprintf(stderr, "X Range: %lf - %lf\n", server.xMin, server.xMax);
+	fprintf(stderr, "Y Range: %lf - %lf\n", server.yMin, server.yMax);
+
+	server.nCached = 0;
+	server.head = server.tail = NULL;
+	server.done = false;
+	pthread_mutex_init(&server.cacheLock, NULL);
+	pthread_mutex_init(&server.queueLock, NULL);
+	pthread_cond_init(&server.notEmpty, NULL);
+
+	pthread_t * workers;
+	if(NULL == (workers = (pthread_t *)malloc(sizeof(pthread_t) * nThreads)))
+	{
+		fprintf(stderr, "ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+		exit(1);
+	}
+	for(int i = 0; i < nThreads; i++)
+		pthread_create(workers + i, NULL, worker, NULL);
+
+	if(NULL == socketPath)
+	{
+		//requests from stdin, until it is closed
+		readRequests(openConnection(STDIN_FILENO, replyFd));
+	}
+	else
+	{
+		//requests from any number of clients, until the server is killed
+		int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		struct sockaddr_un addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		strncpy(addr.sun_path, socketPath, sizeof(addr.sun_path) - 1);
+		unlink(socketPath);
+		if(-1 == fd || -1 == bind(fd, (struct sockaddr *)&addr, sizeof(addr)) || -1 == listen(fd, 16))
+		{
+			fprintf(stderr, "ERROR: Can't listen on the socket.\n");
+			exit(1);
+		}
+		fprintf(stderr, "Listening on %s\n", socketPath);
+		int client;
+		pthread_t reader;
+		while(-1 != (client = accept(fd, NULL, NULL)))
+		{
+			pthread_create(&reader, NULL, readRequests, openConnection(client, dup(client)));
+			pthread_detach(reader);
+		}
+		close(fd);
+	}
+
+	pthread_mutex_lock(&server.queueLock);
+	server.done = true;
+	pthread_cond_broadcast(&server.notEmpty);
+	pthread_mutex_unlock(&server.queueLock);
+	for(int i = 0; i < nThreads; i++)
+		pthread_join(workers[i], NULL);
+	free(workers);
+
+	for(int i = 0; i < server.nCached; i++)
+		freeGrid(server.cache[i]);
+	for(int s = 0; s < 2; s++)
+	{
+		free(server.data[s].x);
+		free(server.data[s].y);
+	}
+	return 0;
+}
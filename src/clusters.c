@@ -1,22 +1,26 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <limits.h>
+#include "io.h"
+#include "kdtree.h"
+#include "clusters.h"
 
 /**
  * NAME:	PossionTest
  * DESCRIPTION:	calculate the probability to get a value equal or larger than nP under a Poisson (lambda) distribution
  * PARAMETERS:
- * 	int nP:	the value from Poisson distribution
+ * 	PointCount nP:	the value from Poisson distribution
  * 	double lambda: the mean of Poisson distribution
  * RETURN:
  * 	TYPE:	double
  * 	VALUE:	the probability to get a value equal or larger than nP
  */
-double PossionTest(int nP, double lambda)
+double PossionTest(PointCount nP, double lambda)
 {
 	double sum = 1.0;
 	double element = 1;
-	for(int i = 1; i < nP; i++)
+	for(PointCount i = 1; i < nP; i++)
 	{
 		element = element * lambda / i;
 		sum += element;
@@ -30,22 +34,22 @@ double PossionTest(int nP, double lambda)
  * NAME:	BinomialTest
  * DESCRIPTION:	calculate the probability to get equal or more cases than nCas under a Binomial (nCas, (nCas+nCon), p) distribution
  * PARAMETERS:
- * 	int nCas: the number of cases
- * 	int nCon: the number of controls
+ * 	PointCount nCas: the number of cases
+ * 	PointCount nCon: the number of controls
  * 	double p: the p of Binomial distribution (e.g., the probability of any point to be a case)
  * RETURN:
  * 	TYPE:	double
  * 	VALUE:	the probability to get a value equal or larger than nCas
  */
-double BinomialTest(int nCas, int nCon, double p)
+double BinomialTest(PointCount nCas, PointCount nCon, double p)
 {
 	double q = 1 - p;
-	int n = nCas + nCon;
+	PointCount n = nCas + nCon;
 	double logElement = n * log(q);
 	 
 	double sum = exp(logElement);
 
-	for(int i = 1; i < nCas; i++)
+	for(PointCount i = 1; i < nCas; i++)
 	{
 		logElement = logElement + log(n+1-i) + log(p) - log(i) - log(q);
 		sum += exp(logElement);
@@ -53,30 +57,288 @@ double BinomialTest(int nCas, int nCon, double p)
 	return 1 - sum;
 }
 
+/**
+ * NAME:	criticalCountsPoi
+ * DESCRIPTION:	get, for each number of background points near an event point, the smallest number of nearby events that makes it a core point. lambda is computed from the background count the same way as in ESCIB_Poisson, and the tail probabilities are accumulated exactly as PossionTest does, so comparing a count with the table gives the same result as PossionTest
+ * PARAMETERS:
+ * 	PointCount maxBackground:	the largest number of background points near an event point
+ * 	PointCount countE:	the number of event points
+ * 	PointCount countB:	the number of background points
+ * 	double baseLineRatio:	the ratio null hypothesis to the baseline
+ * 	double significance:	the significane level to tell a cluste core point
+ * RETURN:
+ * 	TYPE:	PointCount *
+ * 	VALUE:	an array of length (maxBackground + 1); POINT_COUNT_MAX if no count up to countE is significant
+ */
+PointCount * criticalCountsPoi(PointCount maxBackground, PointCount countE, PointCount countB, double baseLineRatio, double significance)
+{
+	PointCount * critical;
+	if(NULL == (critical = (PointCount *)malloc(sizeof(PointCount) * (maxBackground + 1))))
+	{
+		printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+		exit(1);
+	}
+
+	#pragma omp parallel for schedule(dynamic, 64)
+	for(PointCount b = 0; b <= maxBackground; b++)
+	{
+		double lambda = (double)(b) * countE * baseLineRatio / countB;
+		double expL = exp(-lambda);
+		double sum = 1.0;
+		double element = 1;
+		//sum holds the terms 0..nP-1 of PossionTest(nP, lambda)
+		critical[b] = POINT_COUNT_MAX;
+		//once exp(-lambda) underflows, PossionTest is 1 for every count
+		if(expL == 0)
+			continue;
+		for(PointCount nP = 1; nP <= countE; nP++)
+		{
+			if(nP > 1)
+			{
+				element = element * lambda / (nP - 1);
+				//a term too small to change the sum leaves PossionTest the same for every larger count
+				if(sum + element == sum)
+					break;
+				sum += element;
+			}
+			if(1 - sum * expL < significance)
+			{
+				critical[b] = nP;
+				break;
+			}
+		}
+	}
+	return critical;
+}
+
+/**
+ * NAME:	criticalCountsBer
+ * DESCRIPTION:	get, for each number of control points near a case point, the smallest number of nearby cases that makes it a core point under BinomialTest. The critical count hardly changes from one number of controls to the next, so each search starts from the previous one
+ * PARAMETERS:
+ * 	PointCount maxControls:	the largest number of control points near a case point
+ * 	PointCount countCas:	the number of case points
+ * 	double p:		the p of Binomial distribution
+ * 	double significance:	the significane level to tell a cluste core point
+ * RETURN:
+ * 	TYPE:	PointCount *
+ * 	VALUE:	an array of length (maxControls + 1); POINT_COUNT_MAX if no count up to countCas is significant
+ */
+PointCount * criticalCountsBer(PointCount maxControls, PointCount countCas, double p, double significance)
+{
+	PointCount * critical;
+	if(NULL == (critical = (PointCount *)malloc(sizeof(PointCount) * (maxControls + 1))))
+	{
+		printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+		exit(1);
+	}
+
+	PointCount nCas = 1;
+	for(PointCount c = 0; c <= maxControls; c++)
+	{
+		//step back in case rounding made the previous count smaller than needed
+		while(nCas > 1 && nCas <= countCas && BinomialTest(nCas - 1, c, p) < significance)
+			nCas --;
+		while(nCas <= countCas && BinomialTest(nCas, c, p) >= significance)
+			nCas ++;
+		critical[c] = (nCas <= countCas) ? nCas : POINT_COUNT_MAX;
+	}
+	return critical;
+}
+
+/**
+ * NAME:	initClusterSummaries
+ * DESCRIPTION:	initialize an empty list of cluster statistics
+ * PARAMETERS:
+ * 	ClusterSummaries & summaries: the list to initialize
+ * RETURN: none
+ */
+void initClusterSummaries(ClusterSummaries & summaries)
+{
+	summaries.items = NULL;
+	summaries.count = 0;
+	summaries.capacity = 0;
+}
+
+/**
+ * NAME:	freeClusterSummaries
+ * DESCRIPTION:	free the memory of a list of cluster statistics
+ * PARAMETERS:
+ * 	ClusterSummaries & summaries: the list to free
+ * RETURN: none
+ */
+void freeClusterSummaries(ClusterSummaries & summaries)
+{
+	free(summaries.items);
+	initClusterSummaries(summaries);
+}
+
+/**
+ * NAME:	startSummary
+ * DESCRIPTION:	reset the statistics of a cluster before it is expanded
+ * PARAMETERS:
+ * 	ClusterSummary & s:	the statistics to reset
+ * 	int cID:		the ID of the cluster
+ * RETURN: none
+ */
+static void startSummary(ClusterSummary & s, int cID)
+{
+	s.clusterID = cID;
+	s.members = 0;
+	s.cores = 0;
+	s.xMin = s.yMin = HUGE_VAL;
+	s.xMax = s.yMax = -HUGE_VAL;
+	s.sumX = s.sumY = 0;
+	s.cases = 0;
+	s.controls = 0;
+	s.expected = 0;
+}
+
+/**
+ * NAME:	addToSummary
+ * DESCRIPTION:	add a point to the statistics of a cluster
+ * PARAMETERS:
+ * 	ClusterSummary & s:	the statistics to update
+ * 	double x:		the X value of the point
+ * 	double y:		the Y value of the point
+ * 	PointCount w:		the number of input points at the location
+ * RETURN: none
+ */
+static inline void addToSummary(ClusterSummary & s, double x, double y, PointCount w)
+{
+	s.members += w;
+	if(x < s.xMin)
+		s.xMin = x;
+	if(x > s.xMax)
+		s.xMax = x;
+	if(y < s.yMin)
+		s.yMin = y;
+	if(y > s.yMax)
+		s.yMax = y;
+	s.sumX += x * w;
+	s.sumY += y * w;
+}
+
+/**
+ * NAME:	addCaseToSummary
+ * DESCRIPTION:	add an event (or case) point to the statistics of a cluster
+ * PARAMETERS:
+ * 	ClusterSummary & s:	the statistics to update
+ * 	double x:		the X value of the point
+ * 	double y:		the Y value of the point
+ * 	double expected:	the share of each point in the expected number of cases
+ * 	PointCount w:		the number of input points at the location
+ * RETURN: none
+ */
+static inline void addCaseToSummary(ClusterSummary & s, double x, double y, double expected, PointCount w)
+{
+	addToSummary(s, x, y, w);
+	s.cases += w;
+	s.expected += expected * w;
+}
+
+/**
+ * NAME:	keepSummary
+ * DESCRIPTION:	append the statistics of a cluster which is kept to a list
+ * PARAMETERS:
+ * 	ClusterSummaries * summaries:	the list, nothing is done if it is NULL
+ * 	ClusterSummary & s:		the statistics of the cluster
+ * RETURN: none
+ */
+static void keepSummary(ClusterSummaries * summaries, ClusterSummary & s)
+{
+	if(NULL == summaries)
+		return;
+	if(summaries->count == summaries->capacity)
+	{
+		summaries->capacity = (summaries->capacity == 0) ? 64 : summaries->capacity * 2;
+		if(NULL == (summaries->items = (ClusterSummary *)realloc(summaries->items, sizeof(ClusterSummary) * summaries->capacity)))
+		{
+			printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+			exit(1);
+		}
+	}
+	summaries->items[summaries->count ++] = s;
+}
+
+/**
+ * NAME:	pointWeight
+ * DESCRIPTION:	get the number of input points at a location
+ * PARAMETERS:
+ * 	PointCount * weight:	the number of input points at each location, NULL if every point counts once
+ * 	PointCount i:	the location
+ * RETURN:
+ * 	TYPE:	int
+ * 	VALUE:	the weight of the location
+ */
+static inline PointCount pointWeight(PointCount * weight, PointCount i)
+{
+	return (NULL == weight) ? 1 : weight[i];
+}
+
+/**
+ * NAME:	addNeighbor
+ * DESCRIPTION:	add a point found within the search radius of a core point, which is not in any cluster yet, to the cluster being expanded. A core point is also queued to be expanded
+ * PARAMETERS:
+ * 	PointCount iNb:		the point found
+ * 	int cID:		the ID of the cluster
+ * 	int * clusterID:	the cluster ID of each point, 0 for core points not in any cluster and -1 for other points not in any cluster
+ * 	bool nonCorePoints:	whether a cluster include non-core points
+ * 	PointCount * pointsToDo:	the core points waiting to be expanded
+ * 	PointCount &nPToDo:	the number of core points waiting to be expanded
+ * 	PointCount &coreCount:	the number of core points in the cluster
+ * 	PointCount * weight:	the number of input points at each location, NULL if every point counts once
+ * RETURN:
+ * 	TYPE:	bool
+ * 	VALUE:	whether the point is added to the cluster
+ */
+static inline bool addNeighbor(PointCount iNb, int cID, int * clusterID, bool nonCorePoints, PointCount * pointsToDo, PointCount &nPToDo, PointCount &coreCount, PointCount * weight)
+{
+	if(clusterID[iNb] != -1)
+	{
+		pointsToDo[nPToDo] = iNb;
+		nPToDo ++;
+		coreCount += pointWeight(weight, iNb);
+		clusterID[iNb] = cID;
+		return true;
+	}
+	if(nonCorePoints)
+	{
+		clusterID[iNb] = cID;
+		return true;
+	}
+	return false;
+}
+
 /**
  * NAME:	doClusterPoi
  * DESCRIPTION:	cluster all event points based on a Possion Test
  * PARAMETERS:
  * 	double * x: 		the array of event points' X values
  * 	double * y: 		the array of event points' Y values
- * 	int * index:		the index of all event points
+ * 	PointCount * index:	the index of all event points
  * 	int nBlockX:		the number of index blocks along X dimension
  * 	int nBlockY:		the number of index blocks along Y dimension
  *	double radius:		the search radius, which is also the block size
  *	double xMin:		the minimum X of all points
  *	double yMin:		the minimum Y of all points
- *	int * eC:		the number of events points (within radius) near each event points
+ *	PointCount * eC:	the number of events points (within radius) near each event points
  *	double * lambda:	the local lambda of Possion distribution of each event points
  *	double significance: 	the significane level to tell a cluste core point
  *	int minCore:		the minimum number of core points in each cluster (each cluste should have more core points than minCore)
  *	bool nonCorePoints:	whether a cluster include non-core points
+ *	ClusterSummaries * summaries:	if not NULL, the statistics of each kept cluster are appended to it. The expected number of events of a cluster sums lambda / eC of its events
+ *	KDTree * tree:		if not NULL, a KD-tree of the event points used to find neighbors instead of the index blocks
+ *	PointCount * critical:	if not NULL, the smallest eC making each event point a core point (see criticalCountsPoi), used instead of PossionTest
+ *	PointCount * weight:	if not NULL, the number of input events at each (deduplicated) location; eC must then be the weighted count, and core points, members and cases are counted with these weights
+ *	const Geo * geo:	if not NULL, points are geographic (see withinGeo) and the radius is the size of each index block in degrees of latitude; the KD-tree must then be NULL
+ *	bool sortedX:		if true, points are sorted by X within each index block (see sortBlocksByX), and each row strip is only tested within the X window of the search
  * RETURN:
  * 	TYPE:	int *
  * 	VALUE:	the cluster ID of each event point
  */
-int * doClusterPoi(double * x, double * y, int * index, int nBlockX, int nBlockY, double radius, double xMin, double yMin, int * eC, double * lambda, double significance, int minCore, bool nonCorePoints)
+int * doClusterPoi(double * x, double * y, PointCount * index, int nBlockX, int nBlockY, double radius, double xMin, double yMin, PointCount * eC, double * lambda, double significance, int minCore, bool nonCorePoints, ClusterSummaries * summaries, KDTree * tree, PointCount * critical, PointCount * weight, const Geo * geo, bool sortedX)
 {
-	int count = index[nBlockX * nBlockY];
+	PointCount count = index[nBlockX * nBlockY];
 
 	int * clusterID;
 	if(NULL == (clusterID = (int *)malloc(sizeof(int) * count)))
@@ -85,35 +347,43 @@ int * doClusterPoi(double * x, double * y, int * index, int nBlockX, int nBlockY
 		exit(1);
 	}
 
-	for(int i = 0; i < count; i++)
+	for(PointCount i = 0; i < count; i++)
 	{
-		if(PossionTest(eC[i], lambda[i]) < significance)
+		if((NULL != critical) ? (eC[i] >= critical[i]) : (PossionTest(eC[i], lambda[i]) < significance))
 			clusterID[i] = 0;
 		else
 			clusterID[i] = -1;
 	}
 
-	int * pointsToDo;
-	if(NULL == (pointsToDo = (int *)malloc(sizeof(int) * count)))
+	PointCount * pointsToDo;
+	if(NULL == (pointsToDo = (PointCount *)malloc(sizeof(PointCount) * count)))
 	{
 		printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
 		exit(1);
 	}
-	int nPToDo = 0;
+	PointCount nPToDo = 0;
 	int cID = 0;
 
 	double dist2 = radius * radius;
 
-	double cX, cY;
+	double cX, cY, cosY = 0;
 	int colID, rowID;
 	int colMin, colMax, rowMin, rowMax;
 
-	int iNb;
-	int iNbEnd;
+	PointCount iNb, stripEnd;
+	PointCount nNb;
+	//points found by the KD-tree
+	PointCount * neighbors = NULL;
+	if(NULL != tree && NULL == (neighbors = (PointCount *)malloc(sizeof(PointCount) * (count + 1))))
+	{
+		printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+		exit(1);
+	}
 
-	int coreCount;
+	PointCount coreCount;
+	ClusterSummary summary;
 
-	for(int i = 0; i < count; i++)
+	for(PointCount i = 0; i < count; i++)
 	{
 		if(clusterID[i] != 0)
 			continue;
@@ -122,12 +392,31 @@ int * doClusterPoi(double * x, double * y, int * index, int nBlockX, int nBlockY
 		cID ++;
 		clusterID[i] = cID;
 		
-		coreCount = 1;	
+		coreCount = pointWeight(weight, i);	
+		if(NULL != summaries)
+		{
+			startSummary(summary, cID);
+			addCaseToSummary(summary, x[i], y[i], lambda[i] / eC[i], pointWeight(weight, i));
+		}
 
 		while(nPToDo > 0) {
 			nPToDo --;
 			cX = x[pointsToDo[nPToDo]];		
 			cY = y[pointsToDo[nPToDo]];
+			if(NULL != geo)
+				cosY = geoCos(cY);
+
+			if(NULL != tree)
+			{
+				nNb = rangeSearchKD(tree, cX, cY, radius, neighbors);
+				for(PointCount k = 0; k < nNb; k++)
+				{
+					iNb = neighbors[k];
+					if(clusterID[iNb] < 1 && addNeighbor(iNb, cID, clusterID, nonCorePoints, pointsToDo, nPToDo, coreCount, weight) && NULL != summaries)
+						addCaseToSummary(summary, x[iNb], y[iNb], lambda[iNb] / eC[iNb], pointWeight(weight, iNb));
+				}
+				continue;
+			}
 
 			colID = (int)((cX - xMin) / radius);
 			rowID = (int)((cY - yMin) / radius);
@@ -139,21 +428,18 @@ int * doClusterPoi(double * x, double * y, int * index, int nBlockX, int nBlockY
 
 			for(int row = rowMin; row <= rowMax; row ++)
 			{
-				for(iNb = index[row * nBlockX + colMin]; iNb < index[row * nBlockX + colMax + 1]; iNb ++)
+				stripEnd = index[row * nBlockX + colMax + 1];
+				iNb = sortedX ? stripWindowStart(x, index[row * nBlockX + colMin], stripEnd, cX, dist2) : index[row * nBlockX + colMin];
+				for(; iNb < stripEnd; iNb ++)
 				{
+					if(sortedX && afterStripWindow(x[iNb], cX, dist2))
+						break;
 					if(clusterID[iNb] < 1)
 					{
-						if(dist2 >= ((x[iNb] - cX) * (x[iNb] - cX) + (y[iNb] - cY) * (y[iNb] - cY)))
+						if((NULL == geo) ? (dist2 >= ((x[iNb] - cX) * (x[iNb] - cX) + (y[iNb] - cY) * (y[iNb] - cY))) : withinGeo(geo, cX, cY, cosY, x[iNb], y[iNb]))
 						{
-							if(clusterID[iNb] != -1)
-							{
-								pointsToDo[nPToDo] = iNb;
-								nPToDo ++;
-								coreCount ++;
-								clusterID[iNb] = cID;
-							}
-							else if(nonCorePoints)
-								clusterID[iNb] = cID;
+							if(addNeighbor(iNb, cID, clusterID, nonCorePoints, pointsToDo, nPToDo, coreCount, weight) && NULL != summaries)
+								addCaseToSummary(summary, x[iNb], y[iNb], lambda[iNb] / eC[iNb], pointWeight(weight, iNb));
 						}
 					}
 				}
@@ -163,17 +449,23 @@ int * doClusterPoi(double * x, double * y, int * index, int nBlockX, int nBlockY
 
 		if(coreCount <= minCore)
 		{
-			for(int j = 0; j < count; j++)
+			for(PointCount j = 0; j < count; j++)
 			{
 				if(clusterID[j] == cID)
 					clusterID[j] = -1;
 			}
 			cID --;
 		}
+		else if(NULL != summaries)
+		{
+			summary.cores = coreCount;
+			keepSummary(summaries, summary);
+		}
 		
 	}
 
 	free(pointsToDo);
+	free(neighbors);
 	return clusterID; 
 }
 
@@ -184,29 +476,37 @@ int * doClusterPoi(double * x, double * y, int * index, int nBlockX, int nBlockY
  * PARAMETERS:
  * 	double * xCas: 		the array of case points' X values
  * 	double * yCas: 		the array of case points' Y values
- * 	int * indexCas:		the index of all case points
+ * 	PointCount * indexCas:	the index of all case points
  * 	double * xCon: 		the array of control points' X values
  * 	double * yCon: 		the array of control points' Y values
- * 	int * indexCon:		the index of all control points
+ * 	PointCount * indexCon:	the index of all control points
  * 	int nBlockX:		the number of index blocks along X dimension
  * 	int nBlockY:		the number of index blocks along Y dimension
  *	double radius:		the search radius, which is also the block size
  *	double xMin:		the minimum X of all points
  *	double yMin:		the minimum Y of all points
- *	int * casC:		the number of case points (within radius) near each case points
- *	int * conC:		the number of control points (within radius) near each case points
+ *	PointCount * casC:	the number of case points (within radius) near each case points
+ *	PointCount * conC:	the number of control points (within radius) near each case points
  *	double p:		the p of Possion distribution
  *	double significance: 	the significane level to tell a cluste core point
  *	int minCore:		the minimum number of core points in each cluster (each cluste should have more core points than minCore)
  *	bool nonCorePoints:	whether a cluster include non-core points
+ *	ClusterSummaries * summaries:	if not NULL, the statistics of each kept cluster are appended to it. The expected number of cases of a cluster sums p * (casC + conC) / casC of its cases
+ *	KDTree * treeCas:	if not NULL, a KD-tree of the case points used to find neighbors instead of the index blocks
+ *	KDTree * treeCon:	if not NULL, a KD-tree of the control points used to find neighbors instead of the index blocks
+ *	PointCount * critical:	if not NULL, the smallest casC making each case point a core point (see criticalCountsBer), used instead of BinomialTest
+ *	PointCount * weightCas:	if not NULL, the number of input cases at each (deduplicated) location; casC must then be the weighted count
+ *	PointCount * weightCon:	if not NULL, the number of input controls at each (deduplicated) location; conC must then be the weighted count
+ *	const Geo * geo:	if not NULL, points are geographic (see withinGeo) and the radius is the size of each index block in degrees of latitude; the KD-trees must then be NULL
+ *	bool sortedX:		if true, points are sorted by X within each index block (see sortBlocksByX), and each row strip is only tested within the X window of the search
  * RETURN:
  * 	TYPE:	int *
  * 	VALUE:	an array of length (countCas + countCon): the cluster ID of each case and control point
  */
-int * doClusterBer(double * xCas, double * yCas, int * indexCas, double * xCon, double * yCon, int * indexCon, int nBlockX, int nBlockY, double radius, double xMin, double yMin, int * casC, int * conC, double p, double significance, int minCore, bool nonCorePoints)
+int * doClusterBer(double * xCas, double * yCas, PointCount * indexCas, double * xCon, double * yCon, PointCount * indexCon, int nBlockX, int nBlockY, double radius, double xMin, double yMin, PointCount * casC, PointCount * conC, double p, double significance, int minCore, bool nonCorePoints, ClusterSummaries * summaries, KDTree * treeCas, KDTree * treeCon, PointCount * critical, PointCount * weightCas, PointCount * weightCon, const Geo * geo, bool sortedX)
 {
-	int countCas = indexCas[nBlockX * nBlockY];
-	int countCon = indexCon[nBlockX * nBlockY];
+	PointCount countCas = indexCas[nBlockX * nBlockY];
+	PointCount countCon = indexCon[nBlockX * nBlockY];
 
 	int * clusterID;
 	if(NULL == (clusterID = (int *)malloc(sizeof(int) * (countCas + countCon))))
@@ -215,34 +515,48 @@ int * doClusterBer(double * xCas, double * yCas, int * indexCas, double * xCon,
 		exit(1);
 	}
 
-	for(int i = 0; i < countCas; i++)
+	for(PointCount i = 0; i < countCas; i++)
 	{
-		if(BinomialTest(casC[i], conC[i], p) < significance)
+		if((NULL != critical) ? (casC[i] >= critical[i]) : (BinomialTest(casC[i], conC[i], p) < significance))
 			clusterID[i] = 0;
 		else
 			clusterID[i] = -1;
 	}
+	//control points are not in any cluster until they are reached by one
+	for(PointCount i = countCas; i < (countCas + countCon); i++)
+	{
+		clusterID[i] = 0;
+	}
 
-	int * pointsToDo;
-	if(NULL == (pointsToDo = (int *)malloc(sizeof(int) * countCas)))
+	PointCount * pointsToDo;
+	if(NULL == (pointsToDo = (PointCount *)malloc(sizeof(PointCount) * countCas)))
 	{
 		printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
 		exit(1);
 	}
-	int nPToDo = 0;
+	PointCount nPToDo = 0;
 	int cID = 0;
 
 	double dist2 = radius * radius;
 
-	double cX, cY;
+	double cX, cY, cosY = 0;
 	int colID, rowID;
 	int colMin, colMax, rowMin, rowMax;
 
-	int iNb;
+	PointCount iNb, stripEnd;
+	PointCount nNb;
+	//points found by the KD-tree
+	PointCount * neighbors = NULL;
+	if((NULL != treeCas || NULL != treeCon) && NULL == (neighbors = (PointCount *)malloc(sizeof(PointCount) * (((countCas > countCon) ? countCas : countCon) + 1))))
+	{
+		printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+		exit(1);
+	}
 
-	int coreCount;
+	PointCount coreCount;
+	ClusterSummary summary;
 
-	for(int i = 0; i < countCas; i++)
+	for(PointCount i = 0; i < countCas; i++)
 	{
 		if(clusterID[i] != 0)
 			continue;
@@ -251,12 +565,49 @@ int * doClusterBer(double * xCas, double * yCas, int * indexCas, double * xCon,
 		cID ++;
 		clusterID[i] = cID;
 		
-		coreCount = 1;	
+		coreCount = pointWeight(weightCas, i);	
+		if(NULL != summaries)
+		{
+			startSummary(summary, cID);
+			addCaseToSummary(summary, xCas[i], yCas[i], p * (casC[i] + conC[i]) / casC[i], pointWeight(weightCas, i));
+		}
 
 		while(nPToDo > 0) {
 			nPToDo --;
 			cX = xCas[pointsToDo[nPToDo]];		
 			cY = yCas[pointsToDo[nPToDo]];
+			if(NULL != geo)
+				cosY = geoCos(cY);
+
+			if(NULL != treeCas)
+			{
+				nNb = rangeSearchKD(treeCas, cX, cY, radius, neighbors);
+				for(PointCount k = 0; k < nNb; k++)
+				{
+					iNb = neighbors[k];
+					if(clusterID[iNb] < 1 && addNeighbor(iNb, cID, clusterID, nonCorePoints, pointsToDo, nPToDo, coreCount, weightCas) && NULL != summaries)
+						addCaseToSummary(summary, xCas[iNb], yCas[iNb], p * (casC[iNb] + conC[iNb]) / casC[iNb], pointWeight(weightCas, iNb));
+				}
+			}
+			if(NULL != treeCon && nonCorePoints)
+			{
+				nNb = rangeSearchKD(treeCon, cX, cY, radius, neighbors);
+				for(PointCount k = 0; k < nNb; k++)
+				{
+					iNb = neighbors[k];
+					if(clusterID[countCas + iNb] < 1)
+					{
+						clusterID[countCas + iNb] = cID;
+						if(NULL != summaries)
+						{
+							addToSummary(summary, xCon[iNb], yCon[iNb], pointWeight(weightCon, iNb));
+							summary.controls += pointWeight(weightCon, iNb);
+						}
+					}
+				}
+			}
+			if(NULL != treeCas && (NULL != treeCon || !nonCorePoints))
+				continue;
 
 			colID = (int)((cX - xMin) / radius);
 			rowID = (int)((cY - yMin) / radius);
@@ -268,33 +619,41 @@ int * doClusterBer(double * xCas, double * yCas, int * indexCas, double * xCon,
 
 			for(int row = rowMin; row <= rowMax; row ++)
 			{
-				for(iNb = indexCas[row * nBlockX + colMin]; iNb < indexCas[row * nBlockX + colMax + 1]; iNb ++)
-				{
-					if(clusterID[iNb] < 1)
+				if(NULL == treeCas) {
+					stripEnd = indexCas[row * nBlockX + colMax + 1];
+					iNb = sortedX ? stripWindowStart(xCas, indexCas[row * nBlockX + colMin], stripEnd, cX, dist2) : indexCas[row * nBlockX + colMin];
+					for(; iNb < stripEnd; iNb ++)
 					{
-						if(dist2 >= ((xCas[iNb] - cX) * (xCas[iNb] - cX) + (yCas[iNb] - cY) * (yCas[iNb] - cY)))
+						if(sortedX && afterStripWindow(xCas[iNb], cX, dist2))
+							break;
+						if(clusterID[iNb] < 1)
 						{
-							if(clusterID[iNb] != -1)
+							if((NULL == geo) ? (dist2 >= ((xCas[iNb] - cX) * (xCas[iNb] - cX) + (yCas[iNb] - cY) * (yCas[iNb] - cY))) : withinGeo(geo, cX, cY, cosY, xCas[iNb], yCas[iNb]))
 							{
-								pointsToDo[nPToDo] = iNb;
-								nPToDo ++;
-								coreCount ++;
-								clusterID[iNb] = cID;
+								if(addNeighbor(iNb, cID, clusterID, nonCorePoints, pointsToDo, nPToDo, coreCount, weightCas) && NULL != summaries)
+									addCaseToSummary(summary, xCas[iNb], yCas[iNb], p * (casC[iNb] + conC[iNb]) / casC[iNb], pointWeight(weightCas, iNb));
 							}
-							else if(nonCorePoints)
-								clusterID[iNb] = cID;
 						}
 					}
 				}
 
-				if(nonCorePoints) {
-					for(iNb = indexCon[row * nBlockX + colMin]; iNb < indexCon[row * nBlockX + colMax + 1]; iNb ++)
+				if(nonCorePoints && NULL == treeCon) {
+					stripEnd = indexCon[row * nBlockX + colMax + 1];
+					iNb = sortedX ? stripWindowStart(xCon, indexCon[row * nBlockX + colMin], stripEnd, cX, dist2) : indexCon[row * nBlockX + colMin];
+					for(; iNb < stripEnd; iNb ++)
 					{
+						if(sortedX && afterStripWindow(xCon[iNb], cX, dist2))
+							break;
 						if(clusterID[countCas + iNb] < 1)
 						{
-							if(dist2 >= ((xCon[iNb] - cX) * (xCon[iNb] - cX) + (yCon[iNb] - cY) * (yCon[iNb] - cY)))
+							if((NULL == geo) ? (dist2 >= ((xCon[iNb] - cX) * (xCon[iNb] - cX) + (yCon[iNb] - cY) * (yCon[iNb] - cY))) : withinGeo(geo, cX, cY, cosY, xCon[iNb], yCon[iNb]))
 							{
 								clusterID[countCas + iNb] = cID;
+								if(NULL != summaries)
+								{
+									addToSummary(summary, xCon[iNb], yCon[iNb], pointWeight(weightCon, iNb));
+									summary.controls += pointWeight(weightCon, iNb);
+								}
 							}
 						}
 					}
@@ -305,23 +664,29 @@ int * doClusterBer(double * xCas, double * yCas, int * indexCas, double * xCon,
 
 		if(coreCount <= minCore)
 		{
-			for(int j = 0; j < (countCas + countCon); j++)
+			for(PointCount j = 0; j < (countCas + countCon); j++)
 			{
 				if(clusterID[j] == cID)
 					clusterID[j] = -1;
 			}
 			cID --;
 		}
+		else if(NULL != summaries)
+		{
+			summary.cores = coreCount;
+			keepSummary(summaries, summary);
+		}
 		
 	}
 
-	for(int j = countCas; j < (countCas + countCon); j++)
+	for(PointCount j = countCas; j < (countCas + countCon); j++)
 	{
 		if(clusterID[j] == 0)
 			clusterID[j] = -1;
 	}
 
 	free(pointsToDo);
+	free(neighbors);
 	return clusterID; 
 }
 
@@ -332,23 +697,27 @@ int * doClusterBer(double * xCas, double * yCas, int * indexCas, double * xCon,
  * PARAMETERS:
  * 	double * x: 		the array of events' X values
  * 	double * y: 		the array of events' Y values
- * 	int * index:		the index of all event points
+ * 	PointCount * index:	the index of all event points
  * 	int nBlockX:		the number of index blocks along X dimension
  * 	int nBlockY:		the number of index blocks along Y dimension
  *	double radius:		the search radius, which is also the block size
  *	int minPts:		the minimum points to form a core points
  *	double xMin:		the minimum X of all points
  *	double yMin:		the minimum Y of all points
- *	int * eC:		the number of event points (within radius) near each event points
+ *	PointCount * eC:	the number of event points (within radius) near each event points
  *	int minCore:		the minimum number of core points in each cluster (each cluste should have more core points than minCore)
  *	bool nonCorePoints:	whether a cluster include non-core points
+ *	KDTree * tree:		if not NULL, a KD-tree of the event points used to find neighbors instead of the index blocks
+ *	PointCount * weight:	if not NULL, the number of input events at each (deduplicated) location; eC must then be the weighted count
+ *	const Geo * geo:	if not NULL, points are geographic (see withinGeo) and the radius is the size of each index block in degrees of latitude; the KD-tree must then be NULL
+ *	bool sortedX:		if true, points are sorted by X within each index block (see sortBlocksByX), and each row strip is only tested within the X window of the search
  * RETURN:
  * 	TYPE:	int *
  * 	VALUE:	an array of length count: the cluster ID of each case and control point
  */
-int * doClusterDBSCAN(double * x, double * y, int * index, int nBlockX, int nBlockY, double radius, int minPts, double xMin, double yMin, int * eC, int minCore, bool nonCorePoints) {
+int * doClusterDBSCAN(double * x, double * y, PointCount * index, int nBlockX, int nBlockY, double radius, int minPts, double xMin, double yMin, PointCount * eC, int minCore, bool nonCorePoints, KDTree * tree, PointCount * weight, const Geo * geo, bool sortedX) {
 
-	int count = index[nBlockX * nBlockY];
+	PointCount count = index[nBlockX * nBlockY];
 
 	int * clusterID;
 	if(NULL == (clusterID = (int *)malloc(sizeof(int) * count)))
@@ -357,7 +726,7 @@ int * doClusterDBSCAN(double * x, double * y, int * index, int nBlockX, int nBlo
 		exit(1);
 	}
 
-	for(int i = 0; i < count; i++)
+	for(PointCount i = 0; i < count; i++)
 	{
 		if(eC[i] >= minPts)
 			clusterID[i] = 0;
@@ -365,26 +734,34 @@ int * doClusterDBSCAN(double * x, double * y, int * index, int nBlockX, int nBlo
 			clusterID[i] = -1;
 	}
 
-	int * pointsToDo;
-	if(NULL == (pointsToDo = (int *)malloc(sizeof(int) * count)))
+	PointCount * pointsToDo;
+	if(NULL == (pointsToDo = (PointCount *)malloc(sizeof(PointCount) * count)))
 	{
 		printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
 		exit(1);
 	}
-	int nPToDo = 0;
+	PointCount nPToDo = 0;
 	int cID = 0;
 
 	double dist2 = radius * radius;
 
-	double cX, cY;
+	double cX, cY, cosY = 0;
 	int colID, rowID;
 	int colMin, colMax, rowMin, rowMax;
 
-	int iNb;
+	PointCount iNb, stripEnd;
+	PointCount nNb;
+	//points found by the KD-tree
+	PointCount * neighbors = NULL;
+	if(NULL != tree && NULL == (neighbors = (PointCount *)malloc(sizeof(PointCount) * (count + 1))))
+	{
+		printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+		exit(1);
+	}
 
-	int coreCount;
+	PointCount coreCount;
 
-	for(int i = 0; i < count; i++)
+	for(PointCount i = 0; i < count; i++)
 	{
 		if(clusterID[i] != 0)
 			continue;
@@ -393,12 +770,26 @@ int * doClusterDBSCAN(double * x, double * y, int * index, int nBlockX, int nBlo
 		cID ++;
 		clusterID[i] = cID;
 		
-		coreCount = 1;	
+		coreCount = pointWeight(weight, i);	
 
 		while(nPToDo > 0) {
 			nPToDo --;
 			cX = x[pointsToDo[nPToDo]];		
 			cY = y[pointsToDo[nPToDo]];
+			if(NULL != geo)
+				cosY = geoCos(cY);
+
+			if(NULL != tree)
+			{
+				nNb = rangeSearchKD(tree, cX, cY, radius, neighbors);
+				for(PointCount k = 0; k < nNb; k++)
+				{
+					iNb = neighbors[k];
+					if(clusterID[iNb] < 1)
+						addNeighbor(iNb, cID, clusterID, nonCorePoints, pointsToDo, nPToDo, coreCount, weight);
+				}
+				continue;
+			}
 
 			colID = (int)((cX - xMin) / radius);
 			rowID = (int)((cY - yMin) / radius);
@@ -410,22 +801,16 @@ int * doClusterDBSCAN(double * x, double * y, int * index, int nBlockX, int nBlo
 
 			for(int row = rowMin; row <= rowMax; row ++)
 			{
-				for(iNb = index[row * nBlockX + colMin]; iNb < index[row * nBlockX + colMax + 1]; iNb ++)
+				stripEnd = index[row * nBlockX + colMax + 1];
+				iNb = sortedX ? stripWindowStart(x, index[row * nBlockX + colMin], stripEnd, cX, dist2) : index[row * nBlockX + colMin];
+				for(; iNb < stripEnd; iNb ++)
 				{
+					if(sortedX && afterStripWindow(x[iNb], cX, dist2))
+						break;
 					if(clusterID[iNb] < 1)
 					{
-						if(dist2 >= ((x[iNb] - cX) * (x[iNb] - cX) + (y[iNb] - cY) * (y[iNb] - cY)))
-						{
-							if(clusterID[iNb] != -1)
-							{
-								pointsToDo[nPToDo] = iNb;
-								nPToDo ++;
-								coreCount ++;
-								clusterID[iNb] = cID;
-							}
-							else if(nonCorePoints)
-								clusterID[iNb] = cID;
-						}
+						if((NULL == geo) ? (dist2 >= ((x[iNb] - cX) * (x[iNb] - cX) + (y[iNb] - cY) * (y[iNb] - cY))) : withinGeo(geo, cX, cY, cosY, x[iNb], y[iNb]))
+							addNeighbor(iNb, cID, clusterID, nonCorePoints, pointsToDo, nPToDo, coreCount, weight);
 					}
 				}
 			}
@@ -434,7 +819,7 @@ int * doClusterDBSCAN(double * x, double * y, int * index, int nBlockX, int nBlo
 
 		if(coreCount <= minCore)
 		{
-			for(int j = 0; j < count; j++)
+			for(PointCount j = 0; j < count; j++)
 			{
 				if(clusterID[j] == cID)
 					clusterID[j] = -1;
@@ -446,5 +831,6 @@ int * doClusterDBSCAN(double * x, double * y, int * index, int nBlockX, int nBlo
 
 
 	free(pointsToDo);
+	free(neighbors);
 	return clusterID;
 }
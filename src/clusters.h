@@ -1,10 +1,37 @@
 #ifndef CH
 #define CH
+
+#include "kdtree.h"
+#include "geo.h"
+
+//statistics of one cluster, accumulated while the cluster is expanded
+struct ClusterSummary {
+	int clusterID;
+	PointCount members;	//all points in the cluster
+	PointCount cores;	//core points in the cluster
+	double xMin, yMin, xMax, yMax;
+	double sumX, sumY;	//used to get the centroid of members
+	PointCount cases;	//event (or case) points in the cluster
+	PointCount controls;	//control points in the cluster
+	double expected;	//expected number of cases, each case contributing its share of the expectation in its neighborhood
+};
+
+//a growing list of cluster statistics
+struct ClusterSummaries {
+	ClusterSummary * items;
+	int count;
+	int capacity;
+};
+
+void initClusterSummaries(ClusterSummaries & summaries);
+void freeClusterSummaries(ClusterSummaries & summaries);
+PointCount * criticalCountsPoi(PointCount maxBackground, PointCount countE, PointCount countB, double baseLineRatio, double significance);
+PointCount * criticalCountsBer(PointCount maxControls, PointCount countCas, double p, double significance);
 //Poisson
-int * doClusterPoi(double * x, double * y, int * index, int nBlockX, int nBlockY, double radius, double xMin, double yMin, int * eC, double * lambda, double significance, int minCores, bool nonCorePoints);
+int * doClusterPoi(double * x, double * y, PointCount * index, int nBlockX, int nBlockY, double radius, double xMin, double yMin, PointCount * eC, double * lambda, double significance, int minCores, bool nonCorePoints, ClusterSummaries * summaries = NULL, KDTree * tree = NULL, PointCount * critical = NULL, PointCount * weight = NULL, const Geo * geo = NULL, bool sortedX = false);
 //Bernoulli
-int * doClusterBer(double * xCas, double * yCas, int * indexCas, double * xCon, double * yCon, int * indexCon, int nBlockX, int nBlockY, double radius, double xMin, double yMin, int * casC, int * conC, double p, double significance, int minCore, bool nonCorePoints);
+int * doClusterBer(double * xCas, double * yCas, PointCount * indexCas, double * xCon, double * yCon, PointCount * indexCon, int nBlockX, int nBlockY, double radius, double xMin, double yMin, PointCount * casC, PointCount * conC, double p, double significance, int minCore, bool nonCorePoints, ClusterSummaries * summaries = NULL, KDTree * treeCas = NULL, KDTree * treeCon = NULL, PointCount * critical = NULL, PointCount * weightCas = NULL, PointCount * weightCon = NULL, const Geo * geo = NULL, bool sortedX = false);
 //DBSCAN
-int * doClusterDBSCAN(double * x, double * y, int * index, int nBlockX, int nBlockY, double radius, int minPts, double xMin, double yMin, int * eC, int minCore, bool nonCorePoints);
+int * doClusterDBSCAN(double * x, double * y, PointCount * index, int nBlockX, int nBlockY, double radius, int minPts, double xMin, double yMin, PointCount * eC, int minCore, bool nonCorePoints, KDTree * tree = NULL, PointCount * weight = NULL, const Geo * geo = NULL, bool sortedX = false);
 
 #endif
@@ -1,5 +1,10 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <math.h>
+#include "io.h"
+#include "kdtree.h"
+#include "lattice.h"
+#include "geo.h"
 
 /**
  * NAME:	countInDistance_Single
@@ -7,54 +12,74 @@
  * PARAMETERS:
  * 	double * xE:		type A points' X values 
  * 	double * yE:		type A points' Y values 
- * 	int * indexE:		the index of type A points
+ * 	PointCount * indexE:	the index of type A points
  * 	int nBlockX:		the number of index blocks along X dimension
  * 	int nBlockY:		the number of index blocks along Y dimension
  * 	double distance:	the distance, which is also the size (side length) of each index block
+ * 	PointCount * limit:	if not NULL, counting for each point stops once its count reaches its limit (the count needed to be a core point)
+ * 	PointCount * weight:	if not NULL, the weight of each type A point (the number of input points at its location), summed instead of counting each point once
+ * 	const Geo * geo:	if not NULL, points are geographic (see withinGeo) and the distance is the size of each index block in degrees of latitude
+ * 	bool sortedX:		if true, points are sorted by X within each index block (see sortBlocksByX), and each row strip is only tested within the X window of the search, which moves forward from one point of a block to the next
  * RETURN:
- * 	TYPE:	int * 
- * 	VALUE:	an array of the numbers of points within the distance, ordered the same as xE and yE
+ * 	TYPE:	PointCount * 
+ * 	VALUE:	an array of the numbers of points within the distance (at most the limit), ordered the same as xE and yE
  */
 
-int * countInDistance_Single(double * xE, double * yE, int * indexE, int nBlockX, int nBlockY, double distance)
+PointCount * countInDistance_Single(double * xE, double * yE, PointCount * indexE, int nBlockX, int nBlockY, double distance, PointCount * limit, PointCount * weight, const Geo * geo, bool sortedX)
 {
-	int countE = indexE[nBlockX * nBlockY];
-	int * count;
+	PointCount countE = indexE[nBlockX * nBlockY];
+	PointCount * count;
 	
-	if(NULL == (count = (int *)malloc(sizeof(int) * countE)))
+	if(NULL == (count = (PointCount *)malloc(sizeof(PointCount) * countE)))
 	{
 		printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
 		exit(1);
 	}
-	double x, y;
 	double dis2 = distance * distance;
-	int colID, rowID;
-	int colMin, colMax, rowMin, rowMax;
-	int iC, iP;
-	int pCol, pRow;
-	for(rowID = 0; rowID < nBlockY; rowID ++)
+	#pragma omp parallel for schedule(dynamic, 64)
+	for(int b = 0; b < nBlockX * nBlockY; b++)
 	{
-		for(colID = 0; colID < nBlockX; colID ++)
+		int colID = b % nBlockX;
+		int rowID = b / nBlockX;
+		int colMin = (colID == 0) ? 0 : (colID - 1);
+		int colMax = (colID == nBlockX - 1) ? (nBlockX - 1) : (colID + 1);
+		int rowMin = (rowID == 0) ? 0 : (rowID - 1);
+		int rowMax = (rowID == nBlockY - 1) ? (nBlockY - 1) : (rowID + 1);
+		double x, y, cosY = 0;
+		PointCount iP, stripEnd, lim;
+		//with sortedX, the centers of a block come in increasing X, so the X window of each strip only moves forward
+		PointCount windowStart[3];
+		for(int row = rowMin; row <= rowMax; row ++)
+			windowStart[row - rowMin] = indexE[row * nBlockX + colMin];
+		for(PointCount iC = indexE[b]; iC < indexE[b + 1]; iC++)
 		{
-			colMin = (colID == 0) ? 0 : (colID - 1);
-			colMax = (colID == nBlockX - 1) ? (nBlockX - 1) : (colID + 1);
-			rowMin = (rowID == 0) ? 0 : (rowID - 1);
-			rowMax = (rowID == nBlockY - 1) ? (nBlockY - 1) : (rowID + 1);
-			for(iC = indexE[rowID * nBlockX + colID]; iC < indexE[rowID * nBlockX + colID + 1]; iC++)
+			x = xE[iC];
+			y = yE[iC];
+			if(NULL != geo)
+				cosY = geoCos(y);
+			count[iC] = 0;
+			lim = (NULL == limit) ? POINT_COUNT_MAX : limit[iC];
+			for(int row = rowMin; row <= rowMax && count[iC] < lim; row ++)
 			{
-				x = xE[iC];
-				y = yE[iC];
-				count[iC] = 0;
-				for(int row = rowMin; row <= rowMax; row ++)
+				stripEnd = indexE[row * nBlockX + colMax + 1];
+				iP = indexE[row * nBlockX + colMin];
+				if(sortedX)
+				{
+					while(windowStart[row - rowMin] < stripEnd && beforeStripWindow(xE[windowStart[row - rowMin]], x, dis2))
+						windowStart[row - rowMin] ++;
+					iP = windowStart[row - rowMin];
+				}
+				for(; iP < stripEnd; iP ++)
 				{
-					for(iP = indexE[row * nBlockX + colMin]; iP < indexE[row * nBlockX + colMax + 1]; iP ++)
+					if(sortedX && afterStripWindow(xE[iP], x, dis2))
+						break;
+					if((NULL == geo) ? (dis2 >= ((xE[iP] - x) * (xE[iP] - x) + (yE[iP] - y) * (yE[iP] - y))) : withinGeo(geo, x, y, cosY, xE[iP], yE[iP]))
 					{
-						if(dis2 >= ((xE[iP] - x) * (xE[iP] - x) + (yE[iP] - y) * (yE[iP] - y)))
-							count[iC] ++;
+						count[iC] += (NULL == weight) ? 1 : weight[iP];
+						if(count[iC] >= lim)
+							break;
 					}
-
 				}
-
 			}
 		}
 	}
@@ -69,60 +94,258 @@ int * countInDistance_Single(double * xE, double * yE, int * indexE, int nBlockX
  * 	double * yE:		type A points' Y values 
  * 	double * xB:		type B points' X values 
  * 	double * yB:		type B points' Y values 
- * 	int * indexE:		the index of type A points
- * 	int * indexB:		the index of type B points
+ * 	PointCount * indexE:	the index of type A points
+ * 	PointCount * indexB:	the index of type B points
  * 	int nBlockX:		the number of index blocks along X dimension
  * 	int nBlockY:		the number of index blocks along Y dimension
  * 	double distance:	the distance, which is also the size (side length) of each index block
+ * 	PointCount * weightB:	if not NULL, the weight of each type B point (the number of input points at its location), summed instead of counting each point once
+ * 	const Geo * geo:	if not NULL, points are geographic (see withinGeo) and the distance is the size of each index block in degrees of latitude
+ * 	bool sortedX:		if true, points are sorted by X within each index block (see sortBlocksByX), and each row strip is only tested within the X window of the search, which moves forward from one point of a block to the next
  * RETURN:
- * 	TYPE:	int * 
+ * 	TYPE:	PointCount * 
  * 	VALUE:	an array of the numbers of points within the distance
  */
 
-int * countInDistance_Double(double * xE, double * yE, double * xB, double * yB, int * indexE, int * indexB, int nBlockX, int nBlockY, double distance)
+PointCount * countInDistance_Double(double * xE, double * yE, double * xB, double * yB, PointCount * indexE, PointCount * indexB, int nBlockX, int nBlockY, double distance, PointCount * weightB, const Geo * geo, bool sortedX)
 {
-	int countE = indexE[nBlockX * nBlockY];
-	int countB = indexB[nBlockX * nBlockY];
+	PointCount countE = indexE[nBlockX * nBlockY];
+	PointCount countB = indexB[nBlockX * nBlockY];
 
-	int * count;
+	PointCount * count;
 	
-	if(NULL == (count = (int *)malloc(sizeof(int) * countE)))
+	if(NULL == (count = (PointCount *)malloc(sizeof(PointCount) * countE)))
 	{
 		printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
 		exit(1);
 	}
-	double x, y;
 	double dis2 = distance * distance;
-	int colID, rowID;
-	int colMin, colMax, rowMin, rowMax;
-	int iC, iP;
-	int pCol, pRow;
-	for(rowID = 0; rowID < nBlockY; rowID ++)
+	#pragma omp parallel for schedule(dynamic, 64)
+	for(int b = 0; b < nBlockX * nBlockY; b++)
 	{
-		for(colID = 0; colID < nBlockX; colID ++)
+		int colID = b % nBlockX;
+		int rowID = b / nBlockX;
+		int colMin = (colID == 0) ? 0 : (colID - 1);
+		int colMax = (colID == nBlockX - 1) ? (nBlockX - 1) : (colID + 1);
+		int rowMin = (rowID == 0) ? 0 : (rowID - 1);
+		int rowMax = (rowID == nBlockY - 1) ? (nBlockY - 1) : (rowID + 1);
+		double x, y, cosY = 0;
+		PointCount iP, stripEnd;
+		//with sortedX, the centers of a block come in increasing X, so the X window of each strip only moves forward
+		PointCount windowStart[3];
+		for(int row = rowMin; row <= rowMax; row ++)
+			windowStart[row - rowMin] = indexB[row * nBlockX + colMin];
+		for(PointCount iC = indexE[b]; iC < indexE[b + 1]; iC++)
 		{
-			colMin = (colID == 0) ? 0 : (colID - 1);
-			colMax = (colID == nBlockX - 1) ? (nBlockX - 1) : (colID + 1);
-			rowMin = (rowID == 0) ? 0 : (rowID - 1);
-			rowMax = (rowID == nBlockY - 1) ? (nBlockY - 1) : (rowID + 1);
-			for(iC = indexE[rowID * nBlockX + colID]; iC < indexE[rowID * nBlockX + colID + 1]; iC++)
+			x = xE[iC];
+			y = yE[iC];
+			if(NULL != geo)
+				cosY = geoCos(y);
+			count[iC] = 0;
+			for(int row = rowMin; row <= rowMax; row ++)
 			{
-				x = xE[iC];
-				y = yE[iC];
-				count[iC] = 0;
-				for(int row = rowMin; row <= rowMax; row ++)
+				stripEnd = indexB[row * nBlockX + colMax + 1];
+				iP = indexB[row * nBlockX + colMin];
+				if(sortedX)
 				{
-					for(iP = indexB[row * nBlockX + colMin]; iP < indexB[row * nBlockX + colMax + 1]; iP ++)
-					{
-						if(dis2 >= ((xB[iP] - x) * (xB[iP] - x) + (yB[iP] - y) * (yB[iP] - y)))
-							count[iC] ++;
-					}
+					while(windowStart[row - rowMin] < stripEnd && beforeStripWindow(xB[windowStart[row - rowMin]], x, dis2))
+						windowStart[row - rowMin] ++;
+					iP = windowStart[row - rowMin];
+				}
+				for(; iP < stripEnd; iP ++)
+				{
+					if(sortedX && afterStripWindow(xB[iP], x, dis2))
+						break;
+					if((NULL == geo) ? (dis2 >= ((xB[iP] - x) * (xB[iP] - x) + (yB[iP] - y) * (yB[iP] - y))) : withinGeo(geo, x, y, cosY, xB[iP], yB[iP]))
+						count[iC] += (NULL == weightB) ? 1 : weightB[iP];
+				}
+			}
+		}
+	}
+	return count;
+}
+
+/**
+ * NAME:	countInDistance_Categories
+ * DESCRIPTION:	get, for each case point, the number of case points of its own category and the number of control points within a distance, in a single sweep of the blocks around each case point: the cases of all categories share one index, and the strips of both indices are searched together
+ * PARAMETERS:
+ * 	double * xCas:		case points' X values
+ * 	double * yCas:		case points' Y values
+ * 	int * category:		the category of each case point
+ * 	double * xCon:		control points' X values
+ * 	double * yCon:		control points' Y values
+ * 	PointCount * indexCas:	the index of case points
+ * 	PointCount * indexCon:	the index of control points
+ * 	int nBlockX:		the number of index blocks along X dimension
+ * 	int nBlockY:		the number of index blocks along Y dimension
+ * 	double distance:	the distance, which is also the size (side length) of each index block
+ * 	PointCount * &casC:	set to a new array of the numbers of case points of the same category within the distance
+ * 	PointCount * &conC:	set to a new array of the numbers of control points within the distance
+ * 	bool sortedX:		if true, points are sorted by X within each index block (see sortBlocksByX), and each row strip is only tested within the X window of the search
+ * RETURN: none
+ */
+void countInDistance_Categories(double * xCas, double * yCas, int * category, double * xCon, double * yCon, PointCount * indexCas, PointCount * indexCon, int nBlockX, int nBlockY, double distance, PointCount * &casC, PointCount * &conC, bool sortedX)
+{
+	PointCount countCas = indexCas[nBlockX * nBlockY];
 
+	if(NULL == (casC = (PointCount *)malloc(sizeof(PointCount) * (countCas + 1))) || NULL == (conC = (PointCount *)malloc(sizeof(PointCount) * (countCas + 1))))
+	{
+		printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+		exit(1);
+	}
+	double dis2 = distance * distance;
+
+	#pragma omp parallel for schedule(dynamic, 64)
+	for(int b = 0; b < nBlockX * nBlockY; b++)
+	{
+		int colID = b % nBlockX;
+		int rowID = b / nBlockX;
+		int colMin = (colID == 0) ? 0 : (colID - 1);
+		int colMax = (colID == nBlockX - 1) ? (nBlockX - 1) : (colID + 1);
+		int rowMin = (rowID == 0) ? 0 : (rowID - 1);
+		int rowMax = (rowID == nBlockY - 1) ? (nBlockY - 1) : (rowID + 1);
+		double x, y;
+		PointCount iP, stripEnd;
+		//with sortedX, the centers of a block come in increasing X, so the X window of each strip only moves forward
+		PointCount startCas[3], startCon[3];
+		for(int row = rowMin; row <= rowMax; row ++)
+		{
+			startCas[row - rowMin] = indexCas[row * nBlockX + colMin];
+			startCon[row - rowMin] = indexCon[row * nBlockX + colMin];
+		}
+		for(PointCount iC = indexCas[b]; iC < indexCas[b + 1]; iC++)
+		{
+			x = xCas[iC];
+			y = yCas[iC];
+			casC[iC] = 0;
+			conC[iC] = 0;
+			for(int row = rowMin; row <= rowMax; row ++)
+			{
+				stripEnd = indexCas[row * nBlockX + colMax + 1];
+				iP = indexCas[row * nBlockX + colMin];
+				if(sortedX)
+				{
+					while(startCas[row - rowMin] < stripEnd && beforeStripWindow(xCas[startCas[row - rowMin]], x, dis2))
+						startCas[row - rowMin] ++;
+					iP = startCas[row - rowMin];
+				}
+				for(; iP < stripEnd; iP ++)
+				{
+					if(sortedX && afterStripWindow(xCas[iP], x, dis2))
+						break;
+					if(category[iP] == category[iC] && dis2 >= ((xCas[iP] - x) * (xCas[iP] - x) + (yCas[iP] - y) * (yCas[iP] - y)))
+						casC[iC] ++;
 				}
 
+				stripEnd = indexCon[row * nBlockX + colMax + 1];
+				iP = indexCon[row * nBlockX + colMin];
+				if(sortedX)
+				{
+					while(startCon[row - rowMin] < stripEnd && beforeStripWindow(xCon[startCon[row - rowMin]], x, dis2))
+						startCon[row - rowMin] ++;
+					iP = startCon[row - rowMin];
+				}
+				for(; iP < stripEnd; iP ++)
+				{
+					if(sortedX && afterStripWindow(xCon[iP], x, dis2))
+						break;
+					if(dis2 >= ((xCon[iP] - x) * (xCon[iP] - x) + (yCon[iP] - y) * (yCon[iP] - y)))
+						conC[iC] ++;
+				}
 			}
 		}
 	}
+}
+
+/**
+ * NAME:	countInDistance_KD
+ * DESCRIPTION:	get the number (the total weight if the tree has weights) of points of a KD-tree within a distance of each type A point, used instead of countInDistance_Single (a tree of type A points) or countInDistance_Double (a tree of type B points) when points are highly concentrated
+ * PARAMETERS:
+ * 	double * xE:		type A points' X values 
+ * 	double * yE:		type A points' Y values 
+ * 	PointCount countE:	the number of type A points
+ * 	KDTree * tree:		the KD-tree of the points to count
+ * 	double distance:	the distance
+ * 	PointCount * limit:	if not NULL, counting for each point stops once its count reaches its limit (the count needed to be a core point)
+ * RETURN:
+ * 	TYPE:	PointCount * 
+ * 	VALUE:	an array of the numbers of points within the distance (at most the limit), ordered the same as xE and yE
+ */
+PointCount * countInDistance_KD(double * xE, double * yE, PointCount countE, KDTree * tree, double distance, PointCount * limit)
+{
+	PointCount * count;
+	
+	if(NULL == (count = (PointCount *)malloc(sizeof(PointCount) * (countE + 1))))
+	{
+		printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+		exit(1);
+	}
+
+	#pragma omp parallel for schedule(dynamic, 256)
+	for(PointCount i = 0; i < countE; i++)
+	{
+		count[i] = rangeCountKD(tree, xE[i], yE[i], distance, (NULL == limit) ? POINT_COUNT_MAX : limit[i]);
+	}
+	return count;
+}
+
+/**
+ * NAME:	countInDistance_Lattice
+ * DESCRIPTION:	count the points of a lattice within a distance of each type A point. The cells entirely within the distance take one summed-area table lookup per lattice row, so only the points in the ring of cells crossed by the circle are tested
+ * PARAMETERS:
+ * 	double * xE:		type A points' X values 
+ * 	double * yE:		type A points' Y values 
+ * 	PointCount countE:	the number of type A points
+ * 	Lattice * lattice:	the lattice of the points to count
+ * 	double distance:	the distance
+ * RETURN:
+ * 	TYPE:	PointCount * 
+ * 	VALUE:	an array of the numbers of points within the distance, ordered the same as xE and yE
+ */
+PointCount * countInDistance_Lattice(double * xE, double * yE, PointCount countE, Lattice * lattice, double distance)
+{
+	PointCount * count;
+	
+	if(NULL == (count = (PointCount *)malloc(sizeof(PointCount) * (countE + 1))))
+	{
+		printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+		exit(1);
+	}
+
+	#pragma omp parallel for schedule(dynamic, 256)
+	for(PointCount i = 0; i < countE; i++)
+		count[i] = latticeCount(lattice, xE[i], yE[i], distance);
 	return count;
 }
 
+/**
+ * NAME:	countInDistance_Smooth
+ * DESCRIPTION:	estimate the number of points within a distance of each type A point from a smoothed density of the points, used instead of counting them where they are sparse and noisy. Each estimate is one raster lookup, whatever the number of points
+ * PARAMETERS:
+ * 	double * xE:		type A points' X values 
+ * 	double * yE:		type A points' Y values 
+ * 	PointCount countE:	the number of type A points
+ * 	Raster * raster:	the smoothed density of the points to count
+ * 	double distance:	the distance
+ * RETURN:
+ * 	TYPE:	double * 
+ * 	VALUE:	an array of the expected numbers of points within the distance (the density times the area of the circle), ordered the same as xE and yE
+ */
+double * countInDistance_Smooth(double * xE, double * yE, PointCount countE, Raster * raster, double distance)
+{
+	double * count;
+	
+	if(NULL == (count = (double *)malloc(sizeof(double) * (countE + 1))))
+	{
+		printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+		exit(1);
+	}
+
+	double area = M_PI * distance * distance;
+	#pragma omp parallel for schedule(static)
+	for(PointCount i = 0; i < countE; i++)
+	{
+		count[i] = rasterDensity(raster, xE[i], yE[i]) * area;
+	}
+	return count;
+}
@@ -1,7 +1,15 @@
 #ifndef CPH
 #define CPH
 
-int * countInDistance_Single(double * xE, double * yE, int * indexE, int nBlockX, int nBlockY, double distance);
-int * countInDistance_Double(double * xE, double * yE, double * xB, double * yB, int * indexE, int * indexB, int nBlockX, int nBlockY, double distance);
+#include "kdtree.h"
+#include "lattice.h"
+#include "geo.h"
+
+PointCount * countInDistance_Single(double * xE, double * yE, PointCount * indexE, int nBlockX, int nBlockY, double distance, PointCount * limit = NULL, PointCount * weight = NULL, const Geo * geo = NULL, bool sortedX = false);
+PointCount * countInDistance_Double(double * xE, double * yE, double * xB, double * yB, PointCount * indexE, PointCount * indexB, int nBlockX, int nBlockY, double distance, PointCount * weightB = NULL, const Geo * geo = NULL, bool sortedX = false);
+void countInDistance_Categories(double * xCas, double * yCas, int * category, double * xCon, double * yCon, PointCount * indexCas, PointCount * indexCon, int nBlockX, int nBlockY, double distance, PointCount * &casC, PointCount * &conC, bool sortedX = false);
+PointCount * countInDistance_KD(double * xE, double * yE, PointCount countE, KDTree * tree, double distance, PointCount * limit = NULL);
+PointCount * countInDistance_Lattice(double * xE, double * yE, PointCount countE, Lattice * lattice, double distance);
+double * countInDistance_Smooth(double * xE, double * yE, PointCount countE, Raster * raster, double distance);
 
 #endif
@@ -0,0 +1,522 @@
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <limits.h>
+#include "io.h"
+#include "countPoints.h"
+#include "clusters.h"
+
+//the points of one input set, read from two float64 buffers
+struct PointSet {
+	Py_buffer xView, yView;
+	PointCount count;
+	double * x;		//copies of the buffers, re-ordered by indexPoints
+	double * y;
+	PointCount * index;
+	PointCount * order;	//the position in the buffers of each indexed point
+};
+
+/**
+ * NAME:	getPoints
+ * DESCRIPTION:	get the X and Y buffers of a point set, which must be one dimensional, contiguous, float64 and of the same length
+ * PARAMETERS:
+ * 	PyObject * xObj:	an object supporting the buffer protocol, e.g. a NumPy array
+ * 	PyObject * yObj:	another one
+ * 	PointSet & set:		the point set, its views are set
+ * RETURN:
+ * 	TYPE:	bool
+ * 	VALUE:	false with a Python exception set if a buffer is not accepted, both views are then released
+ */
+static bool getPoints(PyObject * xObj, PyObject * yObj, PointSet & set)
+{
+	memset(&set, 0, sizeof(PointSet));
+	if(0 != PyObject_GetBuffer(xObj, &set.xView, PyBUF_C_CONTIGUOUS | PyBUF_FORMAT))
+		return false;
+	if(0 != PyObject_GetBuffer(yObj, &set.yView, PyBUF_C_CONTIGUOUS | PyBUF_FORMAT))
+	{
+		PyBuffer_Release(&set.xView);
+		return false;
+	}
+
+	const char * message = NULL;
+	for(int v = 0; v < 2 && NULL == message; v++)
+	{
+		Py_buffer * view = (v == 0) ? &set.xView : &set.yView;
+		const char * format = (NULL == view->format) ? "B" : view->format;
+		if(view->ndim != 1 || view->itemsize != sizeof(double) || !(0 == strcmp(format, "d") || 0 == strcmp(format, "<d") || 0 == strcmp(format, "=d") || 0 == strcmp(format, "@d")))
+			message = "coordinates must be one dimensional float64 arrays";
+	}
+	if(NULL == message && set.xView.len != set.yView.len)
+		message = "X and Y arrays must have the same length";
+	if(NULL == message && set.xView.len == 0)
+		message = "a point set is empty";
+	if(NULL == message && (unsigned long long)(set.xView.len / sizeof(double)) > (unsigned long long)POINT_COUNT_MAX)
+		message = "too many points for this build, rebuild with LARGE=1";
+	if(NULL != message)
+	{
+		PyErr_SetString(PyExc_ValueError, message);
+		PyBuffer_Release(&set.xView);
+		PyBuffer_Release(&set.yView);
+		return false;
+	}
+	set.count = set.xView.len / sizeof(double);
+	return true;
+}
+
+/**
+ * NAME:	releasePoints
+ * DESCRIPTION:	release the buffers and free the arrays of a point set
+ * PARAMETERS:
+ * 	PointSet & set:	the point set
+ * RETURN: none
+ */
+static void releasePoints(PointSet & set)
+{
+	PyBuffer_Release(&set.xView);
+	PyBuffer_Release(&set.yView);
+	free(set.x);
+	free(set.y);
+	free(set.index);
+	free(set.order);
+}
+
+/**
+ * NAME:	copyPoints
+ * DESCRIPTION:	copy the buffers of a point set into arrays that indexPoints can re-order, and extend the bounds of all points. Called without the GIL
+ * PARAMETERS:
+ * 	PointSet & set:		the point set
+ * 	double &xMin:		the minimum X of all points
+ * 	double &xMax:		the maximum X of all points
+ * 	double &yMin:		the minimum Y of all points
+ * 	double &yMax:		the maximum Y of all points
+ * RETURN:
+ * 	TYPE:	bool
+ * 	VALUE:	false if any coordinate is not finite, which would fall outside every index block
+ */
+static bool copyPoints(PointSet & set, double &xMin, double &xMax, double &yMin, double &yMax)
+{
+	if(NULL == (set.x = (double *)malloc(sizeof(double) * (set.count + 1))) || NULL == (set.y = (double *)malloc(sizeof(double) * (set.count + 1))))
+	{
+		printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+		exit(1);
+	}
+	memcpy(set.x, set.xView.buf, sizeof(double) * set.count);
+	memcpy(set.y, set.yView.buf, sizeof(double) * set.count);
+	bool finite = true;
+	for(PointCount i = 0; i < set.count; i++)
+	{
+		if(!isfinite(set.x[i]) || !isfinite(set.y[i]))
+			finite = false;
+		if(set.x[i] < xMin)
+			xMin = set.x[i];
+		if(set.x[i] > xMax)
+			xMax = set.x[i];
+		if(set.y[i] < yMin)
+			yMin = set.y[i];
+		if(set.y[i] > yMax)
+			yMax = set.y[i];
+	}
+	return finite;
+}
+
+/**
+ * NAME:	indexSet
+ * DESCRIPTION:	index a copied point set on a grid, keeping the position of each indexed point in the buffers. Called without the GIL
+ * PARAMETERS:
+ * 	PointSet & set:		the point set
+ * 	double xMin:		the minimum X of all points
+ * 	double yMin:		the minimum Y of all points
+ * 	int nBlockX:		the number of index blocks along X dimension
+ * 	int nBlockY:		the number of index blocks along Y dimension
+ * 	double radius:		the search radius, which is also the block size
+ * RETURN: none
+ */
+static void indexSet(PointSet & set, double xMin, double yMin, int nBlockX, int nBlockY, double radius)
+{
+	set.index = indexPoints(set.x, set.y, set.count, xMin, yMin, nBlockX, nBlockY, radius, &set.order);
+}
+
+/**
+ * NAME:	newArray
+ * DESCRIPTION:	create a writable memoryview of a new bytearray, which NumPy can wrap without copying (numpy.asarray)
+ * PARAMETERS:
+ * 	Py_ssize_t count:	the number of items
+ * 	const char * format:	the struct format of each item, "i" or "q"
+ * 	Py_ssize_t itemSize:	the size of each item
+ * 	void * &data:		set to the memory of the items
+ * RETURN:
+ * 	TYPE:	PyObject *
+ * 	VALUE:	the memoryview, NULL with a Python exception set on failure
+ */
+static PyObject * newArray(Py_ssize_t count, const char * format, Py_ssize_t itemSize, void * &data)
+{
+	PyObject * bytes = PyByteArray_FromStringAndSize(NULL, count * itemSize);
+	if(NULL == bytes)
+		return NULL;
+	data = PyByteArray_AS_STRING(bytes);
+	PyObject * raw = PyMemoryView_FromObject(bytes);
+	Py_DECREF(bytes);
+	if(NULL == raw)
+		return NULL;
+	PyObject * view = PyObject_CallMethod(raw, "cast", "s", format);
+	Py_DECREF(raw);
+	return view;
+}
+
+/**
+ * NAME:	labelsInInputOrder
+ * DESCRIPTION:	create the array of cluster IDs of a point set in the order of its buffers
+ * PARAMETERS:
+ * 	int * clusterID:	the cluster ID of each indexed point
+ * 	PointSet & set:		the point set
+ * RETURN:
+ * 	TYPE:	PyObject *
+ * 	VALUE:	an int32 memoryview, NULL with a Python exception set on failure
+ */
+static PyObject * labelsInInputOrder(int * clusterID, PointSet & set)
+{
+	void * data;
+	PyObject * labels = newArray(set.count, "i", sizeof(int), data);
+	if(NULL == labels)
+		return NULL;
+	int * out = (int *)data;
+	for(PointCount i = 0; i < set.count; i++)
+		out[set.order[i]] = clusterID[i];
+	return labels;
+}
+
+/**
+ * NAME:	countsInInputOrder
+ * DESCRIPTION:	create the array of point counts of a point set in the order of its buffers
+ * PARAMETERS:
+ * 	PointCount * count:	the count of each indexed point
+ * 	PointSet & set:		the point set
+ * RETURN:
+ * 	TYPE:	PyObject *
+ * 	VALUE:	an int32 (int64 when built with LARGE=1) memoryview, NULL with a Python exception set on failure
+ */
+static PyObject * countsInInputOrder(PointCount * count, PointSet & set)
+{
+	void * data;
+	PyObject * counts = newArray(set.count, (sizeof(PointCount) == sizeof(int)) ? "i" : "q", sizeof(PointCount), data);
+	if(NULL == counts)
+		return NULL;
+	PointCount * out = (PointCount *)data;
+	for(PointCount i = 0; i < set.count; i++)
+		out[set.order[i]] = count[i];
+	return counts;
+}
+
+PyDoc_STRVAR(count_doc,
+"count(x, y, radius, x_other=None, y_other=None)\n\n"
+"Count the points within radius of each point (x, y), itself included, or the points (x_other, y_other) within radius of each point when given. Coordinates are float64 buffers (e.g. NumPy arrays), returns an int memoryview in the order of x and y.");
+
+/**
+ * NAME:	escib_count
+ * DESCRIPTION:	Python escib.count, see count_doc. Runs countInDistance_Single or countInDistance_Double without the GIL
+ * PARAMETERS:
+ * 	PyObject * self:	the module
+ * 	PyObject * args:	the positional arguments
+ * 	PyObject * kwargs:	the keyword arguments
+ * RETURN:
+ * 	TYPE:	PyObject *
+ * 	VALUE:	the counts, NULL with a Python exception set on failure
+ */
+static PyObject * escib_count(PyObject * self, PyObject * args, PyObject * kwargs)
+{
+	static const char * keywords[] = {"x", "y", "radius", "x_other", "y_other", NULL};
+	PyObject * xObj, * yObj, * xOtherObj = Py_None, * yOtherObj = Py_None;
+	double radius;
+	if(!PyArg_ParseTupleAndKeywords(args, kwargs, "OOd|OO", (char **)keywords, &xObj, &yObj, &radius, &xOtherObj, &yOtherObj))
+		return NULL;
+	if(!(radius > 0))
+	{
+		PyErr_SetString(PyExc_ValueError, "radius must be positive");
+		return NULL;
+	}
+	bool other = (Py_None != xOtherObj || Py_None != yOtherObj);
+
+	PointSet set, setOther;
+	if(!getPoints(xObj, yObj, set))
+		return NULL;
+	if(other && !getPoints(xOtherObj, yOtherObj, setOther))
+	{
+		releasePoints(set);
+		return NULL;
+	}
+
+	double xMin = INFINITY, yMin = INFINITY, xMax = -INFINITY, yMax = -INFINITY;
+	int nBlockX, nBlockY;
+	bool finite, gridOk;
+	PointCount * count = NULL;
+	Py_BEGIN_ALLOW_THREADS
+	finite = copyPoints(set, xMin, xMax, yMin, yMax);
+	if(other)
+		finite = copyPoints(setOther, xMin, xMax, yMin, yMax) && finite;
+	gridOk = finite && gridBlocks(xMin, xMax, yMin, yMax, radius, nBlockX, nBlockY);
+	if(gridOk)
+	{
+		indexSet(set, xMin, yMin, nBlockX, nBlockY, radius);
+		if(other)
+		{
+			indexSet(setOther, xMin, yMin, nBlockX, nBlockY, radius);
+			count = countInDistance_Double(set.x, set.y, setOther.x, setOther.y, set.index, setOther.index, nBlockX, nBlockY, radius);
+		}
+		else
+			count = countInDistance_Single(set.x, set.y, set.index, nBlockX, nBlockY, radius);
+	}
+	Py_END_ALLOW_THREADS
+
+	PyObject * result = NULL;
+	if(gridOk)
+		result = countsInInputOrder(count, set);
+	else
+		PyErr_SetString(PyExc_ValueError, finite ? "the radius is too small for the extent of the coordinates" : "coordinates must be finite");
+	free(count);
+	releasePoints(set);
+	if(other)
+		releasePoints(setOther);
+	return result;
+}
+
+PyDoc_STRVAR(dbscan_doc,
+"dbscan(x, y, radius, min_pts, min_core=0, non_core=True)\n\n"
+"Cluster points with DBSCAN as the DBSCAN tool does. Returns the int32 cluster ID of each point (-1 for noise) as a memoryview in the order of x and y.");
+
+/**
+ * NAME:	escib_dbscan
+ * DESCRIPTION:	Python escib.dbscan, see dbscan_doc. Indexes, counts and clusters without the GIL
+ * PARAMETERS:
+ * 	PyObject * self:	the module
+ * 	PyObject * args:	the positional arguments
+ * 	PyObject * kwargs:	the keyword arguments
+ * RETURN:
+ * 	TYPE:	PyObject *
+ * 	VALUE:	the cluster IDs, NULL with a Python exception set on failure
+ */
+static PyObject * escib_dbscan(PyObject * self, PyObject * args, PyObject * kwargs)
+{
+	static const char * keywords[] = {"x", "y", "radius", "min_pts", "min_core", "non_core", NULL};
+	PyObject * xObj, * yObj;
+	double radius;
+	int minPts, minCore = 0, nonCorePoints = 1;
+	if(!PyArg_ParseTupleAndKeywords(args, kwargs, "OOdi|ip", (char **)keywords, &xObj, &yObj, &radius, &minPts, &minCore, &nonCorePoints))
+		return NULL;
+	if(!(radius > 0))
+	{
+		PyErr_SetString(PyExc_ValueError, "radius must be positive");
+		return NULL;
+	}
+
+	PointSet set;
+	if(!getPoints(xObj, yObj, set))
+		return NULL;
+
+	double xMin = INFINITY, yMin = INFINITY, xMax = -INFINITY, yMax = -INFINITY;
+	int nBlockX, nBlockY;
+	bool finite, gridOk;
+	int * clusters = NULL;
+	Py_BEGIN_ALLOW_THREADS
+	finite = copyPoints(set, xMin, xMax, yMin, yMax);
+	gridOk = finite && gridBlocks(xMin, xMax, yMin, yMax, radius, nBlockX, nBlockY);
+	if(gridOk)
+	{
+		indexSet(set, xMin, yMin, nBlockX, nBlockY, radius);
+		PointCount * countPoints = countInDistance_Single(set.x, set.y, set.index, nBlockX, nBlockY, radius);
+		clusters = doClusterDBSCAN(set.x, set.y, set.index, nBlockX, nBlockY, radius, minPts, xMin, yMin, countPoints, minCore, nonCorePoints);
+		free(countPoints);
+	}
+	Py_END_ALLOW_THREADS
+
+	PyObject * result = NULL;
+	if(gridOk)
+		result = labelsInInputOrder(clusters, set);
+	else
+		PyErr_SetString(PyExc_ValueError, finite ? "the radius is too small for the extent of the coordinates" : "coordinates must be finite");
+	free(clusters);
+	releasePoints(set);
+	return result;
+}
+
+PyDoc_STRVAR(poisson_doc,
+"poisson(x_background, y_background, x_events, y_events, radius, alpha, baseline_ratio=1.0, min_core=0, non_core=True)\n\n"
+"Cluster event points under the Poisson model as ESCIB_Poisson does. Returns the int32 cluster ID of each event (-1 outside clusters) as a memoryview in the order of x_events and y_events.");
+
+/**
+ * NAME:	escib_poisson
+ * DESCRIPTION:	Python escib.poisson, see poisson_doc. Indexes, counts and clusters without the GIL
+ * PARAMETERS:
+ * 	PyObject * self:	the module
+ * 	PyObject * args:	the positional arguments
+ * 	PyObject * kwargs:	the keyword arguments
+ * RETURN:
+ * 	TYPE:	PyObject *
+ * 	VALUE:	the cluster IDs, NULL with a Python exception set on failure
+ */
+static PyObject * escib_poisson(PyObject * self, PyObject * args, PyObject * kwargs)
+{
+	static const char * keywords[] = {"x_background", "y_background", "x_events", "y_events", "radius", "alpha", "baseline_ratio", "min_core", "non_core", NULL};
+	PyObject * xBObj, * yBObj, * xEObj, * yEObj;
+	double radius, significance, baseLineRatio = 1.0;
+	int minCore = 0, nonCorePoints = 1;
+	if(!PyArg_ParseTupleAndKeywords(args, kwargs, "OOOOdd|dip", (char **)keywords, &xBObj, &yBObj, &xEObj, &yEObj, &radius, &significance, &baseLineRatio, &minCore, &nonCorePoints))
+		return NULL;
+	if(!(radius > 0))
+	{
+		PyErr_SetString(PyExc_ValueError, "radius must be positive");
+		return NULL;
+	}
+
+	PointSet setB, setE;
+	if(!getPoints(xBObj, yBObj, setB))
+		return NULL;
+	if(!getPoints(xEObj, yEObj, setE))
+	{
+		releasePoints(setB);
+		return NULL;
+	}
+
+	double xMin = INFINITY, yMin = INFINITY, xMax = -INFINITY, yMax = -INFINITY;
+	int nBlockX, nBlockY;
+	bool finite, gridOk;
+	int * clusters = NULL;
+	Py_BEGIN_ALLOW_THREADS
+	finite = copyPoints(setB, xMin, xMax, yMin, yMax);
+	finite = copyPoints(setE, xMin, xMax, yMin, yMax) && finite;
+	gridOk = finite && gridBlocks(xMin, xMax, yMin, yMax, radius, nBlockX, nBlockY);
+	if(gridOk)
+	{
+		indexSet(setB, xMin, yMin, nBlockX, nBlockY, radius);
+		indexSet(setE, xMin, yMin, nBlockX, nBlockY, radius);
+		PointCount countB = setB.count;
+		PointCount countE = setE.count;
+		PointCount * countPointsB = countInDistance_Double(setE.x, setE.y, setB.x, setB.y, setE.index, setB.index, nBlockX, nBlockY, radius);
+		PointCount * countPointsE = countInDistance_Single(setE.x, setE.y, setE.index, nBlockX, nBlockY, radius);
+		double * lambda;
+		if(NULL == (lambda = (double *)malloc(sizeof(double) * (countE + 1))))
+		{
+			printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+			exit(1);
+		}
+		for(PointCount i = 0; i < countE; i++)
+			lambda[i] = (double)(countPointsB[i]) * countE * baseLineRatio / countB;
+		clusters = doClusterPoi(setE.x, setE.y, setE.index, nBlockX, nBlockY, radius, xMin, yMin, countPointsE, lambda, significance, minCore, nonCorePoints);
+		free(countPointsB);
+		free(countPointsE);
+		free(lambda);
+	}
+	Py_END_ALLOW_THREADS
+
+	PyObject * result = NULL;
+	if(gridOk)
+		result = labelsInInputOrder(clusters, setE);
+	else
+		PyErr_SetString(PyExc_ValueError, finite ? "the radius is too small for the extent of the coordinates" : "coordinates must be finite");
+	free(clusters);
+	releasePoints(setB);
+	releasePoints(setE);
+	return result;
+}
+
+PyDoc_STRVAR(bernoulli_doc,
+"bernoulli(x_cases, y_cases, x_controls, y_controls, radius, alpha, baseline_ratio=1.0, min_core=0, non_core=True)\n\n"
+"Cluster case points under the Bernoulli model as ESCIB_Bernoulli does. Returns a tuple of the int32 cluster IDs of the cases and of the controls (-1 outside clusters) as memoryviews in the order of their inputs.");
+
+/**
+ * NAME:	escib_bernoulli
+ * DESCRIPTION:	Python escib.bernoulli, see bernoulli_doc. Indexes, counts and clusters without the GIL
+ * PARAMETERS:
+ * 	PyObject * self:	the module
+ * 	PyObject * args:	the positional arguments
+ * 	PyObject * kwargs:	the keyword arguments
+ * RETURN:
+ * 	TYPE:	PyObject *
+ * 	VALUE:	the cluster IDs, NULL with a Python exception set on failure
+ */
+static PyObject * escib_bernoulli(PyObject * self, PyObject * args, PyObject * kwargs)
+{
+	static const char * keywords[] = {"x_cases", "y_cases", "x_controls", "y_controls", "radius", "alpha", "baseline_ratio", "min_core", "non_core", NULL};
+	PyObject * xCasObj, * yCasObj, * xConObj, * yConObj;
+	double radius, significance, baseLineRatio = 1.0;
+	int minCore = 0, nonCorePoints = 1;
+	if(!PyArg_ParseTupleAndKeywords(args, kwargs, "OOOOdd|dip", (char **)keywords, &xCasObj, &yCasObj, &xConObj, &yConObj, &radius, &significance, &baseLineRatio, &minCore, &nonCorePoints))
+		return NULL;
+	if(!(radius > 0))
+	{
+		PyErr_SetString(PyExc_ValueError, "radius must be positive");
+		return NULL;
+	}
+
+	PointSet setCas, setCon;
+	if(!getPoints(xCasObj, yCasObj, setCas))
+		return NULL;
+	if(!getPoints(xConObj, yConObj, setCon))
+	{
+		releasePoints(setCas);
+		return NULL;
+	}
+
+	double xMin = INFINITY, yMin = INFINITY, xMax = -INFINITY, yMax = -INFINITY;
+	int nBlockX, nBlockY;
+	bool finite, gridOk;
+	int * clusters = NULL;
+	Py_BEGIN_ALLOW_THREADS
+	finite = copyPoints(setCas, xMin, xMax, yMin, yMax);
+	finite = copyPoints(setCon, xMin, xMax, yMin, yMax) && finite;
+	gridOk = finite && gridBlocks(xMin, xMax, yMin, yMax, radius, nBlockX, nBlockY);
+	if(gridOk)
+	{
+		indexSet(setCas, xMin, yMin, nBlockX, nBlockY, radius);
+		indexSet(setCon, xMin, yMin, nBlockX, nBlockY, radius);
+		PointCount countCas = setCas.count;
+		PointCount countCon = setCon.count;
+		PointCount * countPointsCas = countInDistance_Single(setCas.x, setCas.y, setCas.index, nBlockX, nBlockY, radius);
+		PointCount * countPointsCon = countInDistance_Double(setCas.x, setCas.y, setCon.x, setCon.y, setCas.index, setCon.index, nBlockX, nBlockY, radius);
+		double p = baseLineRatio * countCas / (countCas + countCon);
+		clusters = doClusterBer(setCas.x, setCas.y, setCas.index, setCon.x, setCon.y, setCon.index, nBlockX, nBlockY, radius, xMin, yMin, countPointsCas, countPointsCon, p, significance, minCore, nonCorePoints);
+		free(countPointsCas);
+		free(countPointsCon);
+	}
+	Py_END_ALLOW_THREADS
+
+	PyObject * result = NULL;
+	if(gridOk)
+	{
+		PyObject * labelsCas = labelsInInputOrder(clusters, setCas);
+		PyObject * labelsCon = (NULL == labelsCas) ? NULL : labelsInInputOrder(clusters + setCas.count, setCon);
+		if(NULL != labelsCon)
+			result = PyTuple_Pack(2, labelsCas, labelsCon);
+		Py_XDECREF(labelsCas);
+		Py_XDECREF(labelsCon);
+	}
+	else
+		PyErr_SetString(PyExc_ValueError, finite ? "the radius is too small for the extent of the coordinates" : "coordinates must be finite");
+	free(clusters);
+	releasePoints(setCas);
+	releasePoints(setCon);
+	return result;
+}
+
+static PyMethodDef escibMethods[] = {
+	{"count", (PyCFunction)(void (*)(void))escib_count, METH_VARARGS | METH_KEYWORDS, count_doc},
+	{"dbscan", (PyCFunction)(void (*)(void))escib_dbscan, METH_VARARGS | METH_KEYWORDS, dbscan_doc},
+	{"poisson", (PyCFunction)(void (*)(void))escib_poisson, METH_VARARGS | METH_KEYWORDS, poisson_doc},
+	{"bernoulli", (PyCFunction)(void (*)(void))escib_bernoulli, METH_VARARGS | METH_KEYWORDS, bernoulli_doc},
+	{NULL, NULL, 0, NULL}
+};
+
+static struct PyModuleDef escibModule = {
+	PyModuleDef_HEAD_INIT,
+	"escib",
+	"ESCIB clustering on float64 buffers (e.g. NumPy arrays). Computations release the GIL, so jobs can run from several Python threads.",
+	-1,
+	escibMethods
+};
+
+PyMODINIT_FUNC PyInit_escib(void)
+{
+	return PyModule_Create(&escibModule);
+}
@@ -0,0 +1,102 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "geo.h"
+#include "clusters.h"
+
+/**
+ * NAME:	initGeo
+ * DESCRIPTION:	set up the geographic mode for a search radius and the latitudes of all points. Along X, the search radius spans the most longitude at the latitude farthest from the equator, so the scale of X values is chosen there
+ * PARAMETERS:
+ * 	Geo & geo:		the geographic mode
+ * 	double radius:		the search radius in meters
+ * 	double yMin:		the minimum latitude of all points
+ * 	double yMax:		the maximum latitude of all points
+ * RETURN: none
+ */
+void initGeo(Geo & geo, double radius, double yMin, double yMax)
+{
+	if(yMin < -90 || yMax > 90)
+	{
+		printf("ERROR: Latitudes must be between -90 and 90 degrees with -geo.\n");
+		exit(1);
+	}
+	geo.theta = radius / GEO_EARTH_RADIUS;
+	geo.blockSize = geo.theta / GEO_DEG;
+	double s = sin(geo.theta / 2);
+	geo.hav = s * s;
+
+	//the longitude difference of a point at the search radius from a center at latitude lat is at most asin(sin(theta) / cos(lat))
+	double maxLat = ((-yMin > yMax) ? -yMin : yMax) * GEO_DEG;
+	double sinLon = sin(geo.theta) / cos(maxLat);
+	if(geo.theta >= M_PI / 2 || sinLon >= 1)
+	{
+		printf("ERROR: The search radius reaches a pole, which -geo can't index.\n");
+		exit(1);
+	}
+	//slightly smaller, so that rounding never moves a point out of the blocks searched
+	geo.scale = geo.theta / asin(sinLon) * (1 - 1e-9);
+}
+
+/**
+ * NAME:	toGeoGrid
+ * DESCRIPTION:	turn longitudes into the X values used to index points in the geographic mode
+ * PARAMETERS:
+ * 	Geo & geo:		the geographic mode
+ * 	double * x:		points' longitudes, changed to their X values
+ * 	PointCount count:	the number of points
+ * 	double ** longitude:	if not NULL, set to a copy of the longitudes, which fromGeoGrid puts back
+ * RETURN: none
+ */
+void toGeoGrid(Geo & geo, double * x, PointCount count, double ** longitude)
+{
+	if(NULL != longitude)
+	{
+		if(NULL == (*longitude = (double *)malloc(sizeof(double) * (count + 1))))
+		{
+			printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+			exit(1);
+		}
+		memcpy(*longitude, x, sizeof(double) * count);
+	}
+	#pragma omp parallel for
+	for(PointCount i = 0; i < count; i++)
+		x[i] *= geo.scale;
+}
+
+/**
+ * NAME:	fromGeoGrid
+ * DESCRIPTION:	put the longitudes of points back in place of their X values before they are written. The saved longitudes are copied rather than the X values divided by the scale, so the output has the input longitudes exactly
+ * PARAMETERS:
+ * 	double * x:		points' X values, changed to their longitudes
+ * 	double * longitude:	the longitudes saved by toGeoGrid, in input order; freed here
+ * 	PointCount * order:	the input order of each point (see indexPoints), NULL if the points are still in input order
+ * 	PointCount count:	the number of points
+ * RETURN: none
+ */
+void fromGeoGrid(double * x, double * longitude, PointCount * order, PointCount count)
+{
+	#pragma omp parallel for
+	for(PointCount i = 0; i < count; i++)
+		x[i] = longitude[(NULL == order) ? i : order[i]];
+	free(longitude);
+}
+
+/**
+ * NAME:	fromGeoSummaries
+ * DESCRIPTION:	turn the X extents and centroids of cluster statistics back into longitudes
+ * PARAMETERS:
+ * 	Geo & geo:			the geographic mode
+ * 	ClusterSummaries & summaries:	the statistics of all clusters
+ * RETURN: none
+ */
+void fromGeoSummaries(Geo & geo, ClusterSummaries & summaries)
+{
+	for(int i = 0; i < summaries.count; i++)
+	{
+		summaries.items[i].xMin /= geo.scale;
+		summaries.items[i].xMax /= geo.scale;
+		summaries.items[i].sumX /= geo.scale;
+	}
+}
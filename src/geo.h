@@ -0,0 +1,77 @@
+#ifndef GEOH
+#define GEOH
+
+#include <math.h>
+#include "pointCount.h"
+
+//the mean radius of the earth in meters
+#define GEO_EARTH_RADIUS 6371008.8
+#define GEO_DEG (M_PI / 180)
+
+//the geographic mode (-geo): X values are longitudes and Y values latitudes in degrees, the search radius is in meters
+struct Geo {
+	double scale;		//while points are indexed, X values are longitudes times scale, so that the search radius spans at most one block along X
+	double blockSize;	//the search radius as a latitude difference (degrees), the size of each index block
+	double theta;		//the search radius as an angle (radians)
+	double hav;		//the haversine of theta
+};
+
+struct ClusterSummaries;
+
+void initGeo(Geo & geo, double radius, double yMin, double yMax);
+void toGeoGrid(Geo & geo, double * x, PointCount count, double ** longitude = NULL);
+void fromGeoGrid(double * x, double * longitude, PointCount * order, PointCount count);
+void fromGeoSummaries(Geo & geo, ClusterSummaries & summaries);
+
+/**
+ * NAME:	geoCos
+ * DESCRIPTION:	get the cosine of a latitude, computed once per search center for withinGeo
+ * PARAMETERS:
+ * 	double y:	the latitude (degrees)
+ * RETURN:
+ * 	TYPE:	double
+ * 	VALUE:	the cosine
+ */
+static inline double geoCos(double y)
+{
+	return cos(y * GEO_DEG);
+}
+
+/**
+ * NAME:	withinGeo
+ * DESCRIPTION:	test whether the great-circle distance between two points is within the search radius. The haversine of the distance, hav(dLat) + cos(lat1) cos(lat2) hav(dLon), is first bounded from both sides with x * x / 4 * (1 - x * x / 12) <= hav(x) <= x * x / 4 and |cos(lat2) - cos(lat1)| <= |dLat| (an equirectangular estimate with error bounds), so the exact haversine with its trigonometric calls is only needed for points very close to the search circle
+ * PARAMETERS:
+ * 	const Geo * geo:	the geographic mode
+ * 	double x1:		the X value of the search center, on the grid (see toGeoGrid)
+ * 	double y1:		the latitude of the search center
+ * 	double cos1:		the cosine of the latitude of the search center (see geoCos)
+ * 	double x2:		the X value of the other point, on the grid
+ * 	double y2:		the latitude of the other point
+ * RETURN:
+ * 	TYPE:	bool
+ * 	VALUE:	true if the distance is within the search radius
+ */
+static inline bool withinGeo(const Geo * geo, double x1, double y1, double cos1, double x2, double y2)
+{
+	double dLat = (y2 - y1) * GEO_DEG;
+	double dLat2 = dLat * dLat;
+	if(dLat2 > geo->theta * geo->theta)
+		return false;
+	double dLon = (x2 - x1) / geo->scale * GEO_DEG;
+	double dLon2 = dLon * dLon;
+	double absLat = fabs(dLat);
+
+	if(dLat2 / 4 + cos1 * (cos1 + absLat) * dLon2 / 4 <= geo->hav)
+		return true;
+	double cosLow = cos1 * (cos1 - absLat);
+	if(cosLow < 0)
+		cosLow = 0;
+	if(dLat2 / 4 * (1 - dLat2 / 12) + cosLow * dLon2 / 4 * (1 - dLon2 / 12) > geo->hav)
+		return false;
+
+	double sLat = sin(dLat / 2);
+	double sLon = sin(dLon / 2);
+	return sLat * sLat + cos1 * cos(y2 * GEO_DEG) * sLon * sLon <= geo->hav;
+}
+
+#endif
@@ -1,95 +1,810 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <limits.h>
+#include <math.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <zlib.h>
+#ifdef USE_ZSTD
+#include <zstd.h>
+#endif
+#include "io.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+//inputs smaller than this are indexed by a single thread
+#define PARALLEL_INDEX_MIN_COUNT 100000
+//the smallest piece of a file parsed by one thread
+#define PARALLEL_READ_MIN_CHUNK (1 << 20)
+//the size and number of blocks passed from the decompressing thread to the parsing thread
+#define STREAM_BLOCK_SIZE (1 << 22)
+#define STREAM_BLOCKS 4
+
+//formats of input files, or INPUT_MISSING for a file that can't be opened
+#define INPUT_MISSING -1
+#define INPUT_PLAIN 0
+#define INPUT_GZIP 1
+#define INPUT_ZSTD 2
+
+//blocks of (decompressed) text shared by the reading thread and the parsing thread
+struct InputStream {
+	FILE * file;
+	gzFile gz;
+	int format;
+
+	char * blocks[STREAM_BLOCKS];
+	size_t sizes[STREAM_BLOCKS];
+	int head;		//the next block to parse
+	int filled;		//the number of blocks read but not parsed
+	bool done;		//all blocks are read
+	const char * error;	//why the reading thread stopped before the end of the file, NULL if it didn't
+	pthread_mutex_t lock;
+	pthread_cond_t notEmpty;
+	pthread_cond_t notFull;
+};
+
+/**
+ * NAME:	parseChunk
+ * DESCRIPTION:	parse all lines "x,y" (or "x,y,category") in a piece of text which starts at the beginning of a line and ends after a newline (or at the end of the file); update the bounding box of the parsed points
+ * PARAMETERS:
+ * 	const char * begin:	the first character of the text
+ * 	const char * end:	the position after the last character of the text
+ * 	double * x:		the array to store points' X values, long enough for all lines
+ * 	double * y:		the array to store points' Y values, long enough for all lines
+ * 	int * category:		if not NULL, the array to store points' categories (the integer third column, -1 if there is none), long enough for all lines
+ * 	double &xMin:		the Mininum X of parsed points, can be updated in this function if necessary
+ * 	double &xMax:		the Maximum X of parsed points, can be updated in this function if necessary
+ * 	double &yMin:		the Minimum Y of parsed points, can be updated in this function if necessary
+ * 	double &yMax:		the Maximum Y of parsed points, can be updated in this function if necessary
+ * RETURN:
+ * 	TYPE:	PointCount
+ * 	VALUE:	the number of points parsed
+ */
+static PointCount parseChunk(const char * begin, const char * end, double * x, double * y, int * category, double &xMin, double &xMax, double &yMin, double &yMax)
+{
+	PointCount count = 0;
+	const char * p = begin;
+	const char * line;
+	const char * lineEnd;
+	char * e;
+	char tail[256];
+
+	while(p < end)
+	{
+		//skip blank lines and spaces so that strtod never reads past this piece
+		while(p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n'))
+			p ++;
+		if(p == end)
+			break;
+		line = p;
+		if(NULL == (lineEnd = (const char *)memchr(p, '\n', end - p)))
+		{
+			//the last line of a file without a newline is not followed by a terminating character
+			size_t n = end - p;
+			if(n >= sizeof(tail))
+				n = sizeof(tail) - 1;
+			memcpy(tail, p, n);
+			tail[n] = '\0';
+			line = tail;
+			lineEnd = end - 1;
+		}
+
+		x[count] = strtod(line, &e);
+		if(e != line && *e == ',')
+		{
+			line = e + 1;
+			y[count] = strtod(line, &e);
+			if(e != line)
+			{
+				if(NULL != category)
+				{
+					category[count] = -1;
+					if(*e == ',')
+					{
+						line = e + 1;
+						errno = 0;
+						long c = strtol(line, &e, 10);
+						//a value that doesn't fit in an int is stored as -1, so it is rejected like any other invalid category
+						if(e != line && errno != ERANGE && c >= INT_MIN && c <= INT_MAX)
+							category[count] = (int)c;
+					}
+				}
+				if(x[count] < xMin)
+					xMin = x[count];
+				if(x[count] > xMax)
+					xMax = x[count];
+				if(y[count] < yMin)
+					yMin = y[count];
+				if(y[count] > yMax)
+					yMax = y[count];
+				count ++;
+			}
+		}
+		p = lineEnd + 1;
+	}
+	return count;
+}
 
 /**
- * NAME:	getCount
- * DESCRIPTION:	get the number of points in a input file; update the bounding box of all points accordingly
+ * NAME:	inputFormat
+ * DESCRIPTION:	detect the format of an input file from its first bytes
  * PARAMETERS:
- * 	FILE * file: the input file 
- * 	double &xMin: the Mininum X of all points, can be updated in this function if necessary
- * 	double &xMax: the Maximum X of all points, can be updated in this function if necessary
- * 	double &yMin: the Minimum Y of all points, can be updated in this function if necessary
- * 	double &xMin: the Maxinum Y of all points, can be updated in this function if necessary
+ * 	const char * fileName: the input file name
  * RETURN:
  * 	TYPE:	int
+ * 	VALUE:	INPUT_GZIP, INPUT_ZSTD, INPUT_PLAIN, or INPUT_MISSING if the file can't be opened
+ */
+static int inputFormat(const char * fileName)
+{
+	FILE * file;
+	unsigned char magic[4] = {0, 0, 0, 0};
+	if(NULL == (file = fopen(fileName, "rb")))
+		return INPUT_MISSING;
+	size_t n = fread(magic, 1, 4, file);
+	fclose(file);
+
+	if(n >= 2 && magic[0] == 0x1f && magic[1] == 0x8b)
+		return INPUT_GZIP;
+	if(n == 4 && magic[0] == 0x28 && magic[1] == 0xb5 && magic[2] == 0x2f && magic[3] == 0xfd)
+		return INPUT_ZSTD;
+	return INPUT_PLAIN;
+}
+
+/**
+ * NAME:	readBlocks
+ * DESCRIPTION:	the reading thread of an InputStream: read and decompress the input file block by block, waiting whenever all blocks are waiting to be parsed. A file that can't be decompressed ends the stream early with the reason in the InputStream
+ * PARAMETERS:
+ * 	void * arg: the InputStream
+ * RETURN:
+ * 	TYPE:	void *
+ * 	VALUE:	NULL
+ */
+static void * readBlocks(void * arg)
+{
+	InputStream * in = (InputStream *)arg;
+	int tail = 0;
+	bool end = false;
+
+#ifdef USE_ZSTD
+	ZSTD_DStream * zs = NULL;
+	char * zIn = NULL;
+	ZSTD_inBuffer zInBuf = {NULL, 0, 0};
+	//the last return value of ZSTD_decompressStream that made progress, 0 once a frame is complete
+	size_t zLast = 1;
+	bool zEof = false;
+	if(in->format == INPUT_ZSTD)
+	{
+		if(NULL == (zs = ZSTD_createDStream()) || NULL == (zIn = (char *)malloc(ZSTD_DStreamInSize())))
+		{
+			printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+			exit(1);
+		}
+		ZSTD_initDStream(zs);
+		zInBuf.src = zIn;
+	}
+#endif
+
+	while(!end)
+	{
+		pthread_mutex_lock(&in->lock);
+		while(in->filled == STREAM_BLOCKS)
+			pthread_cond_wait(&in->notFull, &in->lock);
+		pthread_mutex_unlock(&in->lock);
+
+		//the block at tail is not used by the parsing thread until it is counted in filled
+		char * block = in->blocks[tail];
+		size_t size = 0;
+		if(in->format == INPUT_PLAIN)
+		{
+			size = fread(block, 1, STREAM_BLOCK_SIZE, in->file);
+			if(size < STREAM_BLOCK_SIZE)
+				end = true;
+		}
+		else if(in->format == INPUT_GZIP)
+		{
+			int n = gzread(in->gz, block, STREAM_BLOCK_SIZE);
+			int status = Z_OK;
+			//a truncated file only shows in the error state once gzread returns short
+			if(n < STREAM_BLOCK_SIZE)
+				gzerror(in->gz, &status);
+			if(n < 0 || (status != Z_OK && status != Z_STREAM_END))
+			{
+				in->error = "Can't decompress the input file.";
+				if(n < 0)
+					n = 0;
+			}
+			size = n;
+			if(size < STREAM_BLOCK_SIZE)
+				end = true;
+		}
+#ifdef USE_ZSTD
+		else
+		{
+			ZSTD_outBuffer zOutBuf = {block, STREAM_BLOCK_SIZE, 0};
+			while(zOutBuf.pos < zOutBuf.size)
+			{
+				if(zInBuf.pos == zInBuf.size && !zEof)
+				{
+					zInBuf.size = fread(zIn, 1, ZSTD_DStreamInSize(), in->file);
+					zInBuf.pos = 0;
+					if(zInBuf.size == 0)
+						zEof = true;
+				}
+				//at the end of the file the decoder is called with no input until it has flushed everything it holds
+				size_t outPos = zOutBuf.pos, inPos = zInBuf.pos;
+				size_t ret = ZSTD_decompressStream(zs, &zOutBuf, &zInBuf);
+				if(ZSTD_isError(ret))
+				{
+					in->error = "Can't decompress the input file.";
+					end = true;
+					break;
+				}
+				if(zOutBuf.pos != outPos || zInBuf.pos != inPos)
+					zLast = ret;
+				else if(zEof)
+				{
+					//a nonzero return means the last frame is incomplete
+					if(zLast != 0)
+						in->error = "The zstd input file is truncated.";
+					end = true;
+					break;
+				}
+			}
+			size = zOutBuf.pos;
+		}
+#endif
+		//so that strtod stops at the end of the block
+		block[size] = '\0';
+		in->sizes[tail] = size;
+		tail = (tail + 1) % STREAM_BLOCKS;
+
+		pthread_mutex_lock(&in->lock);
+		in->filled ++;
+		in->done = end;
+		pthread_cond_signal(&in->notEmpty);
+		pthread_mutex_unlock(&in->lock);
+	}
+
+#ifdef USE_ZSTD
+	if(NULL != zs)
+	{
+		ZSTD_freeDStream(zs);
+		free(zIn);
+	}
+#endif
+	return NULL;
+}
+
+/**
+ * NAME:	readFailed
+ * DESCRIPTION:	report an input file that can't be read: exit with the error unless the caller takes it
+ * PARAMETERS:
+ * 	const char * message:	the error
+ * 	const char ** error:	if not NULL, set to the error instead of exiting
+ * RETURN: none
+ */
+static void readFailed(const char * message, const char ** error)
+{
+	if(NULL == error)
+	{
+		printf("ERROR: %s\n", message);
+		exit(1);
+	}
+	*error = message;
+}
+
+/**
+ * NAME:	reservePoints
+ * DESCRIPTION:	make sure the arrays of points growing during reading can store more points
+ * PARAMETERS:
+ * 	double * &x:		the array of points' X values, can be reallocated
+ * 	double * &y:		the array of points' Y values, can be reallocated
+ * 	size_t &capacity:	the length of x and y, updated if they are reallocated
+ * 	size_t needed:		the length needed
+ * 	int ** category:	if not NULL, the array of points' categories, reallocated along with x and y
+ * RETURN: none
+ */
+static void reservePoints(double * &x, double * &y, size_t &capacity, size_t needed, int ** category)
+{
+	if(needed <= capacity)
+		return;
+	while(capacity < needed)
+		capacity = (capacity < 1024) ? 1024 : capacity * 2;
+	if(NULL == (x = (double *)realloc(x, sizeof(double) * capacity)) || NULL == (y = (double *)realloc(y, sizeof(double) * capacity)))
+	{
+		printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+		exit(1);
+	}
+	if(NULL != category && NULL == (*category = (int *)realloc(*category, sizeof(int) * capacity)))
+	{
+		printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+		exit(1);
+	}
+}
+
+/**
+ * NAME:	readPointsStream
+ * DESCRIPTION:	read all points (X, Y) in a plain, gzip or zstd (if built with ZSTD=1) compressed file in a single pass. A separate thread reads and decompresses blocks of text while this thread parses them, so the input is never rewound
+ * PARAMETERS:
+ * 	const char * fileName:	the input file name
+ * 	double * &x:		set to a new array of points' X values
+ * 	double * &y:		set to a new array of points' Y values
+ * 	double &xMin:		the Mininum X of all points, can be updated in this function if necessary
+ * 	double &xMax:		the Maximum X of all points, can be updated in this function if necessary
+ * 	double &yMin:		the Minimum Y of all points, can be updated in this function if necessary
+ * 	double &yMax:		the Maximum Y of all points, can be updated in this function if necessary
+ * 	int ** category:	if not NULL, set to a new array of points' categories, read from a third column (-1 for lines without one)
+ * 	const char ** error:	if not NULL, set to why the file can't be read (and NULL if it can) instead of exiting; no points are returned then
+ * RETURN:
+ * 	TYPE:	PointCount
  * 	VALUE:	the number of points in the file
  */
-int getCount(FILE * file, double &xMin, double &xMax, double &yMin, double &yMax)
+PointCount readPointsStream(const char * fileName, double * &x, double * &y, double &xMin, double &xMax, double &yMin, double &yMax, int ** category, const char ** error)
 {
-	int count = 0;
-	double x, y;
-	rewind(file);
-	
-	while(fscanf(file, "%lf,%lf\n", &x, &y) != EOF) {
-		count ++;
-		if(x < xMin)
-			xMin = x;
-		if(x > xMax)
-			xMax = x;
-		if(y < yMin)
-			yMin = y;
-		if(y > yMax)
-			yMax = y;
+	InputStream in;
+	in.format = inputFormat(fileName);
+	in.file = NULL;
+	in.gz = NULL;
+	x = NULL;
+	y = NULL;
+	if(NULL != category)
+		*category = NULL;
+	if(NULL != error)
+		*error = NULL;
+	if(in.format == INPUT_MISSING)
+	{
+		readFailed("Can't open the input file.", error);
+		return 0;
+	}
+#ifndef USE_ZSTD
+	if(in.format == INPUT_ZSTD)
+	{
+		readFailed("zstd input is not supported (rebuild with ZSTD=1).", error);
+		return 0;
+	}
+#endif
+	if(in.format == INPUT_GZIP)
+	{
+		if(NULL == (in.gz = gzopen(fileName, "rb")))
+		{
+			readFailed("Can't open the input file.", error);
+			return 0;
+		}
+		gzbuffer(in.gz, 1 << 18);
+	}
+	else if(NULL == (in.file = fopen(fileName, "rb")))
+	{
+		readFailed("Can't open the input file.", error);
+		return 0;
+	}
+
+	for(int i = 0; i < STREAM_BLOCKS; i++)
+	{
+		if(NULL == (in.blocks[i] = (char *)malloc(STREAM_BLOCK_SIZE + 1)))
+		{
+			printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+			exit(1);
+		}
+	}
+	in.head = 0;
+	in.filled = 0;
+	in.done = false;
+	in.error = NULL;
+	pthread_mutex_init(&in.lock, NULL);
+	pthread_cond_init(&in.notEmpty, NULL);
+	pthread_cond_init(&in.notFull, NULL);
+
+	pthread_t reader;
+	if(0 != pthread_create(&reader, NULL, readBlocks, &in))
+	{
+		printf("ERROR: Can't start the reading thread.\n");
+		exit(1);
+	}
+
+	size_t capacity = 0;
+	PointCount count = 0;
+
+	//the unfinished line at the end of the last block, kept with room for a newline
+	char * carry;
+	size_t carrySize = 0;
+	size_t carryCapacity = 1024;
+	if(NULL == (carry = (char *)malloc(carryCapacity)))
+	{
+		printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+		exit(1);
+	}
+
+	bool end = false;
+	while(!end)
+	{
+		pthread_mutex_lock(&in.lock);
+		while(in.filled == 0)
+			pthread_cond_wait(&in.notEmpty, &in.lock);
+		end = in.done && in.filled == 1;
+		pthread_mutex_unlock(&in.lock);
+
+		const char * block = in.blocks[in.head];
+		const char * blockEnd = block + in.sizes[in.head];
+		const char * first = NULL;
+		const char * last = NULL;
+		size_t lines = 0;
+		for(const char * p = block; p < blockEnd && NULL != (p = (const char *)memchr(p, '\n', blockEnd - p)); p++)
+		{
+			if(NULL == first)
+				first = p;
+			last = p;
+			lines ++;
+		}
+		reservePoints(x, y, capacity, count + lines + 1, category);
+
+		//the line started in earlier blocks is finished at the first newline of this one
+		size_t head = (NULL == first) ? (blockEnd - block) : (first - block + 1);
+		size_t tail = (NULL == first) ? 0 : (blockEnd - last - 1);
+		size_t needed = ((carrySize + head > tail) ? (carrySize + head) : tail) + 1;
+		if(needed > carryCapacity)
+		{
+			carryCapacity = needed * 2;
+			if(NULL == (carry = (char *)realloc(carry, carryCapacity)))
+			{
+				printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+				exit(1);
+			}
+		}
+		memcpy(carry + carrySize, block, head);
+		carrySize += head;
+		carry[carrySize] = '\0';
+		if(NULL != first)
+		{
+			count += parseChunk(carry, carry + carrySize, x + count, y + count, (NULL != category) ? *category + count : NULL, xMin, xMax, yMin, yMax);
+			count += parseChunk(first + 1, last + 1, x + count, y + count, (NULL != category) ? *category + count : NULL, xMin, xMax, yMin, yMax);
+			memcpy(carry, last + 1, tail);
+			carrySize = tail;
+		}
+
+		pthread_mutex_lock(&in.lock);
+		in.head = (in.head + 1) % STREAM_BLOCKS;
+		in.filled --;
+		pthread_cond_signal(&in.notFull);
+		pthread_mutex_unlock(&in.lock);
+	}
+
+	//the last line of a file without a newline
+	if(carrySize > 0)
+	{
+		reservePoints(x, y, capacity, count + 1, category);
+		count += parseChunk(carry, carry + carrySize, x + count, y + count, (NULL != category) ? *category + count : NULL, xMin, xMax, yMin, yMax);
+	}
+
+	pthread_join(reader, NULL);
+	pthread_mutex_destroy(&in.lock);
+	pthread_cond_destroy(&in.notEmpty);
+	pthread_cond_destroy(&in.notFull);
+	for(int i = 0; i < STREAM_BLOCKS; i++)
+		free(in.blocks[i]);
+	free(carry);
+	if(NULL != in.gz)
+		gzclose(in.gz);
+	if(NULL != in.file)
+		fclose(in.file);
+	if(NULL != in.error)
+	{
+		free(x);
+		free(y);
+		x = NULL;
+		y = NULL;
+		if(NULL != category)
+		{
+			free(*category);
+			*category = NULL;
+		}
+		readFailed(in.error, error);
+		return 0;
+	}
+
+	//give back the unused capacity
+	if(NULL == (x = (double *)realloc(x, sizeof(double) * (count + 1))) || NULL == (y = (double *)realloc(y, sizeof(double) * (count + 1))))
+	{
+		printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+		exit(1);
+	}
+	if(NULL != category && NULL == (*category = (int *)realloc(*category, sizeof(int) * (count + 1))))
+	{
+		printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+		exit(1);
 	}
 
 	return count;
-	
 }
 
 /**
- * NAME:	readPoints
- * DESCRIPTION:	read all points (X, Y) in a file
+ * NAME:	readPointsParallel
+ * DESCRIPTION:	read all points (X, Y) in a file with multiple threads. The file is mapped into memory and split into chunks at newline boundaries; chunks are parsed concurrently into their own buffers with their own bounding boxes and then concatenated in order, giving the same arrays as readPointsStream
+ * PARAMETERS:
+ * 	const char * fileName:	the input file name
+ * 	double * &x:		set to a new array of points' X values
+ * 	double * &y:		set to a new array of points' Y values
+ * 	double &xMin:		the Mininum X of all points, can be updated in this function if necessary
+ * 	double &xMax:		the Maximum X of all points, can be updated in this function if necessary
+ * 	double &yMin:		the Minimum Y of all points, can be updated in this function if necessary
+ * 	double &yMax:		the Maximum Y of all points, can be updated in this function if necessary
+ * 	const char ** error:	if not NULL, set to why the file can't be read (and NULL if it can) instead of exiting; no points are returned then
+ * RETURN:
+ * 	TYPE:	PointCount
+ * 	VALUE:	the number of points in the file
+ */
+PointCount readPointsParallel(const char * fileName, double * &x, double * &y, double &xMin, double &xMax, double &yMin, double &yMax, const char ** error)
+{
+	int fd;
+	struct stat st;
+	x = NULL;
+	y = NULL;
+	if(NULL != error)
+		*error = NULL;
+	if(-1 == (fd = open(fileName, O_RDONLY)) || -1 == fstat(fd, &st))
+	{
+		if(-1 != fd)
+			close(fd);
+		readFailed("Can't open the input file.", error);
+		return 0;
+	}
+	size_t size = st.st_size;
+	const char * text = NULL;
+	if(size > 0 && MAP_FAILED == (text = (const char *)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0)))
+	{
+		close(fd);
+		readFailed("Can't map the input file.", error);
+		return 0;
+	}
+	if(size > 0)
+		madvise((void *)text, size, MADV_SEQUENTIAL);
+
+	int nThreads = 1;
+#ifdef _OPENMP
+	nThreads = omp_get_max_threads();
+#endif
+	size_t chunkSize = size / ((size_t)nThreads * 4) + 1;
+	if(chunkSize < PARALLEL_READ_MIN_CHUNK)
+		chunkSize = PARALLEL_READ_MIN_CHUNK;
+	int nChunks = (int)((size + chunkSize - 1) / chunkSize);
+
+	//move the end of each chunk after the next newline
+	size_t * bounds;
+	if(NULL == (bounds = (size_t *)malloc(sizeof(size_t) * (nChunks + 1))))
+	{
+		printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+		exit(1);
+	}
+	bounds[0] = 0;
+	for(int c = 1; c < nChunks; c++)
+	{
+		size_t b = c * chunkSize;
+		if(b < bounds[c - 1])
+			b = bounds[c - 1];
+		const char * nl = (b < size) ? (const char *)memchr(text + b, '\n', size - b) : NULL;
+		bounds[c] = (NULL == nl) ? size : (nl - text + 1);
+	}
+	bounds[nChunks] = size;
+
+	double ** xC;
+	double ** yC;
+	PointCount * countC;
+	double * boxC;
+	if(NULL == (xC = (double **)malloc(sizeof(double *) * nChunks)) || NULL == (yC = (double **)malloc(sizeof(double *) * nChunks)) || NULL == (countC = (PointCount *)malloc(sizeof(PointCount) * (nChunks + 1))) || NULL == (boxC = (double *)malloc(sizeof(double) * 4 * nChunks)))
+	{
+		printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+		exit(1);
+	}
+
+	#pragma omp parallel for schedule(dynamic, 1)
+	for(int c = 0; c < nChunks; c++)
+	{
+		const char * begin = text + bounds[c];
+		const char * end = text + bounds[c + 1];
+		//every point is on its own line
+		size_t lines = 1;
+		for(const char * p = begin; NULL != (p = (const char *)memchr(p, '\n', end - p)); p++)
+			lines ++;
+		if(NULL == (xC[c] = (double *)malloc(sizeof(double) * lines)) || NULL == (yC[c] = (double *)malloc(sizeof(double) * lines)))
+		{
+			printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+			exit(1);
+		}
+		boxC[4 * c] = xMin;
+		boxC[4 * c + 1] = xMax;
+		boxC[4 * c + 2] = yMin;
+		boxC[4 * c + 3] = yMax;
+		countC[c] = parseChunk(begin, end, xC[c], yC[c], NULL, boxC[4 * c], boxC[4 * c + 1], boxC[4 * c + 2], boxC[4 * c + 3]);
+	}
+
+	//concatenate chunks in order
+	PointCount count = 0;
+	PointCount n;
+	for(int c = 0; c < nChunks; c++)
+	{
+		n = countC[c];
+		countC[c] = count;
+		count += n;
+		if(boxC[4 * c] < xMin)
+			xMin = boxC[4 * c];
+		if(boxC[4 * c + 1] > xMax)
+			xMax = boxC[4 * c + 1];
+		if(boxC[4 * c + 2] < yMin)
+			yMin = boxC[4 * c + 2];
+		if(boxC[4 * c + 3] > yMax)
+			yMax = boxC[4 * c + 3];
+	}
+	countC[nChunks] = count;
+
+	if(NULL == (x = (double *)malloc(sizeof(double) * count)))
+	{
+		printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+		exit(1);
+	}
+	if(NULL == (y = (double *)malloc(sizeof(double) * count)))
+	{
+		printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+		exit(1);
+	}
+
+	#pragma omp parallel for schedule(dynamic, 1)
+	for(int c = 0; c < nChunks; c++)
+	{
+		memcpy(x + countC[c], xC[c], sizeof(double) * (countC[c + 1] - countC[c]));
+		memcpy(y + countC[c], yC[c], sizeof(double) * (countC[c + 1] - countC[c]));
+		free(xC[c]);
+		free(yC[c]);
+	}
+
+	free(xC);
+	free(yC);
+	free(countC);
+	free(boxC);
+	free(bounds);
+	if(size > 0)
+		munmap((void *)text, size);
+	close(fd);
+
+	return count;
+}
+
+/**
+ * NAME:	loadPoints
+ * DESCRIPTION:	read all points (X, Y) in a plain or compressed file into new arrays and update the bounding box of all points accordingly
+ * PARAMETERS:
+ * 	const char * fileName:	the input file name
+ * 	double * &x:		set to a new array of points' X values
+ * 	double * &y:		set to a new array of points' Y values
+ * 	double &xMin:		the Mininum X of all points, can be updated in this function if necessary
+ * 	double &xMax:		the Maximum X of all points, can be updated in this function if necessary
+ * 	double &yMin:		the Minimum Y of all points, can be updated in this function if necessary
+ * 	double &yMax:		the Maximum Y of all points, can be updated in this function if necessary
+ * 	bool parallel:		whether to parse a plain file with multiple threads (readPointsParallel), otherwise it is read by readPointsStream
+ * 	const char ** error:	if not NULL, set to why the file can't be read (and NULL if it can) instead of exiting; no points are returned then
+ * RETURN:
+ * 	TYPE:	PointCount
+ * 	VALUE:	the number of points in the file
+ */
+PointCount loadPoints(const char * fileName, double * &x, double * &y, double &xMin, double &xMax, double &yMin, double &yMax, bool parallel, const char ** error)
+{
+	//compressed files can only be read as a stream
+	if(parallel && INPUT_PLAIN == inputFormat(fileName))
+		return readPointsParallel(fileName, x, y, xMin, xMax, yMin, yMax, error);
+	return readPointsStream(fileName, x, y, xMin, xMax, yMin, yMax, NULL, error);
+}
+
+#ifdef ESCIB_LARGE
+/**
+ * NAME:	permutePoints
+ * DESCRIPTION:	move every point to its new position in place by following the cycles of the permutation, used by the large-data build instead of copying the points to new arrays, which would need twice the memory of the coordinates
  * PARAMETERS:
- * 	FILE * file: the input file
- * 	double * x: the array to store points' X values
- * 	double * y: the array to store points' Y values
+ * 	double * x:		points' X values, re-ordered in place
+ * 	double * y:		points' Y values, re-ordered in place
+ * 	PointCount * order:	if not NULL, set to the original array index of each re-ordered point
+ * 	PointCount * dest:	the new position of each point, destroyed in the process
+ * 	PointCount count:	the number of points
  * RETURN: none
  */
-void readPoints(FILE * file, double * x, double * y)
+static void permutePoints(double * x, double * y, PointCount * order, PointCount * dest, PointCount count)
 {
-        rewind(file);
-	int count = 0;
+	if(NULL != order)
+	{
+		for(PointCount i = 0; i < count; i++)
+			order[i] = i;
+	}
 
-	while(fscanf(file, "%lf,%lf\n", x + count, y + count) != EOF) {
-		count ++;
+	double t;
+	PointCount j, k;
+	for(PointCount i = 0; i < count; i++)
+	{
+		//swap the point at i into its position until the point moved to i belongs there
+		while(dest[i] != i)
+		{
+			j = dest[i];
+			t = x[i];
+			x[i] = x[j];
+			x[j] = t;
+			t = y[i];
+			y[i] = y[j];
+			y[j] = t;
+			if(NULL != order)
+			{
+				k = order[i];
+				order[i] = order[j];
+				order[j] = k;
+			}
+			dest[i] = dest[j];
+			dest[j] = j;
+		}
 	}
 }
+#endif
 
 /**
  * NAME:	indexPoints
  * DESCRIPTION:	index all points based on the block they falls in. the points will be re-ordered based on their blocksIDs accendingly. a seperate index table is created to store the ending array index (in the re-ordered array x and y) of points in each block.
  * PARAMETERS:
- * 	double * &x: 		array points' X values, will be changed to a new array of ordered points
- * 	double * &y: 		array points' Y values, will be changed to a new array of ordered points
- * 	int:			the total number of points
+ * 	double * &x: 		array points' X values, will be changed to a new array of ordered points (ordered in place in the large-data build)
+ * 	double * &y: 		array points' Y values, will be changed to a new array of ordered points (ordered in place in the large-data build)
+ * 	PointCount count:	the total number of points
  * 	double xMin:		the minimum X of all points, used to calculate the blockID of each point
  * 	double yMin:		the minimum Y of all points, used to calculate the blockID of each point
  * 	int nBlockX:		the number of index blocks along X dimension
  * 	int nBlockY:		the number of index blocks along Y dimension
  * 	double blockSize:	the size (side length) of each index block
+ * 	PointCount ** order:	if not NULL, set to a new array storing the original array index of each re-ordered point
  * RETURN:
- * 	TYPE:	int *
+ * 	TYPE:	PointCount *
  * 	VALUE:	an array with a length equal to (the total number of index blocks + 1), storing the starting and ending array index of points in each block
  */
-int * indexPoints(double * &x, double * &y, int count, double xMin, double yMin, int nBlockX, int nBlockY, double blockSize)
+PointCount * indexPoints(double * &x, double * &y, PointCount count, double xMin, double yMin, int nBlockX, int nBlockY, double blockSize, PointCount ** order)
 {
-	int * index;
-	int * pointsInB;
+	PointCount * index;
+	PointCount * pointsInB;
 
+#ifdef ESCIB_LARGE
+	PointCount * dest;
+#else
 	double * newX;
 	double * newY;
+#endif
+	PointCount * newOrder = NULL;
+
+	//blockIDs are int, so the grid can't have more blocks than that
+	if((double)nBlockX * nBlockY >= INT_MAX)
+	{
+		printf("ERROR: The grid of %d * %d index blocks is too large, use a larger search radius\n", nBlockX, nBlockY);
+		exit(1);
+	}
+
+#ifdef _OPENMP
+	if(count >= PARALLEL_INDEX_MIN_COUNT && omp_get_max_threads() > 1)
+		return indexPointsParallel(x, y, count, xMin, yMin, nBlockX, nBlockY, blockSize, order);
+#endif
 	
-	if(NULL == (index = (int *)malloc(sizeof(int) * (nBlockY * nBlockX + 1))))
+	if(NULL == (index = (PointCount *)malloc(sizeof(PointCount) * (nBlockY * nBlockX + 1))))
 	{
 		printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
 		exit(1);
 	}
-	if(NULL == (pointsInB = (int *)malloc(sizeof(int) * nBlockY * nBlockX)))
+	if(NULL == (pointsInB = (PointCount *)malloc(sizeof(PointCount) * nBlockY * nBlockX)))
 	{
 		printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
 		exit(1);
 	}
 
+#ifdef ESCIB_LARGE
+	if(NULL == (dest = (PointCount *)malloc(sizeof(PointCount) * count)))
+	{
+		printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+		exit(1);
+	}
+#else
 	if(NULL == (newX = (double *)malloc(sizeof(double) * count)))
 	{
 		printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
@@ -100,6 +815,12 @@ int * indexPoints(double * &x, double * &y, int count, double xMin, double yMin,
 		printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
 		exit(1);
 	}
+#endif
+	if(NULL != order && NULL == (newOrder = (PointCount *)malloc(sizeof(PointCount) * count)))
+	{
+		printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+		exit(1);
+	}
 
 	//Read all points the 1st time to get the number of points in each block
 	
@@ -110,7 +831,7 @@ int * indexPoints(double * &x, double * &y, int count, double xMin, double yMin,
 
 	int rowID, colID;
 	int blockID;
-	for(int i = 0; i < count; i++)
+	for(PointCount i = 0; i < count; i++)
 	{
 		colID = (int)((x[i] - xMin) / blockSize);
 		rowID = (int)((y[i] - yMin) / blockSize);
@@ -134,25 +855,878 @@ int * indexPoints(double * &x, double * &y, int count, double xMin, double yMin,
 		pointsInB[i] = index[i];
 	}
 
-	for(int i = 0; i < count; i++)
+	for(PointCount i = 0; i < count; i++)
 	{
 		colID = (int)((x[i] - xMin) / blockSize);
 		rowID = (int)((y[i] - yMin) / blockSize);
 		blockID = colID + rowID * nBlockX;
+#ifdef ESCIB_LARGE
+		dest[i] = pointsInB[blockID];
+#else
 		newX[pointsInB[blockID]] = x[i];
 		newY[pointsInB[blockID]] = y[i];
+		if(NULL != newOrder)
+			newOrder[pointsInB[blockID]] = i;
+#endif
 		pointsInB[blockID] ++;
 	}
 	
 
 	free(pointsInB);
+#ifdef ESCIB_LARGE
+	permutePoints(x, y, newOrder, dest, count);
+	free(dest);
+#else
 	free(x);
 	free(y);
 
 
 	x = newX;
 	y = newY;
+#endif
+	if(NULL != order)
+		*order = newOrder;
+
+
+	return index;
+}
+
+/**
+ * NAME:	indexPointsParallel
+ * DESCRIPTION:	the parallel version of indexPoints, producing identical arrays. Each thread takes a contiguous range of points, computes their blockIDs once and counts them in its own histogram; a prefix sum over (block, thread) gives every thread its own filling position in each block, so points keep their input order within each block
+ * PARAMETERS:
+ * 	the same as indexPoints
+ * RETURN:
+ * 	the same as indexPoints
+ */
+PointCount * indexPointsParallel(double * &x, double * &y, PointCount count, double xMin, double yMin, int nBlockX, int nBlockY, double blockSize, PointCount ** order)
+{
+	int nBlocks = nBlockX * nBlockY;
+	int nThreads = 1;
+#ifdef _OPENMP
+	nThreads = omp_get_max_threads();
+	//keep the per-thread histograms no larger than the points
+	while(nThreads > 1 && (long long)nThreads * nBlocks > (long long)count * 4 + nBlocks)
+		nThreads --;
+#endif
 
+	PointCount * index;
+	PointCount * pointsInB;
+	//the blockID of each point, and in the large-data build then its new position
+	PointCount * blockOf;
+
+#ifndef ESCIB_LARGE
+	double * newX;
+	double * newY;
+#endif
+	PointCount * newOrder = NULL;
+
+	if(NULL == (index = (PointCount *)malloc(sizeof(PointCount) * (nBlocks + 1))))
+	{
+		printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+		exit(1);
+	}
+	if(NULL == (pointsInB = (PointCount *)calloc((size_t)nBlocks * nThreads, sizeof(PointCount))))
+	{
+		printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+		exit(1);
+	}
+	if(NULL == (blockOf = (PointCount *)malloc(sizeof(PointCount) * count)))
+	{
+		printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+		exit(1);
+	}
+#ifndef ESCIB_LARGE
+	if(NULL == (newX = (double *)malloc(sizeof(double) * count)))
+	{
+		printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+		exit(1);
+	}
+	if(NULL == (newY = (double *)malloc(sizeof(double) * count)))
+	{
+		printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+		exit(1);
+	}
+#endif
+	if(NULL != order && NULL == (newOrder = (PointCount *)malloc(sizeof(PointCount) * count)))
+	{
+		printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+		exit(1);
+	}
+
+	#pragma omp parallel num_threads(nThreads)
+	{
+		int t = 0;
+#ifdef _OPENMP
+		t = omp_get_thread_num();
+#endif
+		PointCount * pointsInBT = pointsInB + (size_t)nBlocks * t;
+		PointCount begin = (PointCount)((long long)count * t / nThreads);
+		PointCount end = (PointCount)((long long)count * (t + 1) / nThreads);
+		int colID, rowID;
+
+		//1st pass: the blockID of each point and the number of points of this thread in each block
+		for(PointCount i = begin; i < end; i++)
+		{
+			colID = (int)((x[i] - xMin) / blockSize);
+			rowID = (int)((y[i] - yMin) / blockSize);
+			blockOf[i] = colID + rowID * nBlockX;
+			pointsInBT[blockOf[i]] ++;
+		}
+
+		#pragma omp barrier
+		#pragma omp single
+		{
+			//From this time, pointsInB stores the index of the next-to-fill point of each thread in each block
+			PointCount next = 0;
+			PointCount n;
+			for(int b = 0; b < nBlocks; b++)
+			{
+				index[b] = next;
+				for(int k = 0; k < nThreads; k++)
+				{
+					n = pointsInB[(size_t)nBlocks * k + b];
+					pointsInB[(size_t)nBlocks * k + b] = next;
+					next += n;
+				}
+			}
+			index[nBlocks] = next;
+		}
+
+		//2nd pass: fill points in the new array
+		PointCount pos;
+		for(PointCount i = begin; i < end; i++)
+		{
+			pos = pointsInBT[blockOf[i]] ++;
+#ifdef ESCIB_LARGE
+			blockOf[i] = pos;
+#else
+			newX[pos] = x[i];
+			newY[pos] = y[i];
+			if(NULL != newOrder)
+				newOrder[pos] = i;
+#endif
+		}
+	}
+
+	free(pointsInB);
+#ifdef ESCIB_LARGE
+	permutePoints(x, y, newOrder, blockOf, count);
+	free(blockOf);
+#else
+	free(blockOf);
+	free(x);
+	free(y);
+
+	x = newX;
+	y = newY;
+#endif
+	if(NULL != order)
+		*order = newOrder;
 
 	return index;
 }
+
+/**
+ * NAME:	gridBlocks
+ * DESCRIPTION:	get the number of index blocks covering the bounds of all points. A point at the maximum falls in block floor((max - min) / blockSize), which must exist even when the extent is a whole number of blocks
+ * PARAMETERS:
+ * 	double xMin:		the minimum X of all points
+ * 	double xMax:		the maximum X of all points
+ * 	double yMin:		the minimum Y of all points
+ * 	double yMax:		the maximum Y of all points
+ * 	double blockSize:	the size (side length) of each index block
+ * 	int &nBlockX:		set to the number of index blocks along X dimension
+ * 	int &nBlockY:		set to the number of index blocks along Y dimension
+ * RETURN:
+ * 	TYPE:	bool
+ * 	VALUE:	false if the grid would have INT_MAX blocks or more, or the bounds are not finite
+ */
+bool gridBlocks(double xMin, double xMax, double yMin, double yMax, double blockSize, int &nBlockX, int &nBlockY)
+{
+	double nX = floor((xMax - xMin) / blockSize) + 1;
+	double nY = floor((yMax - yMin) / blockSize) + 1;
+	if(!(nX >= 1 && nY >= 1 && nX * nY < INT_MAX))
+		return false;
+	nBlockX = (int)nX;
+	nBlockY = (int)nY;
+	return true;
+}
+
+/**
+ * NAME:	maxPointsInBlock
+ * DESCRIPTION:	get the largest number of points in any index block
+ * PARAMETERS:
+ * 	PointCount * index:	the index of the points, created by indexPoints
+ * 	int nBlockX:	the number of index blocks along X dimension
+ * 	int nBlockY:	the number of index blocks along Y dimension
+ * RETURN:
+ * 	TYPE:	PointCount
+ * 	VALUE:	the largest number of points in a block
+ */
+PointCount maxPointsInBlock(PointCount * index, int nBlockX, int nBlockY)
+{
+	PointCount maxCount = 0;
+	for(int i = 0; i < nBlockX * nBlockY; i++)
+	{
+		if(index[i + 1] - index[i] > maxCount)
+			maxCount = index[i + 1] - index[i];
+	}
+	return maxCount;
+}
+
+//a point and its row in the input file, sorted to find points at the same location
+struct RowPoint {
+	double x, y;
+	PointCount row;
+};
+
+/**
+ * NAME:	compareRowPoints
+ * DESCRIPTION:	order two points by X and then by Y, for qsort
+ * PARAMETERS:
+ * 	const void * a:	a RowPoint
+ * 	const void * b:	another RowPoint
+ * RETURN:
+ * 	TYPE:	int
+ * 	VALUE:	negative, zero or positive as a is before, at or after b
+ */
+static int compareRowPoints(const void * a, const void * b)
+{
+	const RowPoint * p = (const RowPoint *)a;
+	const RowPoint * q = (const RowPoint *)b;
+	if(p->x != q->x)
+		return (p->x < q->x) ? -1 : 1;
+	if(p->y != q->y)
+		return (p->y < q->y) ? -1 : 1;
+	return 0;
+}
+
+/**
+ * NAME:	dedupPoints
+ * DESCRIPTION:	collapse points with identical coordinates into weighted locations. Locations keep the order of their first points in the input, so indexing and clustering visit them in the same order as the points
+ * PARAMETERS:
+ * 	double * &x:		points' X values, will be changed to a new array of the X values of the locations
+ * 	double * &y:		points' Y values, will be changed to a new array of the Y values of the locations
+ * 	PointCount count:	the number of points
+ * 	PointCount * &weight:	set to a new array storing the number of points at each location
+ * 	PointCount * &location:	set to a new array storing the location of each point, in input order
+ * RETURN:
+ * 	TYPE:	PointCount
+ * 	VALUE:	the number of locations
+ */
+PointCount dedupPoints(double * &x, double * &y, PointCount count, PointCount * &weight, PointCount * &location)
+{
+	RowPoint * points;
+	if(NULL == (points = (RowPoint *)malloc(sizeof(RowPoint) * (count + 1))))
+	{
+		printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+		exit(1);
+	}
+	if(NULL == (location = (PointCount *)malloc(sizeof(PointCount) * (count + 1))))
+	{
+		printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+		exit(1);
+	}
+
+	for(PointCount i = 0; i < count; i++)
+	{
+		points[i].x = x[i];
+		points[i].y = y[i];
+		points[i].row = i;
+	}
+	qsort(points, count, sizeof(RowPoint), compareRowPoints);
+
+	//location is first used to store the group of identical points of each point
+	PointCount nGroups = 0;
+	for(PointCount i = 0; i < count; i++)
+	{
+		if(i == 0 || 0 != compareRowPoints(points + i - 1, points + i))
+			nGroups ++;
+		location[points[i].row] = nGroups - 1;
+	}
+	free(points);
+
+	PointCount * groupLocation;
+	double * newX;
+	double * newY;
+	if(NULL == (groupLocation = (PointCount *)malloc(sizeof(PointCount) * (nGroups + 1))))
+	{
+		printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+		exit(1);
+	}
+	if(NULL == (newX = (double *)malloc(sizeof(double) * (nGroups + 1))))
+	{
+		printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+		exit(1);
+	}
+	if(NULL == (newY = (double *)malloc(sizeof(double) * (nGroups + 1))))
+	{
+		printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+		exit(1);
+	}
+	if(NULL == (weight = (PointCount *)malloc(sizeof(PointCount) * (nGroups + 1))))
+	{
+		printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+		exit(1);
+	}
+
+	for(PointCount i = 0; i < nGroups; i++)
+	{
+		groupLocation[i] = -1;
+	}
+	PointCount nLocations = 0;
+	PointCount g;
+	for(PointCount i = 0; i < count; i++)
+	{
+		g = location[i];
+		if(groupLocation[g] < 0)
+		{
+			groupLocation[g] = nLocations;
+			newX[nLocations] = x[i];
+			newY[nLocations] = y[i];
+			weight[nLocations] = 0;
+			nLocations ++;
+		}
+		location[i] = groupLocation[g];
+		weight[location[i]] ++;
+	}
+
+	free(groupLocation);
+	free(x);
+	free(y);
+	x = newX;
+	y = newY;
+
+	return nLocations;
+}
+
+/**
+ * NAME:	reorderValues
+ * DESCRIPTION:	re-order a per point array the same way as indexPoints re-ordered the points
+ * PARAMETERS:
+ * 	PointCount * &values:	the value of each point in the original order, will be changed to a new array in the new order
+ * 	PointCount * order:	the original array index of each re-ordered point, created by indexPoints
+ * 	PointCount count:	the number of points
+ * RETURN: none
+ */
+void reorderValues(PointCount * &values, PointCount * order, PointCount count)
+{
+	PointCount * newValues;
+	if(NULL == (newValues = (PointCount *)malloc(sizeof(PointCount) * (count + 1))))
+	{
+		printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+		exit(1);
+	}
+	for(PointCount i = 0; i < count; i++)
+	{
+		newValues[i] = values[order[i]];
+	}
+	free(values);
+	values = newValues;
+}
+
+/**
+ * NAME:	compareStripPoints
+ * DESCRIPTION:	order two points by X, then by Y and then by their original array index, for qsort
+ * PARAMETERS:
+ * 	const void * a:	a RowPoint
+ * 	const void * b:	another RowPoint
+ * RETURN:
+ * 	TYPE:	int
+ * 	VALUE:	negative or positive as a is before or after b
+ */
+static int compareStripPoints(const void * a, const void * b)
+{
+	int result = compareRowPoints(a, b);
+	if(0 != result)
+		return result;
+	return (((const RowPoint *)a)->row < ((const RowPoint *)b)->row) ? -1 : 1;
+}
+
+/**
+ * NAME:	sortBlocksByX
+ * DESCRIPTION:	sort the points of each index block by X. Blocks of a grid row are stored from left to right, so every row strip of adjacent blocks is then sorted by X as a whole, and a search only needs to test the points of a strip within the search radius along X (see stripWindowStart)
+ * PARAMETERS:
+ * 	double * x:		the X values of the points in indexed order, sorted in place
+ * 	double * y:		the Y values of the points in indexed order, sorted in place
+ * 	PointCount * index:	the index of the points, created by indexPoints
+ * 	int nBlockX:		the number of index blocks along X dimension
+ * 	int nBlockY:		the number of index blocks along Y dimension
+ * 	PointCount * order:	if not NULL, the original array index of each point (created by indexPoints), moved along with the points
+ * RETURN: none
+ */
+void sortBlocksByX(double * x, double * y, PointCount * index, int nBlockX, int nBlockY, PointCount * order)
+{
+	PointCount maxCount = maxPointsInBlock(index, nBlockX, nBlockY);
+
+	#pragma omp parallel
+	{
+		RowPoint * points;
+		if(NULL == (points = (RowPoint *)malloc(sizeof(RowPoint) * (maxCount + 1))))
+		{
+			printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+			exit(1);
+		}
+
+		#pragma omp for schedule(dynamic, 64)
+		for(int b = 0; b < nBlockX * nBlockY; b++)
+		{
+			PointCount first = index[b];
+			PointCount n = index[b + 1] - first;
+			if(n < 2)
+				continue;
+			for(PointCount i = 0; i < n; i++)
+			{
+				points[i].x = x[first + i];
+				points[i].y = y[first + i];
+				points[i].row = (NULL == order) ? (first + i) : order[first + i];
+			}
+			qsort(points, n, sizeof(RowPoint), compareStripPoints);
+			for(PointCount i = 0; i < n; i++)
+			{
+				x[first + i] = points[i].x;
+				y[first + i] = points[i].y;
+				if(NULL != order)
+					order[first + i] = points[i].row;
+			}
+		}
+
+		free(points);
+	}
+}
+
+/**
+ * NAME:	expandDuplicates
+ * DESCRIPTION:	turn the cluster IDs of deduplicated locations back into the cluster IDs of all input points. The points are rebuilt from their locations and indexed (and sorted by X) again, so they are written in the same order as without deduplication
+ * PARAMETERS:
+ * 	int * clusterID:	the cluster ID of each location, in indexed order
+ * 	double * &x:		the X values of the locations in indexed order, will be changed to a new array of the X values of the points in indexed order
+ * 	double * &y:		the Y values of the locations in indexed order, will be changed to a new array of the Y values of the points in indexed order
+ * 	PointCount count:	the number of points
+ * 	PointCount * location:	the location of each point in input order, created by dedupPoints
+ * 	PointCount * locationOrder:	the location (before indexing) of each indexed location, created by indexPoints
+ * 	PointCount nLocations:	the number of locations
+ * 	double xMin:		the minimum X of all points
+ * 	double yMin:		the minimum Y of all points
+ * 	int nBlockX:		the number of index blocks along X dimension
+ * 	int nBlockY:		the number of index blocks along Y dimension
+ * 	double blockSize:	the size (side length) of each index block
+ * 	bool sortedX:		if true, the points of each index block are sorted by X (see sortBlocksByX), as they would be without deduplication
+ * 	PointCount ** order:	if not NULL, set to a new array storing the order in the input file of each point
+ * RETURN:
+ * 	TYPE:	int *
+ * 	VALUE:	the cluster ID of each point, in indexed order
+ */
+int * expandDuplicates(int * clusterID, double * &x, double * &y, PointCount count, PointCount * location, PointCount * locationOrder, PointCount nLocations, double xMin, double yMin, int nBlockX, int nBlockY, double blockSize, bool sortedX, PointCount ** order)
+{
+	PointCount * indexed;
+	double * newX;
+	double * newY;
+	int * newClusterID;
+	if(NULL == (indexed = (PointCount *)malloc(sizeof(PointCount) * (nLocations + 1))))
+	{
+		printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+		exit(1);
+	}
+	if(NULL == (newX = (double *)malloc(sizeof(double) * (count + 1))))
+	{
+		printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+		exit(1);
+	}
+	if(NULL == (newY = (double *)malloc(sizeof(double) * (count + 1))))
+	{
+		printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+		exit(1);
+	}
+	if(NULL == (newClusterID = (int *)malloc(sizeof(int) * (count + 1))))
+	{
+		printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+		exit(1);
+	}
+
+	//the indexed position of each location
+	for(PointCount i = 0; i < nLocations; i++)
+	{
+		indexed[locationOrder[i]] = i;
+	}
+	for(PointCount i = 0; i < count; i++)
+	{
+		newX[i] = x[indexed[location[i]]];
+		newY[i] = y[indexed[location[i]]];
+	}
+	free(x);
+	free(y);
+	x = newX;
+	y = newY;
+
+	PointCount * pointOrder;
+	PointCount * index = indexPoints(x, y, count, xMin, yMin, nBlockX, nBlockY, blockSize, &pointOrder);
+	if(sortedX)
+		sortBlocksByX(x, y, index, nBlockX, nBlockY, pointOrder);
+	free(index);
+	for(PointCount i = 0; i < count; i++)
+	{
+		newClusterID[i] = clusterID[indexed[location[pointOrder[i]]]];
+	}
+
+	free(indexed);
+	if(NULL != order)
+		*order = pointOrder;
+	else
+		free(pointOrder);
+	return newClusterID;
+}
+
+/**
+ * NAME:	savePointIndex
+ * DESCRIPTION:	write indexed points, their index and their input order to an index file, which can be given to the tools in place of the input file
+ * PARAMETERS:
+ * 	const char * fileName:	the index file name
+ * 	double * x:		points' X values, ordered by indexPoints
+ * 	double * y:		points' Y values, ordered by indexPoints
+ * 	PointCount count:	the number of points
+ * 	PointCount * index:	the index of the points, created by indexPoints
+ * 	PointCount * order:	the order in the input file of each point, created by indexPoints
+ * 	double radius:		the search radius, which is also the block size
+ * 	double xMin:		the minimum X of the grid
+ * 	double yMin:		the minimum Y of the grid
+ * 	double xMax:		the maximum X of the grid
+ * 	double yMax:		the maximum Y of the grid
+ * 	int nBlockX:		the number of index blocks along X dimension
+ * 	int nBlockY:		the number of index blocks along Y dimension
+ * RETURN: none
+ */
+void savePointIndex(const char * fileName, double * x, double * y, PointCount count, PointCount * index, PointCount * order, double radius, double xMin, double yMin, double xMax, double yMax, int nBlockX, int nBlockY)
+{
+	IndexHeader header;
+	memset(&header, 0, sizeof(IndexHeader));
+	memcpy(header.magic, INDEX_MAGIC, 8);
+	header.version = INDEX_VERSION;
+	header.indexBytes = sizeof(PointCount);
+	header.count = count;
+	header.radius = radius;
+	header.xMin = xMin;
+	header.yMin = yMin;
+	header.xMax = xMax;
+	header.yMax = yMax;
+	header.nBlockX = nBlockX;
+	header.nBlockY = nBlockY;
+
+	FILE * file;
+	if(NULL == (file = fopen(fileName, "wb")))
+	{
+		printf("ERROR: Can't open the index file.\n");
+		exit(1);
+	}
+	if(1 != fwrite(&header, sizeof(IndexHeader), 1, file)
+		|| (size_t)count != fwrite(x, sizeof(double), count, file)
+		|| (size_t)count != fwrite(y, sizeof(double), count, file)
+		|| (size_t)nBlockX * nBlockY + 1 != fwrite(index, sizeof(PointCount), (size_t)nBlockX * nBlockY + 1, file)
+		|| (size_t)count != fwrite(order, sizeof(PointCount), count, file))
+	{
+		printf("ERROR: Can't write the index file.\n");
+		exit(1);
+	}
+	fclose(file);
+}
+
+/**
+ * NAME:	mapPointIndex
+ * DESCRIPTION:	map an index file written by savePointIndex into memory, so that its points are neither parsed nor indexed again
+ * PARAMETERS:
+ * 	const char * fileName:	the file name
+ * RETURN:
+ * 	TYPE:	PointIndex *
+ * 	VALUE:	the mapped index, to be closed by closePointIndex; NULL if the file is not an index file
+ */
+PointIndex * mapPointIndex(const char * fileName)
+{
+	IndexHeader header;
+	FILE * file;
+	if(NULL == (file = fopen(fileName, "rb")))
+		return NULL;
+	size_t n = fread(&header, 1, sizeof(IndexHeader), file);
+	fclose(file);
+	if(n < 8 || 0 != memcmp(header.magic, INDEX_MAGIC, 8))
+		return NULL;
+	if(n < sizeof(IndexHeader) || header.version != INDEX_VERSION)
+	{
+		printf("ERROR: %s is an index file of an unsupported version.\n", fileName);
+		exit(1);
+	}
+	if(header.indexBytes != (int)sizeof(PointCount))
+	{
+		printf("ERROR: %s was written with %d-byte indices, but this build uses %d-byte indices (see make LARGE=1).\n", fileName, header.indexBytes, (int)sizeof(PointCount));
+		exit(1);
+	}
+
+	int fd;
+	struct stat st;
+	if(-1 == (fd = open(fileName, O_RDONLY)) || -1 == fstat(fd, &st))
+	{
+		printf("ERROR: Can't open the index file.\n");
+		exit(1);
+	}
+	size_t size = sizeof(IndexHeader) + (sizeof(double) * 2 + sizeof(PointCount)) * (size_t)header.count + sizeof(PointCount) * ((size_t)header.nBlockX * header.nBlockY + 1);
+	if(header.count < 0 || header.nBlockX < 0 || header.nBlockY < 0 || (size_t)st.st_size != size)
+	{
+		printf("ERROR: The index file %s is damaged.\n", fileName);
+		exit(1);
+	}
+
+	PointIndex * saved;
+	if(NULL == (saved = (PointIndex *)malloc(sizeof(PointIndex))))
+	{
+		printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+		exit(1);
+	}
+	if(MAP_FAILED == (saved->data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0)))
+	{
+		printf("ERROR: Can't map the index file.\n");
+		exit(1);
+	}
+	close(fd);
+
+	char * p = (char *)saved->data;
+	saved->size = size;
+	saved->header = (IndexHeader *)p;
+	p += sizeof(IndexHeader);
+	saved->x = (double *)p;
+	p += sizeof(double) * header.count;
+	saved->y = (double *)p;
+	p += sizeof(double) * header.count;
+	saved->index = (PointCount *)p;
+	p += sizeof(PointCount) * ((size_t)header.nBlockX * header.nBlockY + 1);
+	saved->order = (PointCount *)p;
+	return saved;
+}
+
+/**
+ * NAME:	closePointIndex
+ * DESCRIPTION:	unmap an index file, after which none of its arrays can be used
+ * PARAMETERS:
+ * 	PointIndex * saved:	the mapped index, nothing is done if it is NULL
+ * RETURN: none
+ */
+void closePointIndex(PointIndex * saved)
+{
+	if(NULL == saved)
+		return;
+	munmap(saved->data, saved->size);
+	free(saved);
+}
+
+/**
+ * NAME:	savedPoints
+ * DESCRIPTION:	use the points of a mapped index file in place of reading an input file, and update the bounding box of all points with the extent of its grid
+ * PARAMETERS:
+ * 	PointIndex * saved:	the mapped index
+ * 	double * &x:		set to the (read only) array of points' X values
+ * 	double * &y:		set to the (read only) array of points' Y values
+ * 	double &xMin:		the minimum X of all points, will be updated
+ * 	double &xMax:		the maximum X of all points, will be updated
+ * 	double &yMin:		the minimum Y of all points, will be updated
+ * 	double &yMax:		the maximum Y of all points, will be updated
+ * RETURN:
+ * 	TYPE:	PointCount
+ * 	VALUE:	the number of points
+ */
+PointCount savedPoints(PointIndex * saved, double * &x, double * &y, double &xMin, double &xMax, double &yMin, double &yMax)
+{
+	x = saved->x;
+	y = saved->y;
+	if(saved->header->xMin < xMin)
+		xMin = saved->header->xMin;
+	if(saved->header->xMax > xMax)
+		xMax = saved->header->xMax;
+	if(saved->header->yMin < yMin)
+		yMin = saved->header->yMin;
+	if(saved->header->yMax > yMax)
+		yMax = saved->header->yMax;
+	return saved->header->count;
+}
+
+/**
+ * NAME:	matchPointIndex
+ * DESCRIPTION:	check that a mapped index was built for the grid of this run. The grid covers all inputs and the extent of every index, so it matches only if the index covers all other inputs with the same search radius
+ * PARAMETERS:
+ * 	PointIndex * saved:	the mapped index, NULL always matches
+ * 	double radius:		the search radius
+ * 	double xMin:		the minimum X of all points
+ * 	double yMin:		the minimum Y of all points
+ * 	int nBlockX:		the number of index blocks along X dimension
+ * 	int nBlockY:		the number of index blocks along Y dimension
+ * RETURN:
+ * 	TYPE:	bool
+ * 	VALUE:	true if the index can be used
+ */
+bool matchPointIndex(PointIndex * saved, double radius, double xMin, double yMin, int nBlockX, int nBlockY)
+{
+	if(NULL == saved)
+		return true;
+	IndexHeader * h = saved->header;
+	if(h->radius != radius)
+	{
+		printf("ERROR! The index file was built for search radius %lf\n", h->radius);
+		return false;
+	}
+	if(h->xMin != xMin || h->yMin != yMin || h->nBlockX != nBlockX || h->nBlockY != nBlockY)
+	{
+		printf("ERROR! The index file was built for a different grid, other inputs are outside its extent\n");
+		return false;
+	}
+	return true;
+}
+
+/**
+ * NAME:	loadingThread
+ * DESCRIPTION:	the thread started by startLoading
+ * PARAMETERS:
+ * 	void * arg:	the PointTask
+ * RETURN:
+ * 	TYPE:	void *
+ * 	VALUE:	NULL
+ */
+static void * loadingThread(void * arg)
+{
+	PointTask * task = (PointTask *)arg;
+	task->count = loadPoints(task->fileName, task->x, task->y, task->xMin, task->xMax, task->yMin, task->yMax, task->parallel);
+	return NULL;
+}
+
+/**
+ * NAME:	startLoading
+ * DESCRIPTION:	start loading the points of a file (see loadPoints) on a thread of its own, so that the other input of a tool is read at the same time
+ * PARAMETERS:
+ * 	PointTask & task:	the task, kept until finishLoading
+ * 	const char * fileName:	the name of the input file
+ * 	bool parallel:		parse the file with multiple threads
+ * RETURN: none
+ */
+void startLoading(PointTask & task, const char * fileName, bool parallel)
+{
+	task.fileName = fileName;
+	task.parallel = parallel;
+	task.xMin = 999999999;
+	task.yMin = 999999999;
+	task.xMax = -999999999;
+	task.yMax = -999999999;
+	if(0 != pthread_create(&task.thread, NULL, loadingThread, &task))
+	{
+		printf("ERROR: Can't start the loading thread.\n");
+		exit(1);
+	}
+}
+
+/**
+ * NAME:	finishLoading
+ * DESCRIPTION:	wait for the points loaded by startLoading
+ * PARAMETERS:
+ * 	PointTask & task:	the task
+ * 	double * &x:		set to the array of points' X values
+ * 	double * &y:		set to the array of points' Y values
+ * 	double &xMin:		the Mininum X of all points, extended by the loaded points
+ * 	double &xMax:		the Maximum X of all points, extended by the loaded points
+ * 	double &yMin:		the Minimum Y of all points, extended by the loaded points
+ * 	double &yMax:		the Maximum Y of all points, extended by the loaded points
+ * RETURN:
+ * 	TYPE:	PointCount
+ * 	VALUE:	the number of points
+ */
+PointCount finishLoading(PointTask & task, double * &x, double * &y, double &xMin, double &xMax, double &yMin, double &yMax)
+{
+	pthread_join(task.thread, NULL);
+	x = task.x;
+	y = task.y;
+	if(task.count > 0)
+	{
+		if(task.xMin < xMin)
+			xMin = task.xMin;
+		if(task.xMax > xMax)
+			xMax = task.xMax;
+		if(task.yMin < yMin)
+			yMin = task.yMin;
+		if(task.yMax > yMax)
+			yMax = task.yMax;
+	}
+	return task.count;
+}
+
+/**
+ * NAME:	indexingThread
+ * DESCRIPTION:	the thread started by startIndexing
+ * PARAMETERS:
+ * 	void * arg:	the PointTask
+ * RETURN:
+ * 	TYPE:	void *
+ * 	VALUE:	NULL
+ */
+static void * indexingThread(void * arg)
+{
+	PointTask * task = (PointTask *)arg;
+	task->index = indexPoints(task->x, task->y, task->count, task->xMin, task->yMin, task->nBlockX, task->nBlockY, task->blockSize, task->keepOrder ? &task->order : NULL);
+	if(task->sortX)
+		sortBlocksByX(task->x, task->y, task->index, task->nBlockX, task->nBlockY, task->order);
+	return NULL;
+}
+
+/**
+ * NAME:	startIndexing
+ * DESCRIPTION:	start indexing points (see indexPoints) on a thread of its own, so that the other input of a tool is indexed and counted at the same time. The arrays of the points must not be used until finishIndexing
+ * PARAMETERS:
+ * 	PointTask & task:	the task, kept until finishIndexing
+ * 	double * x:		points' X values
+ * 	double * y:		points' Y values
+ * 	PointCount count:	the number of points
+ * 	double xMin:		the minimum X of all points
+ * 	double yMin:		the minimum Y of all points
+ * 	int nBlockX:		the number of index blocks along X dimension
+ * 	int nBlockY:		the number of index blocks along Y dimension
+ * 	double blockSize:	the size of each block
+ * 	bool keepOrder:		keep the original array index of each indexed point
+ * 	bool sortX:		sort the points of each block by X (see sortBlocksByX)
+ * RETURN: none
+ */
+void startIndexing(PointTask & task, double * x, double * y, PointCount count, double xMin, double yMin, int nBlockX, int nBlockY, double blockSize, bool keepOrder, bool sortX)
+{
+	task.x = x;
+	task.y = y;
+	task.count = count;
+	task.xMin = xMin;
+	task.yMin = yMin;
+	task.nBlockX = nBlockX;
+	task.nBlockY = nBlockY;
+	task.blockSize = blockSize;
+	task.keepOrder = keepOrder;
+	task.sortX = sortX;
+	task.index = NULL;
+	task.order = NULL;
+	if(0 != pthread_create(&task.thread, NULL, indexingThread, &task))
+	{
+		printf("ERROR: Can't start the indexing thread.\n");
+		exit(1);
+	}
+}
+
+/**
+ * NAME:	finishIndexing
+ * DESCRIPTION:	wait for the points indexed by startIndexing
+ * PARAMETERS:
+ * 	PointTask & task:	the task
+ * 	double * &x:		set to the new array of the X values of the points in indexed order
+ * 	double * &y:		set to the new array of the Y values of the points in indexed order
+ * 	PointCount ** order:	if not NULL, set to the original array index of each indexed point (the task must keep them)
+ * RETURN:
+ * 	TYPE:	PointCount *
+ * 	VALUE:	the index of the points, as returned by indexPoints
+ */
+PointCount * finishIndexing(PointTask & task, double * &x, double * &y, PointCount ** order)
+{
+	pthread_join(task.thread, NULL);
+	x = task.x;
+	y = task.y;
+	if(NULL != order)
+		*order = task.order;
+	return task.index;
+}
@@ -1,8 +1,131 @@
 #ifndef IOH
 #define IOH
 
-int getCount(FILE * file, double &xMin, double &xMax, double &yMin, double &yMax);
-void readPoints(FILE * file, double * x, double * y);
-int * indexPoints(double * &x, double * &y, int count, double xMin, double yMin, int nBlockX, int nBlockY, double blockSize);
+#include <stddef.h>
+#include <pthread.h>
+#include "pointCount.h"
+
+#define INDEX_MAGIC "ESCIBIDX"
+#define INDEX_VERSION 2
+
+//header of an index file written by ESCIB_Index, followed by x[count], y[count] (double, in indexed order), index[nBlockX * nBlockY + 1] and order[count] (indexBytes each)
+struct IndexHeader {
+	char magic[8];		//INDEX_MAGIC without the terminating zero
+	int version;		//INDEX_VERSION
+	int indexBytes;		//the size of each index and order entry, sizeof(PointCount) of the build that wrote it
+	long long count;	//the number of points
+	double radius;		//the search radius, which is also the block size
+	double xMin, yMin;	//the lower left corner of the grid
+	double xMax, yMax;	//the extent covered by the grid
+	int nBlockX, nBlockY;
+};
+
+//an index file mapped into memory, its arrays are read only
+struct PointIndex {
+	void * data;
+	size_t size;
+	IndexHeader * header;
+	double * x;
+	double * y;
+	PointCount * index;
+	PointCount * order;
+};
+
+//one input loaded, or indexed, on a thread of its own while the other input of a tool is prepared (see startLoading and startIndexing)
+struct PointTask {
+	pthread_t thread;
+	const char * fileName;
+	bool parallel;		//parse the file with multiple threads
+	double * x;
+	double * y;
+	PointCount count;
+	double xMin, xMax, yMin, yMax;
+	int nBlockX, nBlockY;
+	double blockSize;
+	bool keepOrder;		//keep the original array index of each indexed point
+	bool sortX;		//sort the points of each block by X after indexing
+	PointCount * index;
+	PointCount * order;
+};
+
+PointCount readPointsStream(const char * fileName, double * &x, double * &y, double &xMin, double &xMax, double &yMin, double &yMax, int ** category = NULL, const char ** error = NULL);
+PointCount readPointsParallel(const char * fileName, double * &x, double * &y, double &xMin, double &xMax, double &yMin, double &yMax, const char ** error = NULL);
+PointCount loadPoints(const char * fileName, double * &x, double * &y, double &xMin, double &xMax, double &yMin, double &yMax, bool parallel, const char ** error = NULL);
+PointCount * indexPoints(double * &x, double * &y, PointCount count, double xMin, double yMin, int nBlockX, int nBlockY, double blockSize, PointCount ** order = NULL);
+PointCount * indexPointsParallel(double * &x, double * &y, PointCount count, double xMin, double yMin, int nBlockX, int nBlockY, double blockSize, PointCount ** order = NULL);
+bool gridBlocks(double xMin, double xMax, double yMin, double yMax, double blockSize, int &nBlockX, int &nBlockY);
+PointCount maxPointsInBlock(PointCount * index, int nBlockX, int nBlockY);
+PointCount dedupPoints(double * &x, double * &y, PointCount count, PointCount * &weight, PointCount * &location);
+void reorderValues(PointCount * &values, PointCount * order, PointCount count);
+void sortBlocksByX(double * x, double * y, PointCount * index, int nBlockX, int nBlockY, PointCount * order = NULL);
+int * expandDuplicates(int * clusterID, double * &x, double * &y, PointCount count, PointCount * location, PointCount * locationOrder, PointCount nLocations, double xMin, double yMin, int nBlockX, int nBlockY, double blockSize, bool sortedX, PointCount ** order = NULL);
+void savePointIndex(const char * fileName, double * x, double * y, PointCount count, PointCount * index, PointCount * order, double radius, double xMin, double yMin, double xMax, double yMax, int nBlockX, int nBlockY);
+PointIndex * mapPointIndex(const char * fileName);
+void closePointIndex(PointIndex * saved);
+PointCount savedPoints(PointIndex * saved, double * &x, double * &y, double &xMin, double &xMax, double &yMin, double &yMax);
+bool matchPointIndex(PointIndex * saved, double radius, double xMin, double yMin, int nBlockX, int nBlockY);
+void startLoading(PointTask & task, const char * fileName, bool parallel);
+PointCount finishLoading(PointTask & task, double * &x, double * &y, double &xMin, double &xMax, double &yMin, double &yMax);
+void startIndexing(PointTask & task, double * x, double * y, PointCount count, double xMin, double yMin, int nBlockX, int nBlockY, double blockSize, bool keepOrder, bool sortX);
+PointCount * finishIndexing(PointTask & task, double * &x, double * &y, PointCount ** order = NULL);
+
+/**
+ * NAME:	beforeStripWindow
+ * DESCRIPTION:	test whether a point is left of the X window of a search, so that it can't be within the search radius whatever its Y value. The test is on squared differences, so it never drops a point that the distance test would accept
+ * PARAMETERS:
+ * 	double xP:	the X value of the point
+ * 	double cX:	the X value of the search center
+ * 	double dist2:	the squared search radius
+ * RETURN:
+ * 	TYPE:	bool
+ * 	VALUE:	true if the point is left of the window
+ */
+static inline bool beforeStripWindow(double xP, double cX, double dist2)
+{
+	return xP < cX && (xP - cX) * (xP - cX) > dist2;
+}
+
+/**
+ * NAME:	afterStripWindow
+ * DESCRIPTION:	test whether a point is right of the X window of a search (see beforeStripWindow)
+ * PARAMETERS:
+ * 	double xP:	the X value of the point
+ * 	double cX:	the X value of the search center
+ * 	double dist2:	the squared search radius
+ * RETURN:
+ * 	TYPE:	bool
+ * 	VALUE:	true if the point is right of the window
+ */
+static inline bool afterStripWindow(double xP, double cX, double dist2)
+{
+	return xP > cX && (xP - cX) * (xP - cX) > dist2;
+}
+
+/**
+ * NAME:	stripWindowStart
+ * DESCRIPTION:	binary search a row strip sorted by X (see sortBlocksByX) for the first point that is not left of the X window of a search
+ * PARAMETERS:
+ * 	double * x:		the X values of the points
+ * 	PointCount from:	the first point of the strip
+ * 	PointCount to:		one past the last point of the strip
+ * 	double cX:		the X value of the search center
+ * 	double dist2:		the squared search radius
+ * RETURN:
+ * 	TYPE:	PointCount
+ * 	VALUE:	the first point in the window, or to if there is none
+ */
+static inline PointCount stripWindowStart(double * x, PointCount from, PointCount to, double cX, double dist2)
+{
+	PointCount middle;
+	while(from < to)
+	{
+		middle = from + (to - from) / 2;
+		if(beforeStripWindow(x[middle], cX, dist2))
+			from = middle + 1;
+		else
+			to = middle;
+	}
+	return from;
+}
 
 #endif
@@ -0,0 +1,348 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "kdtree.h"
+
+//the largest number of points in a leaf
+#define KD_LEAF_SIZE 32
+//deep enough for any tree built by buildKDTree
+#define KD_MAX_DEPTH 128
+
+/**
+ * NAME:	swapPoints
+ * DESCRIPTION:	swap two points in the arrays of a KD-tree
+ * PARAMETERS:
+ * 	KDTree * tree:	the tree
+ * 	PointCount i:	the position of a point
+ * 	PointCount j:	the position of another point
+ * RETURN: none
+ */
+static inline void swapPoints(KDTree * tree, PointCount i, PointCount j)
+{
+	double t = tree->x[i];
+	tree->x[i] = tree->x[j];
+	tree->x[j] = t;
+	t = tree->y[i];
+	tree->y[i] = tree->y[j];
+	tree->y[j] = t;
+	PointCount id = tree->id[i];
+	tree->id[i] = tree->id[j];
+	tree->id[j] = id;
+	if(NULL != tree->weight)
+	{
+		id = tree->weight[i];
+		tree->weight[i] = tree->weight[j];
+		tree->weight[j] = id;
+	}
+}
+
+/**
+ * NAME:	selectKD
+ * DESCRIPTION:	partially sort the points begin..end-1 of a KD-tree along one dimension so that the point at k is in its sorted position, with no larger point before and no smaller point after it. A three-way partition keeps this linear when many points share a coordinate
+ * PARAMETERS:
+ * 	KDTree * tree:	the tree
+ * 	PointCount begin:	the first point
+ * 	PointCount end:	the position after the last point
+ * 	PointCount k:	the position to select
+ * 	bool alongX:	whether to compare X values (otherwise Y values)
+ * RETURN: none
+ */
+static void selectKD(KDTree * tree, PointCount begin, PointCount end, PointCount k, bool alongX)
+{
+	double * v = alongX ? tree->x : tree->y;
+	while(end - begin > 1)
+	{
+		double pivot = v[begin + (end - begin) / 2];
+		//begin..lt-1 < pivot, lt..i-1 == pivot, gt..end-1 > pivot
+		PointCount lt = begin, i = begin, gt = end;
+		while(i < gt)
+		{
+			if(v[i] < pivot)
+				swapPoints(tree, lt++, i++);
+			else if(v[i] > pivot)
+				swapPoints(tree, i, --gt);
+			else
+				i ++;
+		}
+		if(k < lt)
+			end = lt;
+		else if(k >= gt)
+			begin = gt;
+		else
+			return;
+	}
+}
+
+/**
+ * NAME:	buildNode
+ * DESCRIPTION:	create the node covering the points begin..end-1 of a KD-tree and, unless it is small enough to be a leaf, split it at the median of its wider dimension
+ * PARAMETERS:
+ * 	KDTree * tree:	the tree
+ * 	PointCount begin:	the first point
+ * 	PointCount end:	the position after the last point
+ * RETURN:
+ * 	TYPE:	PointCount
+ * 	VALUE:	the position of the node in tree->nodes
+ */
+static PointCount buildNode(KDTree * tree, PointCount begin, PointCount end)
+{
+	PointCount n = tree->nNodes ++;
+	KDNode * node = tree->nodes + n;
+	node->begin = begin;
+	node->end = end;
+	node->left = -1;
+	node->right = -1;
+	node->xMin = node->xMax = tree->x[begin];
+	node->yMin = node->yMax = tree->y[begin];
+	node->weight = end - begin;
+	if(NULL != tree->weight)
+	{
+		node->weight = 0;
+		for(PointCount i = begin; i < end; i++)
+			node->weight += tree->weight[i];
+	}
+	for(PointCount i = begin + 1; i < end; i++)
+	{
+		if(tree->x[i] < node->xMin)
+			node->xMin = tree->x[i];
+		if(tree->x[i] > node->xMax)
+			node->xMax = tree->x[i];
+		if(tree->y[i] < node->yMin)
+			node->yMin = tree->y[i];
+		if(tree->y[i] > node->yMax)
+			node->yMax = tree->y[i];
+	}
+
+	if(end - begin <= KD_LEAF_SIZE)
+		return n;
+
+	PointCount mid = begin + (end - begin) / 2;
+	selectKD(tree, begin, end, mid, (node->xMax - node->xMin) >= (node->yMax - node->yMin));
+	//node may move when children are appended, so it is not used after this
+	PointCount left = buildNode(tree, begin, mid);
+	PointCount right = buildNode(tree, mid, end);
+	tree->nodes[n].left = left;
+	tree->nodes[n].right = right;
+	return n;
+}
+
+/**
+ * NAME:	buildKDTree
+ * DESCRIPTION:	build a bucketed KD-tree over a set of points, used instead of the uniform grid when points are highly concentrated
+ * PARAMETERS:
+ * 	double * x:	points' X values
+ * 	double * y:	points' Y values
+ * 	PointCount count:	the number of points
+ * 	PointCount * weight:	if not NULL, the weight of each point (the number of input points at its location), summed by rangeCountKD
+ * RETURN:
+ * 	TYPE:	KDTree *
+ * 	VALUE:	the tree, to be freed by freeKDTree; it reports the array index (in x and y) of each point
+ */
+KDTree * buildKDTree(double * x, double * y, PointCount count, PointCount * weight)
+{
+	KDTree * tree;
+	if(NULL == (tree = (KDTree *)malloc(sizeof(KDTree))))
+	{
+		printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+		exit(1);
+	}
+	//a median split never makes more than 2 * count / (KD_LEAF_SIZE / 2) nodes
+	PointCount maxNodes = 4 * (count / KD_LEAF_SIZE + 1);
+	if(NULL == (tree->nodes = (KDNode *)malloc(sizeof(KDNode) * maxNodes)))
+	{
+		printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+		exit(1);
+	}
+	if(NULL == (tree->x = (double *)malloc(sizeof(double) * (count + 1))))
+	{
+		printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+		exit(1);
+	}
+	if(NULL == (tree->y = (double *)malloc(sizeof(double) * (count + 1))))
+	{
+		printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+		exit(1);
+	}
+	if(NULL == (tree->id = (PointCount *)malloc(sizeof(PointCount) * (count + 1))))
+	{
+		printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+		exit(1);
+	}
+
+	tree->weight = NULL;
+	if(NULL != weight && NULL == (tree->weight = (PointCount *)malloc(sizeof(PointCount) * (count + 1))))
+	{
+		printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+		exit(1);
+	}
+
+	for(PointCount i = 0; i < count; i++)
+	{
+		tree->x[i] = x[i];
+		tree->y[i] = y[i];
+		tree->id[i] = i;
+		if(NULL != weight)
+			tree->weight[i] = weight[i];
+	}
+	tree->count = count;
+	tree->nNodes = 0;
+	if(count > 0)
+		buildNode(tree, 0, count);
+
+	return tree;
+}
+
+/**
+ * NAME:	freeKDTree
+ * DESCRIPTION:	free the memory of a KD-tree
+ * PARAMETERS:
+ * 	KDTree * tree: the tree
+ * RETURN: none
+ */
+void freeKDTree(KDTree * tree)
+{
+	if(NULL == tree)
+		return;
+	free(tree->nodes);
+	free(tree->x);
+	free(tree->y);
+	free(tree->id);
+	free(tree->weight);
+	free(tree);
+}
+
+/**
+ * NAME:	farthestDist2
+ * DESCRIPTION:	get the squared distance from a location to the farthest corner of a node. If it is within the search distance, so is every point of the node
+ * PARAMETERS:
+ * 	KDNode * node:	the node
+ * 	double cX:	the X value of the location
+ * 	double cY:	the Y value of the location
+ * RETURN:
+ * 	TYPE:	double
+ * 	VALUE:	the squared distance
+ */
+static inline double farthestDist2(KDNode * node, double cX, double cY)
+{
+	double dx = (cX - node->xMin > node->xMax - cX) ? (node->xMin - cX) : (node->xMax - cX);
+	double dy = (cY - node->yMin > node->yMax - cY) ? (node->yMin - cY) : (node->yMax - cY);
+	return dx * dx + dy * dy;
+}
+
+/**
+ * NAME:	nearestDist2
+ * DESCRIPTION:	get the squared distance from a location to the nearest location in a node. If it is beyond the search distance, so is every point of the node
+ * PARAMETERS:
+ * 	KDNode * node:	the node
+ * 	double cX:	the X value of the location
+ * 	double cY:	the Y value of the location
+ * RETURN:
+ * 	TYPE:	double
+ * 	VALUE:	the squared distance
+ */
+static inline double nearestDist2(KDNode * node, double cX, double cY)
+{
+	double dx = (cX < node->xMin) ? (node->xMin - cX) : ((cX > node->xMax) ? (cX - node->xMax) : 0);
+	double dy = (cY < node->yMin) ? (node->yMin - cY) : ((cY > node->yMax) ? (cY - node->yMax) : 0);
+	return dx * dx + dy * dy;
+}
+
+/**
+ * NAME:	rangeCountKD
+ * DESCRIPTION:	get the number (the total weight if the tree has weights) of points of a KD-tree within a distance of a location. Nodes entirely within the distance are counted without visiting their points
+ * PARAMETERS:
+ * 	KDTree * tree:		the tree
+ * 	double cX:		the X value of the location
+ * 	double cY:		the Y value of the location
+ * 	double distance:	the distance
+ * 	PointCount limit:	counting stops once the count reaches this limit
+ * RETURN:
+ * 	TYPE:	PointCount
+ * 	VALUE:	the number of points within the distance, at most the limit
+ */
+PointCount rangeCountKD(KDTree * tree, double cX, double cY, double distance, PointCount limit)
+{
+	if(tree->nNodes == 0)
+		return 0;
+
+	double dis2 = distance * distance;
+	PointCount stack[KD_MAX_DEPTH];
+	PointCount nStack = 1;
+	PointCount count = 0;
+	stack[0] = 0;
+
+	KDNode * node;
+	while(nStack > 0 && count < limit)
+	{
+		node = tree->nodes + stack[--nStack];
+		if(dis2 < nearestDist2(node, cX, cY))
+			continue;
+		if(dis2 >= farthestDist2(node, cX, cY))
+		{
+			count += node->weight;
+			continue;
+		}
+		if(node->left >= 0)
+		{
+			stack[nStack++] = node->left;
+			stack[nStack++] = node->right;
+			continue;
+		}
+		for(PointCount i = node->begin; i < node->end; i++)
+		{
+			if(dis2 >= ((tree->x[i] - cX) * (tree->x[i] - cX) + (tree->y[i] - cY) * (tree->y[i] - cY)))
+				count += (NULL == tree->weight) ? 1 : tree->weight[i];
+		}
+	}
+	return (count < limit) ? count : limit;
+}
+
+/**
+ * NAME:	rangeSearchKD
+ * DESCRIPTION:	find all points of a KD-tree within a distance of a location
+ * PARAMETERS:
+ * 	KDTree * tree:		the tree
+ * 	double cX:		the X value of the location
+ * 	double cY:		the Y value of the location
+ * 	double distance:	the distance
+ * 	PointCount * found:	the array to store the array index of each point found, long enough for all points of the tree
+ * RETURN:
+ * 	TYPE:	PointCount
+ * 	VALUE:	the number of points found
+ */
+PointCount rangeSearchKD(KDTree * tree, double cX, double cY, double distance, PointCount * found)
+{
+	if(tree->nNodes == 0)
+		return 0;
+
+	double dis2 = distance * distance;
+	PointCount stack[KD_MAX_DEPTH];
+	PointCount nStack = 1;
+	PointCount nFound = 0;
+	stack[0] = 0;
+
+	KDNode * node;
+	while(nStack > 0)
+	{
+		node = tree->nodes + stack[--nStack];
+		if(dis2 < nearestDist2(node, cX, cY))
+			continue;
+		if(dis2 >= farthestDist2(node, cX, cY))
+		{
+			for(PointCount i = node->begin; i < node->end; i++)
+				found[nFound++] = tree->id[i];
+			continue;
+		}
+		if(node->left >= 0)
+		{
+			stack[nStack++] = node->left;
+			stack[nStack++] = node->right;
+			continue;
+		}
+		for(PointCount i = node->begin; i < node->end; i++)
+		{
+			if(dis2 >= ((tree->x[i] - cX) * (tree->x[i] - cX) + (tree->y[i] - cY) * (tree->y[i] - cY)))
+				found[nFound++] = tree->id[i];
+		}
+	}
+	return nFound;
+}
@@ -0,0 +1,30 @@
+#ifndef KDH
+#define KDH
+
+#include "pointCount.h"
+
+//a node of a KD-tree, covering the points begin..end-1 (in tree order)
+struct KDNode {
+	double xMin, yMin, xMax, yMax;	//the bounding box of the points of the node
+	PointCount begin, end;
+	PointCount weight;		//the total weight of the points of the node
+	PointCount left, right;	//the children, -1 for a leaf
+};
+
+//a bucketed KD-tree; points are copied in tree order so that every node covers a contiguous range
+struct KDTree {
+	KDNode * nodes;
+	PointCount nNodes;
+	double * x;
+	double * y;
+	PointCount * id;		//the array index of each point in the arrays the tree was built from
+	PointCount * weight;		//the weight of each point in tree order, NULL if every point counts once
+	PointCount count;
+};
+
+KDTree * buildKDTree(double * x, double * y, PointCount count, PointCount * weight = NULL);
+void freeKDTree(KDTree * tree);
+PointCount rangeCountKD(KDTree * tree, double cX, double cY, double distance, PointCount limit = POINT_COUNT_MAX);
+PointCount rangeSearchKD(KDTree * tree, double cX, double cY, double distance, PointCount * found);
+
+#endif
@@ -0,0 +1,415 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "lattice.h"
+
+/**
+ * NAME:	buildLattice
+ * DESCRIPTION:	rasterize points onto a lattice of square cells, build the summed-area table of the cells and group the points by cell, used to count points within a distance
+ * PARAMETERS:
+ * 	double * x:		points' X values
+ * 	double * y:		points' Y values
+ * 	PointCount count:	the number of points
+ * 	PointCount * weight:	if not NULL, the weight of each point (the number of input points at its location)
+ * 	double xMin:		the minimum X of all points
+ * 	double yMin:		the minimum Y of all points
+ * 	double xMax:		the maximum X of all points
+ * 	double yMax:		the maximum Y of all points
+ * 	double cellSize:	the size (side length) of each cell
+ * RETURN:
+ * 	TYPE:	Lattice *
+ * 	VALUE:	the lattice, to be freed by freeLattice
+ */
+Lattice * buildLattice(double * x, double * y, PointCount count, PointCount * weight, double xMin, double yMin, double xMax, double yMax, double cellSize)
+{
+	Lattice * lattice;
+	if(NULL == (lattice = (Lattice *)malloc(sizeof(Lattice))))
+	{
+		printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+		exit(1);
+	}
+	lattice->xMin = xMin;
+	lattice->yMin = yMin;
+	lattice->cellSize = cellSize;
+	lattice->nX = (int)((xMax - xMin) / cellSize) + 1;
+	lattice->nY = (int)((yMax - yMin) / cellSize) + 1;
+	if((double)(lattice->nX + 1) * (lattice->nY + 1) > LATTICE_MAX_CELLS)
+	{
+		printf("ERROR: The lattice of %d * %d cells is too large, use fewer cells per search radius\n", lattice->nX, lattice->nY);
+		exit(1);
+	}
+
+	int width = lattice->nX + 1;
+	size_t nCells = (size_t)lattice->nX * lattice->nY;
+	int * cell;
+	if(NULL == (lattice->sums = (PointCount *)calloc((size_t)width * (lattice->nY + 1), sizeof(PointCount))) || NULL == (lattice->start = (PointCount *)calloc(nCells + 1, sizeof(PointCount))) || NULL == (cell = (int *)malloc(sizeof(int) * (count + 1))))
+	{
+		printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+		exit(1);
+	}
+	if(NULL == (lattice->x = (double *)malloc(sizeof(double) * (count + 1))) || NULL == (lattice->y = (double *)malloc(sizeof(double) * (count + 1))))
+	{
+		printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+		exit(1);
+	}
+	lattice->weight = NULL;
+	if(NULL != weight && NULL == (lattice->weight = (PointCount *)malloc(sizeof(PointCount) * (count + 1))))
+	{
+		printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+		exit(1);
+	}
+
+	//count the points of each cell (i, j) at sums[(j + 1) * width + (i + 1)], and the number of points at start[j * nX + i + 1]
+	PointCount * sums = lattice->sums;
+	PointCount * start = lattice->start;
+	int colID, rowID;
+	for(PointCount i = 0; i < count; i++)
+	{
+		colID = (int)((x[i] - xMin) / cellSize);
+		rowID = (int)((y[i] - yMin) / cellSize);
+		if(colID >= lattice->nX)
+			colID = lattice->nX - 1;
+		if(rowID >= lattice->nY)
+			rowID = lattice->nY - 1;
+		sums[(size_t)(rowID + 1) * width + colID + 1] += (NULL == weight) ? 1 : weight[i];
+		cell[i] = rowID * lattice->nX + colID;
+		start[cell[i] + 1] ++;
+	}
+
+	//then accumulate them along rows and along columns
+	for(int j = 1; j <= lattice->nY; j++)
+	{
+		for(int i = 1; i <= lattice->nX; i++)
+			sums[(size_t)j * width + i] += sums[(size_t)j * width + i - 1];
+	}
+	for(int j = 1; j <= lattice->nY; j++)
+	{
+		for(int i = 1; i <= lattice->nX; i++)
+			sums[(size_t)j * width + i] += sums[(size_t)(j - 1) * width + i];
+	}
+
+	//group the points by cell, in the order of the cells
+	for(size_t c = 1; c <= nCells; c++)
+		start[c] += start[c - 1];
+	PointCount target;
+	for(PointCount i = 0; i < count; i++)
+	{
+		target = start[cell[i]]++;
+		lattice->x[target] = x[i];
+		lattice->y[target] = y[i];
+		if(NULL != weight)
+			lattice->weight[target] = weight[i];
+	}
+	for(size_t c = nCells; c > 0; c--)
+		start[c] = start[c - 1];
+	start[0] = 0;
+	free(cell);
+	return lattice;
+}
+
+/**
+ * NAME:	freeLattice
+ * DESCRIPTION:	free the memory of a lattice
+ * PARAMETERS:
+ * 	Lattice * lattice: the lattice
+ * RETURN: none
+ */
+void freeLattice(Lattice * lattice)
+{
+	if(NULL == lattice)
+		return;
+	free(lattice->sums);
+	free(lattice->start);
+	free(lattice->x);
+	free(lattice->y);
+	free(lattice->weight);
+	free(lattice);
+}
+
+/**
+ * NAME:	rowCells
+ * DESCRIPTION:	get the cells of a row of a lattice within a range of X
+ * PARAMETERS:
+ * 	Lattice * lattice:	the lattice
+ * 	double from:		the X value where the range starts
+ * 	double to:		the X value where the range ends
+ * 	bool entirely:		true for cells entirely in from..to, false for cells overlapping from..to
+ * 	int &i0:		set to the first cell
+ * 	int &i1:		set to the last cell, less than i0 if there is none
+ * RETURN: none
+ */
+static inline void rowCells(Lattice * lattice, double from, double to, bool entirely, int &i0, int &i1)
+{
+	double a = (from - lattice->xMin) / lattice->cellSize;
+	double b = (to - lattice->xMin) / lattice->cellSize;
+	if(entirely)
+	{
+		i0 = (int)ceil(a);
+		i1 = (int)floor(b) - 1;
+	}
+	else
+	{
+		i0 = (int)floor(a);
+		i1 = (int)floor(b);
+	}
+	if(i0 < 0)
+		i0 = 0;
+	if(i1 > lattice->nX - 1)
+		i1 = lattice->nX - 1;
+}
+
+/**
+ * NAME:	ringCount
+ * DESCRIPTION:	count the points of some cells of a row of a lattice within a distance of a location, testing each point
+ * PARAMETERS:
+ * 	Lattice * lattice:	the lattice
+ * 	int j:			the row
+ * 	int i0:			the first cell
+ * 	int i1:			the last cell
+ * 	double cX:		the X value of the location
+ * 	double cY:		the Y value of the location
+ * 	double dis2:		the square of the distance
+ * RETURN:
+ * 	TYPE:	PointCount
+ * 	VALUE:	the number of points
+ */
+static inline PointCount ringCount(Lattice * lattice, int j, int i0, int i1, double cX, double cY, double dis2)
+{
+	PointCount count = 0;
+	PointCount * start = lattice->start + (size_t)j * lattice->nX;
+	double * x = lattice->x;
+	double * y = lattice->y;
+	for(PointCount iP = start[i0]; iP < start[i1 + 1]; iP++)
+	{
+		if(dis2 >= ((x[iP] - cX) * (x[iP] - cX) + (y[iP] - cY) * (y[iP] - cY)))
+			count += (NULL == lattice->weight) ? 1 : lattice->weight[iP];
+	}
+	return count;
+}
+
+/**
+ * NAME:	latticeCount
+ * DESCRIPTION:	count the points of a lattice within a distance of a location. In each row, the cells entirely within the distance are summed from the summed-area table, and only the points of the ring of cells crossed by the circle are tested one by one
+ * PARAMETERS:
+ * 	Lattice * lattice:	the lattice
+ * 	double cX:		the X value of the location
+ * 	double cY:		the Y value of the location
+ * 	double distance:	the distance
+ * RETURN:
+ * 	TYPE:	PointCount
+ * 	VALUE:	the number of points within the distance
+ */
+PointCount latticeCount(Lattice * lattice, double cX, double cY, double distance)
+{
+	double cellSize = lattice->cellSize;
+	double dis2 = distance * distance;
+	int jMin = (int)floor((cY - distance - lattice->yMin) / cellSize);
+	int jMax = (int)floor((cY + distance - lattice->yMin) / cellSize);
+	if(jMin < 0)
+		jMin = 0;
+	if(jMax > lattice->nY - 1)
+		jMax = lattice->nY - 1;
+
+	size_t width = lattice->nX + 1;
+	PointCount count = 0;
+	double bottom, top, dyNear, dyFar, half;
+	int o0, o1, i0, i1;
+	for(int j = jMin; j <= jMax; j++)
+	{
+		bottom = lattice->yMin + j * cellSize;
+		top = bottom + cellSize;
+		dyNear = (cY < bottom) ? (bottom - cY) : ((cY > top) ? (cY - top) : 0);
+		dyFar = (cY - bottom > top - cY) ? (cY - bottom) : (top - cY);
+		if(dyNear * dyNear > dis2)
+			continue;
+
+		//the cells touching the circle, and those of them entirely within it
+		half = sqrt(dis2 - dyNear * dyNear);
+		rowCells(lattice, cX - half, cX + half, false, o0, o1);
+		if(o0 > o1)
+			continue;
+		i0 = o1 + 1;
+		i1 = o1;
+		if(dyFar * dyFar <= dis2)
+		{
+			half = sqrt(dis2 - dyFar * dyFar);
+			rowCells(lattice, cX - half, cX + half, true, i0, i1);
+		}
+		if(i0 > i1)
+		{
+			count += ringCount(lattice, j, o0, o1, cX, cY, dis2);
+			continue;
+		}
+
+		PointCount * lower = lattice->sums + (size_t)j * width;
+		PointCount * upper = lower + width;
+		count += upper[i1 + 1] - lower[i1 + 1] - upper[i0] + lower[i0];
+		if(o0 < i0)
+			count += ringCount(lattice, j, o0, i0 - 1, cX, cY, dis2);
+		if(i1 < o1)
+			count += ringCount(lattice, j, i1 + 1, o1, cX, cY, dis2);
+	}
+	return count;
+}
+
+/**
+ * NAME:	buildSmoothRaster
+ * DESCRIPTION:	estimate the density of points with a Gaussian kernel: points are binned onto a raster of RASTER_CELLS cells per bandwidth, and the raster is convolved with the kernel along rows and then along columns. The kernel is separable, so each cell costs two passes over a kernel about 6 * RASTER_CELLS cells wide, however many points are near it
+ * PARAMETERS:
+ * 	double * x:		points' X values
+ * 	double * y:		points' Y values
+ * 	PointCount count:	the number of points
+ * 	PointCount * weight:	if not NULL, the weight of each point (the number of input points at its location)
+ * 	double xMin:		the minimum X of all points
+ * 	double yMin:		the minimum Y of all points
+ * 	double xMax:		the maximum X of all points
+ * 	double yMax:		the maximum Y of all points
+ * 	double bandwidth:	the standard deviation of the Gaussian kernel
+ * RETURN:
+ * 	TYPE:	Raster *
+ * 	VALUE:	the raster, to be freed by freeRaster
+ */
+Raster * buildSmoothRaster(double * x, double * y, PointCount count, PointCount * weight, double xMin, double yMin, double xMax, double yMax, double bandwidth)
+{
+	Raster * raster;
+	if(NULL == (raster = (Raster *)malloc(sizeof(Raster))))
+	{
+		printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+		exit(1);
+	}
+	double cellSize = bandwidth / RASTER_CELLS;
+	raster->xMin = xMin;
+	raster->yMin = yMin;
+	raster->cellSize = cellSize;
+	raster->nX = (int)((xMax - xMin) / cellSize) + 1;
+	raster->nY = (int)((yMax - yMin) / cellSize) + 1;
+	if((double)raster->nX * raster->nY > LATTICE_MAX_CELLS)
+	{
+		printf("ERROR: The raster of %d * %d cells is too large, use a larger bandwidth\n", raster->nX, raster->nY);
+		exit(1);
+	}
+
+	int nX = raster->nX;
+	int nY = raster->nY;
+	double * binned;
+	if(NULL == (binned = (double *)calloc((size_t)nX * nY, sizeof(double))) || NULL == (raster->density = (double *)malloc(sizeof(double) * nX * nY)))
+	{
+		printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+		exit(1);
+	}
+
+	int colID, rowID;
+	for(PointCount i = 0; i < count; i++)
+	{
+		colID = (int)((x[i] - xMin) / cellSize);
+		rowID = (int)((y[i] - yMin) / cellSize);
+		if(colID >= nX)
+			colID = nX - 1;
+		if(rowID >= nY)
+			rowID = nY - 1;
+		binned[(size_t)rowID * nX + colID] += (NULL == weight) ? 1 : weight[i];
+	}
+
+	//the kernel is cut at 3 bandwidths, and its taps sum to 1 / cellSize, so that after both passes each point adds a density that integrates to 1
+	int half = 3 * RASTER_CELLS;
+	double kernel[2 * 3 * RASTER_CELLS + 1];
+	double total = 0;
+	for(int k = -half; k <= half; k++)
+	{
+		kernel[k + half] = exp(-0.5 * k * k / ((double)RASTER_CELLS * RASTER_CELLS));
+		total += kernel[k + half];
+	}
+	for(int k = 0; k <= 2 * half; k++)
+		kernel[k] /= total * cellSize;
+
+	//along rows from binned into density, then along columns from density back into binned
+	double * rows = raster->density;
+	#pragma omp parallel for schedule(dynamic, 16)
+	for(int j = 0; j < nY; j++)
+	{
+		double * in = binned + (size_t)j * nX;
+		double * out = rows + (size_t)j * nX;
+		for(int i = 0; i < nX; i++)
+		{
+			double sum = 0;
+			int kMin = (i - half < 0) ? -i : -half;
+			int kMax = (i + half > nX - 1) ? (nX - 1 - i) : half;
+			for(int k = kMin; k <= kMax; k++)
+				sum += kernel[k + half] * in[i + k];
+			out[i] = sum;
+		}
+	}
+	#pragma omp parallel for schedule(dynamic, 16)
+	for(int j = 0; j < nY; j++)
+	{
+		double * out = binned + (size_t)j * nX;
+		int kMin = (j - half < 0) ? -j : -half;
+		int kMax = (j + half > nY - 1) ? (nY - 1 - j) : half;
+		for(int i = 0; i < nX; i++)
+			out[i] = 0;
+		for(int k = kMin; k <= kMax; k++)
+		{
+			double w = kernel[k + half];
+			double * in = rows + (size_t)(j + k) * nX;
+			for(int i = 0; i < nX; i++)
+				out[i] += w * in[i];
+		}
+	}
+	raster->density = binned;
+	free(rows);
+	return raster;
+}
+
+/**
+ * NAME:	freeRaster
+ * DESCRIPTION:	free the memory of a raster
+ * PARAMETERS:
+ * 	Raster * raster: the raster
+ * RETURN: none
+ */
+void freeRaster(Raster * raster)
+{
+	if(NULL == raster)
+		return;
+	free(raster->density);
+	free(raster);
+}
+
+/**
+ * NAME:	rasterDensity
+ * DESCRIPTION:	get the density of a raster at a location, interpolated bilinearly between the centers of the four nearest cells
+ * PARAMETERS:
+ * 	Raster * raster:	the raster
+ * 	double cX:		the X value of the location
+ * 	double cY:		the Y value of the location
+ * RETURN:
+ * 	TYPE:	double
+ * 	VALUE:	the density (points per unit area)
+ */
+double rasterDensity(Raster * raster, double cX, double cY)
+{
+	double a = (cX - raster->xMin) / raster->cellSize - 0.5;
+	double b = (cY - raster->yMin) / raster->cellSize - 0.5;
+	int i0 = (int)floor(a);
+	int j0 = (int)floor(b);
+	double fx = a - i0;
+	double fy = b - j0;
+	int i1 = i0 + 1;
+	int j1 = j0 + 1;
+	if(i0 < 0)
+		i0 = 0;
+	if(j0 < 0)
+		j0 = 0;
+	if(i1 > raster->nX - 1)
+		i1 = raster->nX - 1;
+	if(j1 > raster->nY - 1)
+		j1 = raster->nY - 1;
+	if(i0 > i1)
+		i0 = i1;
+	if(j0 > j1)
+		j0 = j1;
+
+	double * lower = raster->density + (size_t)j0 * raster->nX;
+	double * upper = raster->density + (size_t)j1 * raster->nX;
+	return (1 - fy) * ((1 - fx) * lower[i0] + fx * lower[i1]) + fy * ((1 - fx) * upper[i0] + fx * upper[i1]);
+}
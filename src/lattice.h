@@ -0,0 +1,38 @@
+#ifndef LATH
+#define LATH
+
+#include "pointCount.h"
+
+//the largest number of cells of a lattice
+#define LATTICE_MAX_CELLS (1 << 28)
+//the number of raster cells per bandwidth of a smoothed density
+#define RASTER_CELLS 4
+
+//a regular lattice of square cells with the summed-area table of the points (or weights) in its cells, and the points themselves grouped by cell
+struct Lattice {
+	double xMin, yMin;	//the lower left corner of cell (0, 0)
+	double cellSize;
+	int nX, nY;		//the number of cells along X and Y dimension
+	PointCount * sums;	//(nX + 1) * (nY + 1) entries, sums[j * (nX + 1) + i] is the number of points in the cells of rows < j and columns < i
+	PointCount * start;	//nX * nY + 1 entries, the points of cell (i, j) are start[j * nX + i] to start[j * nX + i + 1] - 1
+	double * x;		//the points' X values, grouped by cell
+	double * y;		//the points' Y values, grouped by cell
+	PointCount * weight;	//NULL, or the points' weights grouped by cell
+};
+
+//a regular raster of square cells holding a smoothed density of points (points per unit area) at the center of each cell
+struct Raster {
+	double xMin, yMin;	//the lower left corner of cell (0, 0)
+	double cellSize;
+	int nX, nY;		//the number of cells along X and Y dimension
+	double * density;	//nX * nY entries, density[j * nX + i] is the density at the center of cell (i, j)
+};
+
+Lattice * buildLattice(double * x, double * y, PointCount count, PointCount * weight, double xMin, double yMin, double xMax, double yMax, double cellSize);
+void freeLattice(Lattice * lattice);
+PointCount latticeCount(Lattice * lattice, double cX, double cY, double distance);
+Raster * buildSmoothRaster(double * x, double * y, PointCount count, PointCount * weight, double xMin, double yMin, double xMax, double yMax, double bandwidth);
+void freeRaster(Raster * raster);
+double rasterDensity(Raster * raster, double cX, double cY);
+
+#endif
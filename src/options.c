@@ -0,0 +1,156 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "options.h"
+#include "io.h"
+
+/**
+ * NAME:	initOptions
+ * DESCRIPTION:	set all optional settings to their defaults
+ * PARAMETERS:
+ * 	Options & opts: the settings to initialize
+ * RETURN: none
+ */
+void initOptions(Options & opts)
+{
+	opts.binaryOutput = false;
+	opts.clusteredOnly = false;
+	opts.parallelRead = false;
+	opts.summaryFile = NULL;
+	opts.index = INDEX_AUTO;
+	opts.kdThreshold = 10000;
+	opts.coreOnly = false;
+	opts.dedup = false;
+	opts.approxCells = 0;
+	opts.smoothBandwidth = 0;
+	opts.sortX = false;
+	opts.pipeline = false;
+	opts.geo = false;
+	opts.eventList = false;
+}
+
+/**
+ * NAME:	parseOptions
+ * DESCRIPTION:	parse the optional settings following the positional arguments of a tool
+ * PARAMETERS:
+ * 	int argc:	the number of command line arguments
+ * 	char ** argv:	the command line arguments
+ * 	int first:	the position of the first optional argument
+ * 	Options & opts:	the settings to update, should be initialized by initOptions
+ * RETURN:
+ * 	TYPE:	bool
+ * 	VALUE:	false if an unknown option is found
+ */
+bool parseOptions(int argc, char ** argv, int first, Options & opts)
+{
+	for(int i = first; i < argc; i++)
+	{
+		if(0 == strcmp(argv[i], "-binary"))
+			opts.binaryOutput = true;
+		else if(0 == strcmp(argv[i], "-clusteredOnly"))
+			opts.clusteredOnly = true;
+		else if(0 == strcmp(argv[i], "-parallelRead"))
+			opts.parallelRead = true;
+		else if(0 == strcmp(argv[i], "-summary") && i + 1 < argc)
+			opts.summaryFile = argv[++i];
+		else if(0 == strcmp(argv[i], "-index") && i + 1 < argc)
+		{
+			i ++;
+			if(0 == strcmp(argv[i], "auto"))
+				opts.index = INDEX_AUTO;
+			else if(0 == strcmp(argv[i], "grid"))
+				opts.index = INDEX_GRID;
+			else if(0 == strcmp(argv[i], "kdtree"))
+				opts.index = INDEX_KDTREE;
+			else
+			{
+				printf("ERROR! Unknown index %s\n", argv[i]);
+				return false;
+			}
+		}
+		else if(0 == strcmp(argv[i], "-kdThreshold") && i + 1 < argc)
+			opts.kdThreshold = atoi(argv[++i]);
+		else if(0 == strcmp(argv[i], "-coreOnly"))
+			opts.coreOnly = true;
+		else if(0 == strcmp(argv[i], "-dedup"))
+			opts.dedup = true;
+		else if(0 == strcmp(argv[i], "-approx") && i + 1 < argc)
+		{
+			opts.approxCells = atoi(argv[++i]);
+			if(opts.approxCells < 1)
+			{
+				printf("ERROR! -approx needs a positive number of cells\n");
+				return false;
+			}
+		}
+		else if(0 == strcmp(argv[i], "-smooth") && i + 1 < argc)
+		{
+			opts.smoothBandwidth = atof(argv[++i]);
+			if(opts.smoothBandwidth <= 0)
+			{
+				printf("ERROR! -smooth needs a positive bandwidth\n");
+				return false;
+			}
+		}
+		else if(0 == strcmp(argv[i], "-sortX"))
+			opts.sortX = true;
+		else if(0 == strcmp(argv[i], "-pipeline"))
+			opts.pipeline = true;
+		else if(0 == strcmp(argv[i], "-geo"))
+			opts.geo = true;
+		else if(0 == strcmp(argv[i], "-eventList"))
+			opts.eventList = true;
+		else
+		{
+			printf("ERROR! Unknown option %s\n", argv[i]);
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * NAME:	printOptionsUsage
+ * DESCRIPTION:	print the optional settings shared by all tools
+ * PARAMETERS: none
+ * RETURN: none
+ */
+void printOptionsUsage()
+{
+	printf("Options:\n");
+	printf("  -binary         write cluster IDs and input order in the binary format\n");
+	printf("  -clusteredOnly  only write points that belong to a cluster\n");
+	printf("  -parallelRead   parse input files with multiple threads\n");
+	printf("  -summary file   write the statistics of each cluster to file (ESCIB_Poisson, ESCIB_Bernoulli)\n");
+	printf("  -index type     how points are searched: auto (default), grid or kdtree\n");
+	printf("  -kdThreshold n  auto uses a KD-tree when a grid block has more than n points (default 10000)\n");
+	printf("  -coreOnly       stop counting neighbors of a point once it is a core point (not with -summary)\n");
+	printf("  -dedup          count and cluster each distinct location once, weighted by its number of points\n");
+	printf("  -approx n       count on a lattice of n cells per search radius, testing only the points in cells crossed by the search circle\n");
+	printf("  -smooth h       estimate the background near each event from a Gaussian kernel density of bandwidth h (ESCIB_Poisson)\n");
+	printf("  -sortX          sort points by X within each grid block and only test the X window of the search\n");
+	printf("  -pipeline       read and index both inputs at the same time (ESCIB_Poisson, ESCIB_Bernoulli)\n");
+	printf("  -geo            inputs are longitude latitude in degrees, the radius is in meters along great circles\n");
+	printf("  -eventList      inputEvents lists event files and their outputs, clustered against one background; output is a report (ESCIB_Poisson)\n");
+}
+
+/**
+ * NAME:	useKDTree
+ * DESCRIPTION:	decide whether a set of points should be searched with a KD-tree instead of the grid blocks
+ * PARAMETERS:
+ * 	Options & opts:	the settings
+ * 	PointCount * index:	the index of the points, created by indexPoints
+ * 	int nBlockX:	the number of index blocks along X dimension
+ * 	int nBlockY:	the number of index blocks along Y dimension
+ * RETURN:
+ * 	TYPE:	bool
+ * 	VALUE:	true if a KD-tree should be used, never with -geo since KD-trees search planar distances
+ */
+bool useKDTree(Options & opts, PointCount * index, int nBlockX, int nBlockY)
+{
+	if(opts.geo)
+		return false;
+	if(opts.index == INDEX_AUTO)
+		return maxPointsInBlock(index, nBlockX, nBlockY) > opts.kdThreshold;
+	return opts.index == INDEX_KDTREE;
+}
@@ -0,0 +1,34 @@
+#ifndef OPTH
+#define OPTH
+
+#include "pointCount.h"
+
+//how points are indexed for neighbor search
+#define INDEX_AUTO 0		//a KD-tree for point sets with more points than kdThreshold in any grid block
+#define INDEX_GRID 1
+#define INDEX_KDTREE 2
+
+//optional settings given after the positional arguments of each tool
+struct Options {
+	bool binaryOutput;	//write labels and input order in the binary format instead of csv
+	bool clusteredOnly;	//skip points not in any cluster (cluster ID -1) in the output
+	bool parallelRead;	//parse input files with multiple threads
+	char * summaryFile;	//if not NULL, write the statistics of each cluster to this file
+	int index;		//INDEX_AUTO, INDEX_GRID or INDEX_KDTREE
+	int kdThreshold;	//the largest number of points in a grid block before INDEX_AUTO uses a KD-tree
+	bool coreOnly;		//stop counting neighbors once a point is known to be a core point
+	bool dedup;		//collapse points with identical coordinates into weighted locations
+	int approxCells;	//if not 0, approximate counts on a lattice with this many cells per search radius
+	double smoothBandwidth;	//if not 0, ESCIB_Poisson estimates the background near each event from a density smoothed with a Gaussian kernel of this bandwidth
+	bool sortX;		//sort points by X within each grid block, so that searches only test the points of each row strip within the search radius along X
+	bool pipeline;		//read and index the two inputs of a tool at the same time, counting the first input while the second is indexed
+	bool geo;		//points are longitudes and latitudes in degrees, and the search radius is in meters along great circles
+	bool eventList;		//ESCIB_Poisson clusters every event file of a list against one background indexed once
+};
+
+void initOptions(Options & opts);
+bool parseOptions(int argc, char ** argv, int first, Options & opts);
+void printOptionsUsage();
+bool useKDTree(Options & opts, PointCount * index, int nBlockX, int nBlockY);
+
+#endif
@@ -0,0 +1,429 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "output.h"
+
+#define OUTPUT_BUFFER_SIZE (1 << 22)
+//the longest text of a double written by formatDouble: "%lf" of -DBL_MAX is 317 characters
+#define OUTPUT_MAX_DOUBLE 320
+//the longest row (two doubles, a type, a category, a cluster ID) written without checking the remaining space
+#define OUTPUT_MAX_ROW (2 * OUTPUT_MAX_DOUBLE + 80)
+//the longest row of a cluster summary (eight doubles, five integers)
+#define OUTPUT_MAX_SUMMARY_ROW (8 * OUTPUT_MAX_DOUBLE + 140)
+
+/**
+ * NAME:	openOutput
+ * DESCRIPTION:	open an output file for writing through a large buffer
+ * PARAMETERS:
+ * 	const char * fileName: the output file name
+ * RETURN:
+ * 	TYPE:	OutputBuffer *
+ * 	VALUE:	the buffered output, to be closed by closeOutput
+ */
+OutputBuffer * openOutput(const char * fileName)
+{
+	OutputBuffer * out;
+	if(NULL == (out = (OutputBuffer *)malloc(sizeof(OutputBuffer))))
+	{
+		printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+		exit(1);
+	}
+	if(NULL == (out->buffer = (char *)malloc(OUTPUT_BUFFER_SIZE)))
+	{
+		printf("ERROR: Out of memory at line %d in file %s\n", __LINE__, __FILE__);
+		exit(1);
+	}
+	out->size = OUTPUT_BUFFER_SIZE;
+	reopenOutput(out, fileName);
+	return out;
+}
+
+/**
+ * NAME:	reopenOutput
+ * DESCRIPTION:	start writing another output file through the buffer of an output finished by finishOutput, so that a series of output files reuses one buffer
+ * PARAMETERS:
+ * 	OutputBuffer * out:	the buffered output, without an open file
+ * 	const char * fileName:	the output file name
+ * RETURN: none
+ */
+void reopenOutput(OutputBuffer * out, const char * fileName)
+{
+	if(NULL == (out->file = fopen(fileName, "wb")))
+	{
+		printf("ERROR: Can't open the output file.\n");
+		exit(1);
+	}
+	out->used = 0;
+}
+
+/**
+ * NAME:	flushOutput
+ * DESCRIPTION:	write all buffered bytes to the output file
+ * PARAMETERS:
+ * 	OutputBuffer * out: the buffered output
+ * RETURN: none
+ */
+static void flushOutput(OutputBuffer * out)
+{
+	if(out->used > 0 && fwrite(out->buffer, 1, out->used, out->file) != out->used)
+	{
+		printf("ERROR: Can't write the output file.\n");
+		exit(1);
+	}
+	out->used = 0;
+}
+
+/**
+ * NAME:	finishOutput
+ * DESCRIPTION:	flush and close the file of a buffered output, keeping its buffer for reopenOutput
+ * PARAMETERS:
+ * 	OutputBuffer * out: the buffered output
+ * RETURN: none
+ */
+void finishOutput(OutputBuffer * out)
+{
+	flushOutput(out);
+	fclose(out->file);
+	out->file = NULL;
+}
+
+/**
+ * NAME:	closeOutput
+ * DESCRIPTION:	flush and close a buffered output
+ * PARAMETERS:
+ * 	OutputBuffer * out: the buffered output, freed by this function; its file may have been finished already
+ * RETURN: none
+ */
+void closeOutput(OutputBuffer * out)
+{
+	if(NULL != out->file)
+		finishOutput(out);
+	free(out->buffer);
+	free(out);
+}
+
+/**
+ * NAME:	putBytes
+ * DESCRIPTION:	append raw bytes to a buffered output
+ * PARAMETERS:
+ * 	OutputBuffer * out:	the buffered output
+ * 	const void * data:	the bytes to write
+ * 	size_t n:		the number of bytes
+ * RETURN: none
+ */
+static void putBytes(OutputBuffer * out, const void * data, size_t n)
+{
+	const char * p = (const char *)data;
+	while(n > 0)
+	{
+		if(out->used == out->size)
+			flushOutput(out);
+		size_t step = out->size - out->used;
+		if(step > n)
+			step = n;
+		memcpy(out->buffer + out->used, p, step);
+		out->used += step;
+		p += step;
+		n -= step;
+	}
+}
+
+/**
+ * NAME:	formatUnsigned
+ * DESCRIPTION:	write the decimal digits of a non-negative integer
+ * PARAMETERS:
+ * 	char * p:		where to write the digits
+ * 	unsigned long long v:	the value
+ * 	int minDigits:		the minimum number of digits, padded with leading zeros
+ * RETURN:
+ * 	TYPE:	char *
+ * 	VALUE:	the position after the last digit
+ */
+static char * formatUnsigned(char * p, unsigned long long v, int minDigits)
+{
+	char digits[24];
+	int n = 0;
+	do {
+		digits[n++] = (char)('0' + v % 10);
+		v /= 10;
+	} while(v > 0);
+	while(n < minDigits)
+		digits[n++] = '0';
+	while(n > 0)
+		*p++ = digits[--n];
+	return p;
+}
+
+/**
+ * NAME:	formatInt
+ * DESCRIPTION:	write an integer the same way as printf("%lld")
+ * PARAMETERS:
+ * 	char * p:	where to write the text
+ * 	long long v:	the value
+ * RETURN:
+ * 	TYPE:	char *
+ * 	VALUE:	the position after the text
+ */
+static char * formatInt(char * p, long long v)
+{
+	if(v < 0)
+	{
+		*p++ = '-';
+		return formatUnsigned(p, 0ULL - (unsigned long long)v, 1);
+	}
+	return formatUnsigned(p, (unsigned long long)v, 1);
+}
+
+/**
+ * NAME:	printDouble
+ * DESCRIPTION:	write a double with snprintf("%lf"), for the values formatDouble can't format itself
+ * PARAMETERS:
+ * 	char * p:	where to write the text, with room for OUTPUT_MAX_DOUBLE characters
+ * 	double v:	the value
+ * RETURN:
+ * 	TYPE:	char *
+ * 	VALUE:	the position after the text
+ */
+static char * printDouble(char * p, double v)
+{
+	//snprintf returns the length it would have written, which is only reached when nothing was cut
+	int n = snprintf(p, OUTPUT_MAX_DOUBLE, "%lf", v);
+	if(n < 0)
+		n = 0;
+	else if(n >= OUTPUT_MAX_DOUBLE)
+		n = OUTPUT_MAX_DOUBLE - 1;
+	return p + n;
+}
+
+/**
+ * NAME:	formatDouble
+ * DESCRIPTION:	write a double the same way as printf("%lf"), i.e. with 6 decimals. The integer and fraction parts are split exactly so only the fraction is scaled; values too large for this or too close to a rounding tie fall back to snprintf
+ * PARAMETERS:
+ * 	char * p:	where to write the text
+ * 	double v:	the value
+ * RETURN:
+ * 	TYPE:	char *
+ * 	VALUE:	the position after the text
+ */
+static char * formatDouble(char * p, double v)
+{
+	if(!(v > -1e15 && v < 1e15))
+		return printDouble(p, v);
+
+	bool negative = signbit(v);
+	double a = fabs(v);
+	double intPart = floor(a);
+	//exact, the fraction of a double is always representable
+	double scaled = (a - intPart) * 1000000.0;
+	double rounded = floor(scaled + 0.5);
+	if(fabs(scaled - floor(scaled) - 0.5) < 1e-6)
+		return printDouble(p, v);
+
+	unsigned long long ip = (unsigned long long)intPart;
+	unsigned long long frac = (unsigned long long)rounded;
+	if(frac == 1000000)
+	{
+		ip ++;
+		frac = 0;
+	}
+	if(negative)
+		*p++ = '-';
+	p = formatUnsigned(p, ip, 1);
+	*p++ = '.';
+	return formatUnsigned(p, frac, 6);
+}
+
+/**
+ * NAME:	writeLabelsCSV
+ * DESCRIPTION:	write points and their cluster IDs as csv rows "x,y,clusterID", or "x,y,type,clusterID" if a type is given
+ * PARAMETERS:
+ * 	OutputBuffer * out:	the buffered output
+ * 	double * x:		points' X values
+ * 	double * y:		points' Y values
+ * 	int * clusterID:	the cluster ID of each point
+ * 	PointCount count:	the number of points
+ * 	int type:		the type column written for each point, or -1 to omit it
+ * 	bool clusteredOnly:	whether to skip points not in any cluster
+ * RETURN: none
+ */
+void writeLabelsCSV(OutputBuffer * out, double * x, double * y, int * clusterID, PointCount count, int type, bool clusteredOnly)
+{
+	char * p;
+	for(PointCount i = 0; i < count; i++)
+	{
+		if(clusteredOnly && clusterID[i] == -1)
+			continue;
+		if(out->size - out->used < OUTPUT_MAX_ROW)
+			flushOutput(out);
+		p = out->buffer + out->used;
+		p = formatDouble(p, x[i]);
+		*p++ = ',';
+		p = formatDouble(p, y[i]);
+		*p++ = ',';
+		if(type >= 0)
+		{
+			p = formatInt(p, type);
+			*p++ = ',';
+		}
+		p = formatInt(p, clusterID[i]);
+		*p++ = '\n';
+		out->used = p - out->buffer;
+	}
+}
+
+/**
+ * NAME:	writeCategoryLabelsCSV
+ * DESCRIPTION:	write points and their cluster IDs as csv rows "x,y,type,category,clusterID"
+ * PARAMETERS:
+ * 	OutputBuffer * out:	the buffered output
+ * 	double * x:		points' X values
+ * 	double * y:		points' Y values
+ * 	int * category:		the category of each point
+ * 	int * clusterID:	the cluster ID of each point
+ * 	PointCount count:	the number of points
+ * 	int type:		the type column written for each point
+ * 	bool clusteredOnly:	whether to skip points not in any cluster
+ * RETURN: none
+ */
+void writeCategoryLabelsCSV(OutputBuffer * out, double * x, double * y, int * category, int * clusterID, PointCount count, int type, bool clusteredOnly)
+{
+	char * p;
+	for(PointCount i = 0; i < count; i++)
+	{
+		if(clusteredOnly && clusterID[i] == -1)
+			continue;
+		if(out->size - out->used < OUTPUT_MAX_ROW)
+			flushOutput(out);
+		p = out->buffer + out->used;
+		p = formatDouble(p, x[i]);
+		*p++ = ',';
+		p = formatDouble(p, y[i]);
+		*p++ = ',';
+		p = formatInt(p, type);
+		*p++ = ',';
+		p = formatInt(p, category[i]);
+		*p++ = ',';
+		p = formatInt(p, clusterID[i]);
+		*p++ = '\n';
+		out->used = p - out->buffer;
+	}
+}
+
+/**
+ * NAME:	writeLabelsBinary
+ * DESCRIPTION:	write cluster IDs and input order of points in the binary format: an OutputHeader, the cluster IDs of all written rows, then the input order of all written rows. Rows of the 2nd input follow rows of the 1st input in both arrays
+ * PARAMETERS:
+ * 	const char * fileName:	the output file name
+ * 	int * clusterID:	the cluster ID of each point of the 1st input
+ * 	PointCount * order:	the order in the input file of each point of the 1st input
+ * 	PointCount count:	the number of points of the 1st input
+ * 	int * clusterID2:	the cluster ID of each point of the 2nd input, NULL if there is none
+ * 	PointCount * order2:	the order in the input file of each point of the 2nd input, NULL if there is none
+ * 	PointCount count2:	the number of points of the 2nd input
+ * 	bool clusteredOnly:	whether to skip points not in any cluster
+ * RETURN: none
+ */
+void writeLabelsBinary(const char * fileName, int * clusterID, PointCount * order, PointCount count, int * clusterID2, PointCount * order2, PointCount count2, bool clusteredOnly)
+{
+	OutputHeader header;
+	memset(&header, 0, sizeof(OutputHeader));
+	memcpy(header.magic, OUTPUT_MAGIC, 8);
+	header.version = OUTPUT_VERSION;
+	header.indexBytes = sizeof(PointCount);
+
+	int * ids[2] = {clusterID, clusterID2};
+	PointCount * orders[2] = {order, order2};
+	PointCount counts[2] = {count, (NULL == clusterID2) ? 0 : count2};
+
+	for(int s = 0; s < 2; s++)
+	{
+		if(!clusteredOnly)
+		{
+			header.count[s] = counts[s];
+			continue;
+		}
+		for(PointCount i = 0; i < counts[s]; i++)
+		{
+			if(ids[s][i] != -1)
+				header.count[s] ++;
+		}
+	}
+
+	OutputBuffer * out = openOutput(fileName);
+	putBytes(out, &header, sizeof(OutputHeader));
+	for(int s = 0; s < 2; s++)
+	{
+		if(!clusteredOnly)
+		{
+			putBytes(out, ids[s], sizeof(int) * counts[s]);
+			continue;
+		}
+		for(PointCount i = 0; i < counts[s]; i++)
+		{
+			if(ids[s][i] != -1)
+				putBytes(out, ids[s] + i, sizeof(int));
+		}
+	}
+	for(int s = 0; s < 2; s++)
+	{
+		for(PointCount i = 0; i < counts[s]; i++)
+		{
+			if(!clusteredOnly || ids[s][i] != -1)
+				putBytes(out, orders[s] + i, sizeof(PointCount));
+		}
+	}
+	closeOutput(out);
+}
+
+/**
+ * NAME:	writeClusterSummary
+ * DESCRIPTION:	write the statistics of all clusters as a csv with a header row, one row per cluster
+ * PARAMETERS:
+ * 	const char * fileName:	the output file name
+ * 	ClusterSummaries & summaries:	the statistics of all clusters
+ * RETURN: none
+ */
+void writeClusterSummary(const char * fileName, ClusterSummaries & summaries)
+{
+	OutputBuffer * out = openOutput(fileName);
+	const char * header = "clusterID,members,cores,xMin,yMin,xMax,yMax,centroidX,centroidY,cases,controls,expected,ratio\n";
+	putBytes(out, header, strlen(header));
+
+	char * p;
+	for(int i = 0; i < summaries.count; i++)
+	{
+		ClusterSummary & s = summaries.items[i];
+		if(out->size - out->used < OUTPUT_MAX_SUMMARY_ROW)
+			flushOutput(out);
+		p = out->buffer + out->used;
+		p = formatInt(p, s.clusterID);
+		*p++ = ',';
+		p = formatInt(p, s.members);
+		*p++ = ',';
+		p = formatInt(p, s.cores);
+		*p++ = ',';
+		p = formatDouble(p, s.xMin);
+		*p++ = ',';
+		p = formatDouble(p, s.yMin);
+		*p++ = ',';
+		p = formatDouble(p, s.xMax);
+		*p++ = ',';
+		p = formatDouble(p, s.yMax);
+		*p++ = ',';
+		p = formatDouble(p, s.sumX / s.members);
+		*p++ = ',';
+		p = formatDouble(p, s.sumY / s.members);
+		*p++ = ',';
+		p = formatInt(p, s.cases);
+		*p++ = ',';
+		p = formatInt(p, s.controls);
+		*p++ = ',';
+		p = formatDouble(p, s.expected);
+		*p++ = ',';
+		p = formatDouble(p, (s.expected > 0) ? s.cases / s.expected : 0);
+		*p++ = '\n';
+		out->used = p - out->buffer;
+	}
+	closeOutput(out);
+}
@@ -0,0 +1,35 @@
+#ifndef OUTH
+#define OUTH
+
+#include <stdio.h>
+#include "clusters.h"
+
+#define OUTPUT_MAGIC "ESCIBOUT"
+#define OUTPUT_VERSION 1
+
+//header of a binary output file, followed by the cluster IDs (int) of all written rows and then by their order (indexBytes each, 8 in the large-data build) in the input files
+struct OutputHeader {
+	char magic[8];		//OUTPUT_MAGIC without the terminating zero
+	int version;		//OUTPUT_VERSION
+	int indexBytes;		//the size of each input order entry
+	long long count[2];	//rows written from the 1st (events or cases) and the 2nd (controls) input
+};
+
+//a large write buffer in front of an output file
+struct OutputBuffer {
+	FILE * file;
+	char * buffer;
+	size_t used;
+	size_t size;
+};
+
+OutputBuffer * openOutput(const char * fileName);
+void reopenOutput(OutputBuffer * out, const char * fileName);
+void finishOutput(OutputBuffer * out);
+void closeOutput(OutputBuffer * out);
+void writeLabelsCSV(OutputBuffer * out, double * x, double * y, int * clusterID, PointCount count, int type, bool clusteredOnly);
+void writeCategoryLabelsCSV(OutputBuffer * out, double * x, double * y, int * category, int * clusterID, PointCount count, int type, bool clusteredOnly);
+void writeLabelsBinary(const char * fileName, int * clusterID, PointCount * order, PointCount count, int * clusterID2, PointCount * order2, PointCount count2, bool clusteredOnly);
+void writeClusterSummary(const char * fileName, ClusterSummaries & summaries);
+
+#endif
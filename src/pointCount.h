@@ -0,0 +1,15 @@
+#ifndef PCH
+#define PCH
+
+#include <limits.h>
+
+//the type of numbers of points, array indices and index offsets. The large-data build (make LARGE=1) makes it 64-bit for inputs of more than 2^31 points; cluster IDs stay int
+#ifdef ESCIB_LARGE
+typedef long long PointCount;
+#define POINT_COUNT_MAX LLONG_MAX
+#else
+typedef int PointCount;
+#define POINT_COUNT_MAX INT_MAX
+#endif
+
+#endif